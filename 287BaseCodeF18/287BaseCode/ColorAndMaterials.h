@@ -44,6 +44,7 @@ struct Material {
 	Material &operator +=(const Material &mat);
 	Material operator +(const Material &mat) const;
 	Material operator -(const Material &mat) const;
+	bool operator ==(const Material &mat) const;
 	static Material makeTransparent(float alpha, const color &C);
 };
 
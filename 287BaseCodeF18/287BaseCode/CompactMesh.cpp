@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <cmath>
+#include "CompactMesh.h"
+
+/**
+ * @fn	static float signNotZero(float v)
+ * @brief	Sign of a value, treating 0 as positive.
+ * @param	v	The value.
+ * @return	-1 or 1.
+ */
+
+static float signNotZero(float v) {
+	return v < 0.0f ? -1.0f : 1.0f;
+}
+
+/**
+ * @fn	uint32_t encodeOctahedral(const glm::vec3 &n)
+ * @brief	Packs a unit vector into 32 bits. The vector is projected onto the
+ * 			octahedron |x|+|y|+|z| = 1, whose lower half is folded over the upper
+ * 			one, and the resulting square is stored as two 16 bit snorms.
+ * @param	n	The unit vector.
+ * @return	The packed vector.
+ */
+
+uint32_t encodeOctahedral(const glm::vec3 &n) {
+	const float L1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	float u = L1 > 0.0f ? n.x / L1 : 0.0f;
+	float v = L1 > 0.0f ? n.y / L1 : 0.0f;
+	if (n.z < 0.0f) {
+		const float foldedU = (1.0f - std::abs(v)) * signNotZero(u);
+		const float foldedV = (1.0f - std::abs(u)) * signNotZero(v);
+		u = foldedU;
+		v = foldedV;
+	}
+	const int16_t U = (int16_t)std::round(std::min(std::max(u, -1.0f), 1.0f) * 32767.0f);
+	const int16_t V = (int16_t)std::round(std::min(std::max(v, -1.0f), 1.0f) * 32767.0f);
+	return (uint32_t)(uint16_t)U | ((uint32_t)(uint16_t)V << 16);
+}
+
+/**
+ * @fn	glm::vec3 decodeOctahedral(uint32_t packed)
+ * @brief	Unpacks a unit vector packed by encodeOctahedral.
+ * @param	packed	The packed vector.
+ * @return	The unit vector.
+ */
+
+glm::vec3 decodeOctahedral(uint32_t packed) {
+	const float u = (int16_t)(packed & 0xFFFF) / 32767.0f;
+	const float v = (int16_t)(packed >> 16) / 32767.0f;
+	glm::vec3 n(u, v, 1.0f - std::abs(u) - std::abs(v));
+	if (n.z < 0.0f) {
+		const float x = (1.0f - std::abs(v)) * signNotZero(u);
+		const float y = (1.0f - std::abs(u)) * signNotZero(v);
+		n.x = x;
+		n.y = y;
+	}
+	return glm::normalize(n);
+}
+
+/**
+ * @fn	CompactMesh::CompactMesh(const IndexedMesh &mesh)
+ * @brief	Packs an indexed mesh.
+ * @param	mesh	The mesh.
+ */
+
+CompactMesh::CompactMesh(const IndexedMesh &mesh) : indices(mesh.indices), bounds(mesh.bounds) {
+	const int N = (int)mesh.vertices.size();
+	x.resize(N); y.resize(N); z.resize(N);
+	normals.resize(N);
+	materials.resize(N);
+	for (int i = 0; i < N; i++) {
+		const VertexData &v = mesh.vertices[i];
+		x[i] = v.position.x;
+		y[i] = v.position.y;
+		z[i] = v.position.z;
+		normals[i] = encodeOctahedral(glm::normalize(v.normal));
+		materials[i] = v.materialID;
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "IndexedMesh.h"
+#include "MaterialTable.h"
+
+uint32_t encodeOctahedral(const glm::vec3 &n);
+glm::vec3 decodeOctahedral(uint32_t packed);
+
+/**
+ * @struct	CompactMesh
+ * @brief	An indexed mesh stored for size: separate streams of positions,
+ * 			normals packed into 32 bits by octahedral encoding, and 16 bit
+ * 			indices into the MaterialTable. 18 bytes per vertex, against about
+ * 			100 for a VertexData, so large meshes stay in cache. Positions are
+ * 			points; w is taken to be 1.
+ */
+
+struct CompactMesh {
+	std::vector<float> x, y, z;				//!< Positions.
+	std::vector<uint32_t> normals;			//!< Octahedral encoded unit normals.
+	std::vector<MaterialIndex> materials;	//!< Each vertex's material.
+	std::vector<uint32_t> indices;			//!< Index triplets, one per triangle.
+	ObjectBounds bounds;					//!< Bounds of the vertices.
+
+	CompactMesh() {}
+	explicit CompactMesh(const IndexedMesh &mesh);
+	int size() const { return (int)x.size(); }
+	int triangleCount() const { return (int)indices.size() / 3; }
+};
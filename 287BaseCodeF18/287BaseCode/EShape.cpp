@@ -2,7 +2,7 @@
 
 /**
  * @fn	EShapeData EShape::createEDisk(const Material &mat, float radius, int slices)
- * @brief	Creates a disk.
+ * @brief	Creates a disk, centered on (0,0,0) in the xz plane and facing +y.
  * @param	mat   	Material.
  * @param	radius	Radius.
  * @param	slices	Number of slices.
@@ -11,6 +11,18 @@
 
 EShapeData EShape::createEDisk(const Material &mat, float radius, int slices) {
 	EShapeData result;
+	float angle = M_2PI / slices;
+	glm::vec4 center(0, 0, 0, 1);
+	glm::vec3 N(0, 1, 0);
+	for (int i = 0; i < slices; i++) {
+		glm::vec2 p1 = pointOnCircle({ 0, 0 }, radius, i * angle);
+		glm::vec2 p2 = pointOnCircle({ 0, 0 }, radius, (i + 1) * angle);
+		glm::vec4 V1(p1[0], 0, p1[1], 1);
+		glm::vec4 V2(p2[0], 0, p2[1], 1);
+		result.push_back(VertexData(center, N, mat));
+		result.push_back(VertexData(V2, N, mat));
+		result.push_back(VertexData(V1, N, mat));
+	}
 	return result;
 }
 
@@ -3,6 +3,7 @@
 
 #include <utility>
 #include "VertexData.h"
+#include "IndexedMesh.h"
 #include "FrameBuffer.h"
 #include "Light.h"
 
@@ -13,7 +14,7 @@ typedef std::vector<VertexData> EShapeData;
  * @brief	This class contains functions that create explicitly represented shapes.
  * 			This class is used within pipeline applications. The objects returned by
  * 			these routines are vectors of VertexData, where each successive triplet
- * 			is a triangle.
+ * 			is a triangle. Wrap them in an IndexedMesh to share their vertices.
  */
 
 struct EShape {
@@ -1,20 +1,396 @@
+#include <cfloat>
 #include "FragmentOps.h"
 
 FogParams FragmentOps::fogParams;
 bool FragmentOps::performDepthTest = true;
 bool FragmentOps::readonlyDepthBuffer = false;
 bool FragmentOps::readonlyColorBuffer = false;
+bool FragmentOps::earlyDepthTest = true;
+bool FragmentOps::performBlending = false;
+transparencyType FragmentOps::transparency = SORTED_TRANSPARENCY;
+std::vector<const ShadowMap *> FragmentOps::shadowMaps;
+LightTiles FragmentOps::lightTiles;
+
+/**
+ * @fn	template <fogType FOG> static float fogFactorOfType(const FogParams &fog, float distance)
+ * @brief	Computes the fog factor for one fog type, known at compile time.
+ * @param	fog			The fog parameters.
+ * @param	distance	Distance from the eye.
+ * @return	The fog factor - f. 1 ==> no fog, 0 ==> only fog.
+ */
+
+template <fogType FOG>
+static float fogFactorOfType(const FogParams &fog, float distance) {
+	switch (FOG) {
+	case LINEAR_FOG:
+		return glm::clamp((fog.end - distance) / (fog.end - fog.start), 0.0f, 1.0f);
+	case EXPONENTIAL_FOG:
+		return std::exp(-fog.density * distance);
+	case EXPONENTIAL_2_FOG:
+		return std::exp(-(fog.density * distance) * (fog.density * distance));
+	default:
+		return 1.0f;
+	}
+}
+
+/**
+ * @fn	template <fogType FOG> static color fogColor(const FogParams &fog, const color &C, const glm::vec3 &eyePos, const glm::vec3 &fragPos)
+ * @brief	Mixes the fog color into a color, for one fog type known at compile time.
+ * @param	fog	   	The fog parameters.
+ * @param	C	   	The fragment's color.
+ * @param	eyePos 	The eye position.
+ * @param	fragPos	The fragment position.
+ * @return	The fogged color.
+ */
+
+template <fogType FOG>
+static color fogColor(const FogParams &fog, const color &C, const glm::vec3 &eyePos, const glm::vec3 &fragPos) {
+	float f = fogFactorOfType<FOG>(fog, glm::distance(eyePos, fragPos));
+	return f * C + (1.0f - f) * fog.color;
+}
 
 /**
  * @fn	float FogParams::fogFactor(const glm::vec3 &fragPos, const glm::vec3 &eyePos) const
  * @brief	Computes fog factor - f.
  * @param	fragPos	The fragment position.
  * @param	eyePos 	The eye position.
- * @return	The fog factor - f.
+ * @return	The fog factor - f. 1 ==> no fog, 0 ==> only fog.
  */
 
 float FogParams::fogFactor(const glm::vec3 &fragPos, const glm::vec3 &eyePos) const {
-	return 0.5f;
+	float distance = glm::distance(eyePos, fragPos);
+	switch (type) {
+	case LINEAR_FOG:		return fogFactorOfType<LINEAR_FOG>(*this, distance);
+	case EXPONENTIAL_FOG:	return fogFactorOfType<EXPONENTIAL_FOG>(*this, distance);
+	case EXPONENTIAL_2_FOG:	return fogFactorOfType<EXPONENTIAL_2_FOG>(*this, distance);
+	default:				return 1.0f;
+	}
+}
+
+/**
+ * @fn	void LightBlock::clear()
+ * @brief	Removes all the lights.
+ */
+
+void LightBlock::clear() {
+	for (std::vector<float> *v : { &positionX, &positionY, &positionZ, &spotX, &spotY, &spotZ,
+									&cosCutoff, &attenConstant, &attenLinear, &attenQuadratic }) {
+		v->clear();
+	}
+	ambient.clear();
+	diffuse.clear();
+	specular.clear();
+	shadowMap.clear();
+}
+
+/**
+ * @fn	void LightBlock::add(const PositionalLight &light, const ShadowMap *lightShadowMap)
+ * @brief	Appends a positional or spot light.
+ * @param	light		  	The light.
+ * @param	lightShadowMap	The light's shadow map, or nullptr if it casts no shadows.
+ */
+
+void LightBlock::add(const PositionalLight &light, const ShadowMap *lightShadowMap) {
+	positionX.push_back(light.lightPosition.x);
+	positionY.push_back(light.lightPosition.y);
+	positionZ.push_back(light.lightPosition.z);
+	const SpotLight *spot = dynamic_cast<const SpotLight *>(&light);
+	glm::vec3 dir = spot != nullptr ? glm::normalize(spot->spotDirection) : glm::vec3(0.0f);
+	spotX.push_back(dir.x);
+	spotY.push_back(dir.y);
+	spotZ.push_back(dir.z);
+	cosCutoff.push_back(spot != nullptr ? std::cos(spot->fov / 2.0f) : -2.0f);
+	LightAttenuationParameters atten = light.attenuationIsTurnedOn ? light.attenuationParams
+																	: LightAttenuationParameters(1.0f, 0.0f, 0.0f);
+	attenConstant.push_back(atten.constant);
+	attenLinear.push_back(atten.linear);
+	attenQuadratic.push_back(atten.quadratic);
+	ambient.push_back(light.lightColorComponents.ambient);
+	diffuse.push_back(light.lightColorComponents.diffuse);
+	specular.push_back(light.lightColorComponents.specular);
+	shadowMap.push_back(lightShadowMap);
+}
+
+/**
+ * @fn	LightSnapshot::LightSnapshot(const PositionalLight &light)
+ * @brief	Records a light's current settings.
+ * @param	light	The light.
+ */
+
+LightSnapshot::LightSnapshot(const PositionalLight &light)
+	: light(&light), spot(dynamic_cast<const SpotLight *>(&light)), position(light.lightPosition),
+	spotDirection(spot != nullptr ? spot->spotDirection : glm::vec3(0.0f)), fov(spot != nullptr ? spot->fov : 0.0f),
+	isOn(light.isOn), attenuationIsTurnedOn(light.attenuationIsTurnedOn), attenuationParams(light.attenuationParams),
+	lightColorComponents(light.lightColorComponents) {
+}
+
+/**
+ * @fn	bool LightSnapshot::isUnchanged() const
+ * @brief	Determines if the light still has the recorded settings.
+ * @return	True iff nothing light culling used has changed.
+ */
+
+bool LightSnapshot::isUnchanged() const {
+	const LightAttenuationParameters &atten = light->attenuationParams;
+	const LightColor &colors = light->lightColorComponents;
+	return light->lightPosition == position && light->isOn == isOn &&
+		light->attenuationIsTurnedOn == attenuationIsTurnedOn &&
+		atten.constant == attenuationParams.constant && atten.linear == attenuationParams.linear &&
+		atten.quadratic == attenuationParams.quadratic &&
+		colors.ambient == lightColorComponents.ambient && colors.diffuse == lightColorComponents.diffuse &&
+		colors.specular == lightColorComponents.specular &&
+		(spot == nullptr || (spot->spotDirection == spotDirection && spot->fov == fov));
+}
+
+/**
+ * @fn	void FragmentOps::cullLights(const FrameBuffer &frameBuffer, const std::vector<LightSourcePtr> &lights, const glm::mat4 &viewingMatrix, const glm::mat4 &projectionMatrix, const glm::mat4 &viewportMatrix)
+ * @brief	Builds the per tile light lists used for tiled forward+ shading,
+ * 			and by the deferred lighting pass. Each positional light is bounded
+ * 			by a sphere, from its attenuation and spot cone, and the sphere's
+ * 			screen rectangle decides which tiles list it. Call once per frame,
+ * 			after the camera is set up, and the shadow maps are rendered, and
+ * 			before drawing. The lists are only used by draws into the same
+ * 			framebuffer, at the same size, through the same view, with the same
+ * 			lights and shadow maps, none of which has been changed since;
+ * 			other draws evaluate every light.
+ * @param	frameBuffer			The framebuffer about to be drawn into.
+ * @param	lights				Vector of lights in scene.
+ * @param	viewingMatrix   	The viewing transformation matrix.
+ * @param	projectionMatrix	The projection matrix.
+ * @param	viewportMatrix  	The viewport transformation matrix.
+ */
+
+void FragmentOps::cullLights(const FrameBuffer &frameBuffer, const std::vector<LightSourcePtr> &lights,
+								const glm::mat4 &viewingMatrix, const glm::mat4 &projectionMatrix,
+								const glm::mat4 &viewportMatrix) {
+	LightTiles &lt = lightTiles;
+	lt.sourceLights = lights;
+	lt.frameBuffer = &frameBuffer;
+	lt.windowWidth = frameBuffer.getWindowWidth();
+	lt.windowHeight = frameBuffer.getWindowHeight();
+	lt.viewingMatrix = viewingMatrix;
+	lt.projectionMatrix = projectionMatrix;
+	lt.viewportMatrix = viewportMatrix;
+	lt.shadowMaps = shadowMaps;
+	lt.snapshots.clear();
+	lt.otherLights.clear();
+	lt.block.clear();
+	lt.tilesWide = (frameBuffer.getWindowWidth() + LIGHT_TILE_SIZE - 1) >> LIGHT_TILE_SHIFT;
+	lt.tilesHigh = (frameBuffer.getWindowHeight() + LIGHT_TILE_SIZE - 1) >> LIGHT_TILE_SHIFT;
+	const int tileCount = lt.tilesWide * lt.tilesHigh;
+	lt.culledAmbient.assign(tileCount, black);
+	lt.hasSpotLights = false;
+
+	// Tile rectangle each light in the block covers, inclusive. Empty if left > right.
+	std::vector<BoundingBoxi> reach;
+	const glm::mat4 projViewport = viewportMatrix * projectionMatrix;
+	for (const LightSourcePtr &light : lights) {
+		const PositionalLight *pl = dynamic_cast<const PositionalLight *>(light);
+		if (pl == nullptr) {
+			lt.otherLights.push_back(light);
+			continue;
+		}
+		lt.snapshots.push_back(LightSnapshot(*pl));
+		if (!pl->isOn) {
+			// Off lights only ever give ambient light
+			for (color &C : lt.culledAmbient) {
+				C += pl->lightColorComponents.ambient;
+			}
+			continue;
+		}
+		BoundingBoxi tiles(0, lt.tilesWide - 1, 0, lt.tilesHigh - 1);
+		glm::vec3 center;
+		float radius;
+		if (pl->getBoundingSphere(LIGHT_CUTOFF, center, radius)) {
+			glm::vec3 eyeCenter(viewingMatrix * glm::vec4(center, 1.0f));
+			float left = FLT_MAX, right = -FLT_MAX, bottom = FLT_MAX, top = -FLT_MAX;
+			int behindEye = 0;
+			for (int corner = 0; corner < 8; corner++) {
+				glm::vec3 offset((corner & 1) ? radius : -radius,
+								(corner & 2) ? radius : -radius,
+								(corner & 4) ? radius : -radius);
+				glm::vec4 clip = projViewport * glm::vec4(eyeCenter + offset, 1.0f);
+				if (clip.w <= EPSILON) {
+					behindEye++;
+					continue;
+				}
+				left = std::min(left, clip.x / clip.w);
+				right = std::max(right, clip.x / clip.w);
+				bottom = std::min(bottom, clip.y / clip.w);
+				top = std::max(top, clip.y / clip.w);
+			}
+			if (behindEye == 8) {
+				tiles = BoundingBoxi(0, -1, 0, -1);
+			} else if (behindEye == 0) {
+				// Reaching the eye plane projects without bound, so keep every tile then
+				auto toTile = [](float w) { return (int)std::floor(glm::clamp(w, -1.0e6f, 1.0e6f)) >> LIGHT_TILE_SHIFT; };
+				tiles.lx = std::max(tiles.lx, toTile(left));
+				tiles.rx = std::min(tiles.rx, toTile(right));
+				tiles.ly = std::max(tiles.ly, toTile(bottom));
+				tiles.ry = std::min(tiles.ry, toTile(top));
+			}
+		}
+		if (tiles.lx > tiles.rx || tiles.ly > tiles.ry) {
+			for (color &C : lt.culledAmbient) {
+				C += pl->lightColorComponents.ambient;
+			}
+			continue;
+		}
+		lt.block.add(*pl, ShadowMap::find(shadowMaps, pl));
+		lt.hasSpotLights = lt.hasSpotLights || dynamic_cast<const SpotLight *>(pl) != nullptr;
+		reach.push_back(tiles);
+	}
+
+	// Compressed rows: count each tile's lights, then fill them in
+	lt.firstLight.assign(tileCount + 1, 0);
+	for (const BoundingBoxi &tiles : reach) {
+		for (int ty = tiles.ly; ty <= tiles.ry; ty++) {
+			for (int tx = tiles.lx; tx <= tiles.rx; tx++) {
+				lt.firstLight[ty * lt.tilesWide + tx + 1]++;
+			}
+		}
+	}
+	for (int t = 0; t < tileCount; t++) {
+		lt.firstLight[t + 1] += lt.firstLight[t];
+	}
+	lt.lightIndices.resize(lt.firstLight[tileCount]);
+	std::vector<int> fill(lt.firstLight.begin(), lt.firstLight.end() - 1);
+	for (int i = 0; i < (int)reach.size(); i++) {
+		const BoundingBoxi &tiles = reach[i];
+		for (int ty = 0; ty < lt.tilesHigh; ty++) {
+			for (int tx = 0; tx < lt.tilesWide; tx++) {
+				int t = ty * lt.tilesWide + tx;
+				if (tx >= tiles.lx && tx <= tiles.rx && ty >= tiles.ly && ty <= tiles.ry) {
+					lt.lightIndices[fill[t]++] = i;
+				} else {
+					lt.culledAmbient[t] += lt.block.ambient[i];
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @fn	const LightTiles *FragmentOps::currentLightTiles(const FrameBuffer &frameBuffer, const glm::mat4 &viewingMatrix, const std::vector<LightSourcePtr> &lights)
+ * @brief	Finds the light lists built by cullLights, if they still hold for
+ * 			the framebuffer, camera and lights. For the deferred lighting pass,
+ * 			whose G-buffer is assumed to be drawn through the culled projection
+ * 			and viewport.
+ * @param	frameBuffer  	The framebuffer being lit.
+ * @param	viewingMatrix	The viewing matrix.
+ * @param	lights		 	Vector of lights in scene.
+ * @return	The lists, or nullptr if every light must be evaluated.
+ */
+
+const LightTiles *FragmentOps::currentLightTiles(const FrameBuffer &frameBuffer, const glm::mat4 &viewingMatrix,
+												const std::vector<LightSourcePtr> &lights) {
+	const LightTiles &lt = lightTiles;
+	if (lt.frameBuffer != &frameBuffer || lt.windowWidth != frameBuffer.getWindowWidth() ||
+		lt.windowHeight != frameBuffer.getWindowHeight() || lt.viewingMatrix != viewingMatrix ||
+		lt.sourceLights != lights || lt.shadowMaps != shadowMaps) {
+		return nullptr;
+	}
+	for (const LightSnapshot &snapshot : lt.snapshots) {
+		if (!snapshot.isUnchanged()) {
+			return nullptr;
+		}
+	}
+	return &lt;
+}
+
+/**
+ * @fn	const LightTiles *FragmentOps::currentLightTiles(const FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights)
+ * @brief	Finds the light lists built by cullLights, if they still hold for a
+ * 			draw: same framebuffer, view, projection, viewport and lights.
+ * 			Draws whose vertices are already in window coordinates have no
+ * 			projection, so only their view and viewport are checked.
+ * @param	frameBuffer	The framebuffer drawn into.
+ * @param	state	   	The state of the draw.
+ * @param	lights	   	Vector of lights in scene.
+ * @return	The lists, or nullptr if every light must be evaluated.
+ */
+
+const LightTiles *FragmentOps::currentLightTiles(const FrameBuffer &frameBuffer, const RenderState &state,
+												const std::vector<LightSourcePtr> &lights) {
+	const bool projected = state.projectionMatrix != glm::mat4(1.0f);
+	if ((projected && lightTiles.projectionMatrix != state.projectionMatrix) ||
+		lightTiles.viewportMatrix != state.viewportMatrix) {
+		return nullptr;
+	}
+	return currentLightTiles(frameBuffer, state.viewingMatrix, lights);
+}
+
+/**
+ * @fn	template <bool SPOT_LIGHTS> template <bool SPOT_LIGHTS>
+color FragmentOps::lightSurface(const glm::vec3 &position, const glm::vec3 &normal, const Material &material, const Frame &eyeFrame, const std::vector<LightSourcePtr> &lights, const LightTiles *tiles, int x, int y)
+ * @brief	Sums the light reaching a surface point from every light. Given the
+ * 			light lists, only the lights listed for the pixel's tile are
+ * 			evaluated, from the light block; the rest just add their ambient
+ * 			term. Matches LightSource::illuminate otherwise.
+ * 			Lights with a shadow map only add their ambient term for the part
+ * 			of them the map says is blocked.
+ * 			SPOT_LIGHTS must be true if the light block has any spot lights.
+ * @param	position	The surface point, in world coordinates.
+ * @param	normal  	The surface normal, in world coordinates.
+ * @param	material	The surface material.
+ * @param	eyeFrame	The eye's frame.
+ * @param	lights  	Vector of lights in scene.
+ * @param	tiles		The light lists from currentLightTiles, or nullptr to evaluate every light.
+ * @param	x			The pixel's column.
+ * @param	y			The pixel's row.
+ * @return	The lit color.
+ */
+
+template <bool SPOT_LIGHTS>
+color FragmentOps::lightSurface(const glm::vec3 &position, const glm::vec3 &normal, const Material &material,
+								const Frame &eyeFrame, const std::vector<LightSourcePtr> &lights,
+								const LightTiles *tiles, int x, int y) {
+	int tx = x >> LIGHT_TILE_SHIFT, ty = y >> LIGHT_TILE_SHIFT;
+	if (tiles == nullptr || tx < 0 || tx >= tiles->tilesWide || ty < 0 || ty >= tiles->tilesHigh) {
+		color C = black;
+		for (const LightSourcePtr &light : lights) {
+			const ShadowMap *shadowMap = ShadowMap::find(shadowMaps, light);
+			const float visibility = shadowMap != nullptr ? shadowMap->visibility(position, normal) : 1.0f;
+			C += illuminateWithVisibility(*light, position, normal, material, eyeFrame, visibility);
+		}
+		return C;
+	}
+	const LightTiles &lt = *tiles;
+	const int tile = ty * lt.tilesWide + tx;
+	color C = ambientColor(material.ambient, lt.culledAmbient[tile]);
+	for (const LightSourcePtr &light : lt.otherLights) {
+		C += light->illuminate(position, normal, material, eyeFrame, false);
+	}
+
+	const LightBlock &block = lt.block;
+	const glm::vec3 v = glm::normalize(position - eyeFrame.origin);
+	const glm::vec3 n = glm::dot(v, normal) > 0 ? -normal : normal;	// Checks for backfaces
+	for (int j = lt.firstLight[tile]; j < lt.firstLight[tile + 1]; j++) {
+		const int i = lt.lightIndices[j];
+		glm::vec3 toLight = glm::vec3(block.positionX[i], block.positionY[i], block.positionZ[i]) - position;
+		glm::vec3 l = glm::normalize(toLight);
+		color amb = ambientColor(material.ambient, block.ambient[i]);
+		if (SPOT_LIGHTS) {
+			glm::vec3 spotDir(block.spotX[i], block.spotY[i], block.spotZ[i]);
+			if (glm::dot(spotDir, -l) < block.cosCutoff[i]) {
+				C += amb;
+				continue;
+			}
+		}
+		const float visibility = block.shadowMap[i] != nullptr ? block.shadowMap[i]->visibility(position, normal) : 1.0f;
+		if (visibility <= 0.0f) {
+			C += amb;
+			continue;
+		}
+		glm::vec3 r = 2 * glm::dot(l, n) * n - l;
+		color diff = diffuseColor(material.diffuse, block.diffuse[i], l, n);
+		color spec = specularColor(material.specular, block.specular[i], material.shininess, r, v);
+		float d = glm::length(toLight);
+		float atten = 1.0f / (block.attenConstant[i] + block.attenLinear[i] * d + block.attenQuadratic[i] * d * d);
+		color lit = glm::clamp(amb + diff * atten + spec * atten, { 0 }, { 1 });
+		C += visibility < 1.0f ? visibility * lit + (1.0f - visibility) * amb : lit;
+	}
+	return C;
 }
 
 /**
@@ -31,7 +407,9 @@ float FogParams::fogFactor(const glm::vec3 &fragPos, const glm::vec3 &eyePos) co
 color FragmentOps::applyLighting(const Fragment &fragment, const glm::vec3 &eyePositionInWorldCoords,
 										const std::vector<LightSourcePtr> &lights,
 										const glm::mat4 &viewingMatrix) {
-	return gray;
+	return lightSurface<true>(fragment.worldPosition, fragment.worldNormal, MaterialTable::get(fragment.materialID),
+						Frame::createOrthoNormalBasis(viewingMatrix), lights, nullptr,
+						(int)fragment.windowPosition.x, (int)fragment.windowPosition.y);
 }
 
 /**
@@ -45,7 +423,8 @@ color FragmentOps::applyLighting(const Fragment &fragment, const glm::vec3 &eyeP
 
 color FragmentOps::applyFog(const color &destColor,
 							const glm::vec3 &eyePos, const glm::vec3 &fragPos) {
-	return gray;
+	float f = fogParams.fogFactor(fragPos, eyePos);
+	return f * destColor + (1.0f - f) * fogParams.color;
 }
 
 /**
@@ -58,12 +437,14 @@ color FragmentOps::applyFog(const color &destColor,
  */
 
 color FragmentOps::applyBlending(float alpha, const color &srcColor, const color &destColor) {
-	return gray;
+	return alpha * srcColor + (1.0f - alpha) * destColor;
 }
 
 /**
  * @fn	void FragmentOps::processFragment(FrameBuffer &frameBuffer, const glm::vec3 &eyePositionInWorldCoords, const std::vector<LightSourcePtr> lights, const Fragment &fragment, const glm::mat4 &viewingMatrix)
  * @brief	Process the fragment, leaving the results in the framebuffer.
+ * 			Builds a RenderState for just this fragment; the pipeline itself uses
+ * 			processFragments with the state of the draw.
  * @param [in,out]	frameBuffer					
  * @param 		  	eyePositionInWorldCoords	The eye position in world coordinates.
  * @param 		  	lights						Vector of lights in scene.
@@ -75,17 +456,355 @@ void FragmentOps::processFragment(FrameBuffer &frameBuffer, const glm::vec3 &eye
 										const std::vector<LightSourcePtr> lights,
 										const Fragment &fragment,
 										const glm::mat4 &viewingMatrix) {
-	const glm::vec3 &eyePos = eyePositionInWorldCoords;
-
-	const float &Z = fragment.windowPosition.z;
-	int X = (int)fragment.windowPosition.x;
-	int Y = (int)fragment.windowPosition.y;
-	DEBUG_PIXEL = (X == xDebug && Y == yDebug);
-	bool passDepthTest = !performDepthTest || Z < frameBuffer.getDepth(X, Y);
-	if (passDepthTest) {
-		Frame frame = Frame::createOrthoNormalBasis(viewingMatrix);
-		color C = lights[0]->illuminate(fragment.worldPosition, fragment.worldNormal, fragment.material, frame, false);
-		frameBuffer.setColor(X, Y, C);
-		frameBuffer.setDepth(X, Y, Z);
-	}
-}
\ No newline at end of file
+	processFragments(frameBuffer, eyePositionInWorldCoords, lights, &fragment, 1, viewingMatrix);
+}
+
+/**
+ * @fn	void FragmentOps::processFragments(FrameBuffer &frameBuffer, const glm::vec3 &eyePositionInWorldCoords, const std::vector<LightSourcePtr> &lights, const Fragment fragments[], int count, const glm::mat4 &viewingMatrix, bool passedDepthTest)
+ * @brief	Process a batch of fragments with the current FragmentOps settings.
+ * @param [in,out]	frameBuffer					
+ * @param 		  	eyePositionInWorldCoords	The eye position in world coordinates.
+ * @param 		  	lights						Vector of lights in scene.
+ * @param 		  	fragments					Fragments to be processed.
+ * @param 		  	count						Number of fragments.
+ * @param 		  	viewingMatrix				The viewing transformation matrix.
+ * @param 		  	passedDepthTest				True ==> the fragments were already depth tested (early Z).
+ */
+
+void FragmentOps::processFragments(FrameBuffer &frameBuffer, const glm::vec3 &eyePositionInWorldCoords,
+									const std::vector<LightSourcePtr> &lights,
+									const Fragment fragments[], int count,
+									const glm::mat4 &viewingMatrix, bool passedDepthTest) {
+	RenderState state(glm::mat4(1.0f), viewingMatrix, glm::mat4(1.0f),
+						BoundingBoxi(0, frameBuffer.getWindowWidth() - 1, 0, frameBuffer.getWindowHeight() - 1));
+	processFragments(frameBuffer, state, lights, fragments, count, passedDepthTest);
+}
+
+/**
+ * @fn	void FragmentOps::processFragments(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, const Fragment fragments[], int count, bool passedDepthTest)
+ * @brief	Process a batch of fragments, leaving the results in the framebuffer.
+ * 			The kernel is picked once for the batch, from the draw's state.
+ * @param [in,out]	frameBuffer		
+ * @param 		  	state		   	The state of the draw the fragments belong to.
+ * @param 		  	lights		   	Vector of lights in scene.
+ * @param 		  	fragments	   	Fragments to be processed.
+ * @param 		  	count		   	Number of fragments.
+ * @param 		  	passedDepthTest	True ==> the fragments were already depth tested (early Z).
+ * 									Per sample if the framebuffer is multisampled, in
+ * 									which case their coverage must be set.
+ */
+
+void FragmentOps::processFragments(FrameBuffer &frameBuffer, const RenderState &state,
+									const std::vector<LightSourcePtr> &lights,
+									const Fragment fragments[], int count, bool passedDepthTest) {
+	const LightTiles *tiles;
+	selectKernel(frameBuffer, state, lights, passedDepthTest, tiles)(frameBuffer, state, lights, tiles, fragments, count);
+}
+
+// Bits of a shadeFragments variant
+const int KERNEL_DEPTH_TEST = 1;		//!< Fragments are depth tested.
+const int KERNEL_DEPTH_WRITE = 2;		//!< Passing fragments write the depth buffer.
+const int KERNEL_COLOR_WRITE = 4;		//!< Passing fragments write the color buffer.
+const int KERNEL_SPOT_LIGHTS = 8;		//!< The light block has spot lights.
+const int KERNEL_VERTEX_LIGHTING = 16;	//!< Fragments carry colors lit per vertex; no lighting is done.
+const int KERNEL_MULTISAMPLE = 32;		//!< Fragments color only the samples in their coverage.
+const int KERNEL_BLEND_SHIFT = 6;		//!< 0 ==> no blending, else 1 + the transparencyType, in 2 bits from here.
+const int KERNEL_FOG_SHIFT = 8;			//!< The fogType is in the bits from here up.
+const int KERNEL_VARIANTS = 4 << KERNEL_FOG_SHIFT;
+
+/**
+ * @fn	static constexpr bool isReachableVariant(int variant)
+ * @brief	Determines if selectKernel can pick a variant. Multisampled fragments
+ * 			were depth tested and written by the rasterizer, order-independent
+ * 			transparency never writes depth, spot lights are only looked at when
+ * 			lighting per pixel, and without color writes only the depth bits
+ * 			are kept.
+ * @param	variant	The variant.
+ * @return	True iff a kernel is needed for the variant.
+ */
+
+static constexpr bool isReachableVariant(int variant) {
+	return ((variant & KERNEL_COLOR_WRITE) != 0 || (variant & ~(KERNEL_DEPTH_TEST | KERNEL_DEPTH_WRITE)) == 0) &&
+		((variant & KERNEL_MULTISAMPLE) == 0 || (variant & (KERNEL_DEPTH_TEST | KERNEL_DEPTH_WRITE)) == 0) &&
+		(((variant >> KERNEL_BLEND_SHIFT) & 3) < 2 || (variant & KERNEL_DEPTH_WRITE) == 0) &&
+		((variant & KERNEL_SPOT_LIGHTS) == 0 || (variant & KERNEL_VERTEX_LIGHTING) == 0);
+}
+
+/**
+ * @fn	static float transparencyWeight(float distance)
+ * @brief	How much a transparent fragment counts in weighted blended transparency,
+ * 			before its alpha. Falls off steeply with distance from the eye, so
+ * 			nearer surfaces dominate the average, and is clamped so sums of many
+ * 			fragments stay in float range. McGuire and Bavoil's distance weight.
+ * @param	distance	The fragment's distance from the eye.
+ * @return	The weight.
+ */
+
+static float transparencyWeight(float distance) {
+	const float d = distance / 200.0f;
+	return glm::clamp(0.03f / (1.0e-5f + d * d * d * d), 1.0e-2f, 3.0e3f);
+}
+
+/**
+ * @fn	static float coveredFraction(SampleMask coverage, int sampleCount)
+ * @brief	Fraction of a pixel's samples a coverage mask covers.
+ * @param	coverage   	The coverage mask.
+ * @param	sampleCount	Samples per pixel.
+ * @return	The fraction covered.
+ */
+
+static float coveredFraction(SampleMask coverage, int sampleCount) {
+	int covered = 0;
+	for (int s = 0; s < sampleCount; s++) {
+		covered += (coverage >> s) & 1;
+	}
+	return (float)covered / sampleCount;
+}
+
+/**
+ * @fn	template <int VARIANT> void FragmentOps::shadeFragments(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, const Fragment fragments[], int count)
+ * @brief	Depth tests, lights, fogs and blends a batch of fragments, leaving the
+ * 			results in the framebuffer. VARIANT fixes which of those steps happen,
+ * 			so the loop has no per fragment tests of the state. Fragments using
+ * 			order-independent transparency go to the transparency buffers instead
+ * 			of the color buffer.
+ * @param [in,out]	frameBuffer	
+ * @param 		  	state	   	The state of the draw the fragments belong to.
+ * @param 		  	lights	   	Vector of lights in scene.
+ * @param 		  	tiles	   	The light lists, or nullptr to evaluate every light.
+ * @param 		  	fragments  	Fragments to be processed.
+ * @param 		  	count	   	Number of fragments.
+ */
+
+template <int VARIANT>
+void FragmentOps::shadeFragments(FrameBuffer &frameBuffer, const RenderState &state,
+								const std::vector<LightSourcePtr> &lights, const LightTiles *tiles,
+								const Fragment fragments[], int count) {
+	const bool DEPTH_TEST = (VARIANT & KERNEL_DEPTH_TEST) != 0;
+	const bool DEPTH_WRITE = (VARIANT & KERNEL_DEPTH_WRITE) != 0;
+	const bool COLOR_WRITE = (VARIANT & KERNEL_COLOR_WRITE) != 0;
+	const int BLEND_MODE = (VARIANT >> KERNEL_BLEND_SHIFT) & 3;
+	const bool BLEND = BLEND_MODE != 0;
+	const transparencyType TRANSPARENCY = BLEND ? (transparencyType)(BLEND_MODE - 1) : SORTED_TRANSPARENCY;
+	const bool SPOT_LIGHTS = (VARIANT & KERNEL_SPOT_LIGHTS) != 0;
+	const bool VERTEX_LIGHTING = (VARIANT & KERNEL_VERTEX_LIGHTING) != 0;
+	const bool MULTISAMPLE = (VARIANT & KERNEL_MULTISAMPLE) != 0;
+	const fogType FOG = (fogType)(VARIANT >> KERNEL_FOG_SHIFT);
+	for (int i = 0; i < count; i++) {
+		const Fragment &fragment = fragments[i];
+		const float Z = fragment.windowPosition.z;
+		const int X = (int)fragment.windowPosition.x;
+		const int Y = (int)fragment.windowPosition.y;
+		DEBUG_PIXEL = (X == xDebug && Y == yDebug);
+		if (DEPTH_TEST && !(Z < frameBuffer.getDepth(X, Y))) {
+			continue;
+		}
+		if (COLOR_WRITE) {
+			const Material &material = MaterialTable::get(fragment.materialID);
+			color C = VERTEX_LIGHTING ? fragment.litColor :
+						lightSurface<SPOT_LIGHTS>(fragment.worldPosition, fragment.worldNormal, material,
+													state.eyeFrame, lights, tiles, X, Y);
+			if (FOG != NO_FOG) {
+				C = fogColor<FOG>(state.fogParams, C, state.eyePosition, fragment.worldPosition);
+			}
+			if (TRANSPARENCY != SORTED_TRANSPARENCY) {
+				// A partly covered pixel is as transparent as it is uncovered
+				const float alpha = MULTISAMPLE ? material.alpha * coveredFraction(fragment.coverage, frameBuffer.getSampleCount())
+												: material.alpha;
+				if (TRANSPARENCY == WEIGHTED_BLENDED_TRANSPARENCY) {
+					frameBuffer.accumulateTransparentFragment(X, Y, C, alpha,
+						transparencyWeight(glm::distance(state.eyePosition, fragment.worldPosition)));
+				} else {
+					frameBuffer.insertTransparentFragment(X, Y, C, alpha, Z);
+				}
+			} else {
+				if (BLEND) {
+					C = applyBlending(material.alpha, C, frameBuffer.getColor(X, Y));
+				}
+				if (MULTISAMPLE) {
+					frameBuffer.setSampleColors(X, Y, fragment.coverage, C);
+				} else {
+					frameBuffer.setColor(X, Y, C);
+				}
+				if (VERTEX_LIGHTING && frameBuffer.hasGBuffer()) {	// Keep the lighting pass off this pixel
+					frameBuffer.setGBufferTexel(X, Y, fragment.worldNormal, fragment.worldPosition, NO_MATERIAL);
+				}
+			}
+		}
+		if (DEPTH_WRITE) {
+			frameBuffer.setDepth(X, Y, Z);
+		}
+	}
+}
+
+/**
+ * @fn	template <bool DEPTH_TEST, bool DEPTH_WRITE> void FragmentOps::recordFragments(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, const LightTiles *tiles, const Fragment fragments[], int count)
+ * @brief	Depth tests a batch of fragments and records the passing ones in the
+ * 			G-buffer, to be lit by the deferred lighting pass.
+ * @param [in,out]	frameBuffer	
+ * @param 		  	state	   	The state of the draw the fragments belong to.
+ * @param 		  	lights	   	Vector of lights in scene. Unused.
+ * @param 		  	tiles	   	The light lists. Unused.
+ * @param 		  	fragments  	Fragments to be processed.
+ * @param 		  	count	   	Number of fragments.
+ */
+
+template <bool DEPTH_TEST, bool DEPTH_WRITE>
+void FragmentOps::recordFragments(FrameBuffer &frameBuffer, const RenderState &state,
+									const std::vector<LightSourcePtr> &lights, const LightTiles *tiles,
+									const Fragment fragments[], int count) {
+	for (int i = 0; i < count; i++) {
+		const Fragment &fragment = fragments[i];
+		const float Z = fragment.windowPosition.z;
+		const int X = (int)fragment.windowPosition.x;
+		const int Y = (int)fragment.windowPosition.y;
+		if (DEPTH_TEST && !(Z < frameBuffer.getDepth(X, Y))) {
+			continue;
+		}
+		frameBuffer.setGBufferTexel(X, Y, fragment.worldNormal, fragment.worldPosition, fragment.materialID);
+		if (DEPTH_WRITE) {
+			frameBuffer.setDepth(X, Y, Z);
+		}
+	}
+}
+
+/**
+ * @fn	template <int VARIANT> FragmentKernel FragmentOps::kernelIfReachable(std::true_type)
+ * @brief	Instantiates shadeFragments for a variant selectKernel can pick.
+ * @return	The kernel.
+ */
+
+template <int VARIANT>
+FragmentKernel FragmentOps::kernelIfReachable(std::true_type) {
+	return &shadeFragments<VARIANT>;
+}
+
+/**
+ * @fn	template <int VARIANT> FragmentKernel FragmentOps::kernelIfReachable(std::false_type)
+ * @brief	Stands in for a variant selectKernel never picks.
+ * @return	nullptr.
+ */
+
+template <int VARIANT>
+FragmentKernel FragmentOps::kernelIfReachable(std::false_type) {
+	return nullptr;
+}
+
+/**
+ * @fn	template <int... VARIANTS> const FragmentKernel *FragmentOps::makeKernelTable(std::integer_sequence<int, VARIANTS...>)
+ * @brief	Instantiates shadeFragments for each reachable variant.
+ * @return	The kernels, indexed by variant. Unreachable variants are nullptr.
+ */
+
+template <int... VARIANTS>
+const FragmentKernel *FragmentOps::makeKernelTable(std::integer_sequence<int, VARIANTS...>) {
+	static const FragmentKernel kernels[] = {
+		kernelIfReachable<VARIANTS>(std::integral_constant<bool, isReachableVariant(VARIANTS)>())...
+	};
+	return kernels;
+}
+
+/**
+ * @fn	FragmentKernel FragmentOps::selectKernel(const FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, bool passedDepthTest, const LightTiles *&tiles)
+ * @brief	Picks the fragment kernel specialized for a draw's state. Only opaque,
+ * 			color writing draws lit per pixel are recorded in a G-buffer. Draws lit
+ * 			per vertex, depth only draws and blended draws are shaded forward, and
+ * 			sorted blended draws into a G-buffer don't write depth, since the
+ * 			G-buffer keeps only the opaque surface behind them.
+ * 			Fragments that passed the depth test into a multisampled framebuffer
+ * 			were tested, and had their depths written, per sample by the
+ * 			rasterizer; only the samples in their coverage get their color.
+ * 			Order-independent transparency is shaded forward too, and never
+ * 			writes depth, so what is behind a transparent surface still draws.
+ * 			Whether the culled light lists can be used is decided here too, once
+ * 			for the batch.
+ * @param		  	frameBuffer	   	The framebuffer drawn into.
+ * @param		  	state		   	The state of the draw.
+ * @param		  	lights		   	Vector of lights in scene.
+ * @param		  	passedDepthTest	True ==> the fragments were already depth tested (early Z).
+ * @param [out]	tiles		   	The light lists for the kernel, or nullptr to evaluate every light.
+ * @return	The kernel.
+ */
+
+FragmentKernel FragmentOps::selectKernel(const FrameBuffer &frameBuffer, const RenderState &state,
+											const std::vector<LightSourcePtr> &lights, bool passedDepthTest,
+											const LightTiles *&tiles) {
+	static const FragmentKernel *kernels = makeKernelTable(std::make_integer_sequence<int, KERNEL_VARIANTS>());
+	const bool multisample = passedDepthTest && frameBuffer.isMultisampled();
+	const bool orderIndependent = isOrderIndependent(frameBuffer, state);
+	const bool depthTest = state.performDepthTest && !passedDepthTest;
+	const bool deferred = frameBuffer.hasGBuffer();
+	const bool depthWrite = !state.readonlyDepthBuffer && !multisample && !orderIndependent &&
+							!(deferred && state.performBlending);
+	tiles = nullptr;
+	if (deferred && !state.perVertexLighting && !state.performBlending && !state.readonlyColorBuffer) {
+		if (depthTest) {
+			return depthWrite ? recordFragments<true, true> : recordFragments<true, false>;
+		}
+		return depthWrite ? recordFragments<false, true> : recordFragments<false, false>;
+	}
+	if (!state.readonlyColorBuffer && !state.perVertexLighting) {
+		tiles = currentLightTiles(frameBuffer, state, lights);
+	}
+	int variant = (depthTest ? KERNEL_DEPTH_TEST : 0) |
+					(depthWrite ? KERNEL_DEPTH_WRITE : 0) |
+					(!state.readonlyColorBuffer ? KERNEL_COLOR_WRITE : 0) |
+					(state.performBlending ? (orderIndependent ? 1 + state.transparency : 1) << KERNEL_BLEND_SHIFT : 0) |
+					(tiles != nullptr && tiles->hasSpotLights ? KERNEL_SPOT_LIGHTS : 0) |
+					(state.perVertexLighting ? KERNEL_VERTEX_LIGHTING : 0) |
+					(multisample ? KERNEL_MULTISAMPLE : 0) |
+					(state.fogParams.type << KERNEL_FOG_SHIFT);
+	if ((variant & KERNEL_COLOR_WRITE) == 0) {
+		variant &= KERNEL_DEPTH_TEST | KERNEL_DEPTH_WRITE;	// Nothing else matters without color
+	}
+	return kernels[variant];
+}
+
+/**
+ * @fn	bool FragmentOps::isOrderIndependent(const FrameBuffer &frameBuffer, const RenderState &state)
+ * @brief	Determines if a draw's blended fragments are gathered for order-independent
+ * 			transparency. They are if it asks for it and the framebuffer has the
+ * 			transparency buffers; otherwise they are blended as they arrive.
+ * @param	frameBuffer	The framebuffer drawn into.
+ * @param	state	   	The state of the draw.
+ * @return	True iff the draw's fragments go to the transparency buffers.
+ */
+
+bool FragmentOps::isOrderIndependent(const FrameBuffer &frameBuffer, const RenderState &state) {
+	return state.performBlending && state.transparency != SORTED_TRANSPARENCY && frameBuffer.hasTransparencyBuffers();
+}
+
+/**
+ * @fn	void FragmentOps::shadeGBufferTile(FrameBuffer &frameBuffer, const std::vector<LightSourcePtr> &lights, const LightTiles *tiles, const Frame &eyeFrame, int tileX, int tileY)
+ * @brief	Deferred lighting pass for one tile. Every pixel the G-buffer saw a
+ * 			surface at is lit exactly once, by the lights reaching its tile.
+ * @param [in,out]	frameBuffer	
+ * @param 		  	lights	   	Vector of lights in scene.
+ * @param 		  	tiles	   	The light lists from currentLightTiles, or nullptr to evaluate every light.
+ * @param 		  	eyeFrame   	The eye's frame.
+ * @param 		  	tileX	   	The tile column.
+ * @param 		  	tileY	   	The tile row.
+ */
+
+void FragmentOps::shadeGBufferTile(FrameBuffer &frameBuffer, const std::vector<LightSourcePtr> &lights,
+									const LightTiles *tiles, const Frame &eyeFrame, int tileX, int tileY) {
+	if (!frameBuffer.isGBufferTileUsed(tileX, tileY)) {
+		return;
+	}
+	const GBufferTile &tile = frameBuffer.getGBufferTile(tileX, tileY);
+	color (*light)(const glm::vec3 &, const glm::vec3 &, const Material &, const Frame &,
+					const std::vector<LightSourcePtr> &, const LightTiles *, int, int) =
+		tiles != nullptr && tiles->hasSpotLights ? lightSurface<true> : lightSurface<false>;
+	for (int i = 0; i < PIXELS_PER_TILE; i++) {
+		if (tile.materialID[i] == NO_MATERIAL) {
+			continue;
+		}
+		int X = (tileX << TILE_SHIFT) + (i & TILE_MASK);
+		int Y = (tileY << TILE_SHIFT) + (i >> TILE_SHIFT);
+		DEBUG_PIXEL = (X == xDebug && Y == yDebug);
+		glm::vec3 position(tile.positionX[i], tile.positionY[i], tile.positionZ[i]);
+		glm::vec3 normal(tile.normalX[i], tile.normalY[i], tile.normalZ[i]);
+		const Material &material = MaterialTable::get((MaterialIndex)tile.materialID[i]);
+		frameBuffer.setColor(X, Y, light(position, normal, material, eyeFrame, lights, tiles, X, Y));
+	}
+}
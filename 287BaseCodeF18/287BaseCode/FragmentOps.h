@@ -1,39 +1,110 @@
 #pragma once
+#include <type_traits>
+#include <utility>
 #include "FrameBuffer.h"
 #include "Light.h"
+#include "MaterialTable.h"
+#include "RenderState.h"
+#include "ShadowMap.h"
 
 /**
- * @enum	fogType
- * @brief	Represents the different types of fog processing.
+ * @struct	Fragment
+ * @brief	Represents the information relevant to a single fragment. Think
+ * 			of a fragment as a pixel competing to get into the framebuffer.
  */
 
-enum fogType { NO_FOG, LINEAR_FOG, EXPONENTIAL_FOG, EXPONENTIAL_2_FOG };
+struct Fragment {
+	glm::vec3 windowPosition;
+	glm::vec3 worldNormal;
+	glm::vec3 worldPosition;
+	MaterialIndex materialID;	//!< The fragment's material, in the MaterialTable.
+	color litColor;				//!< Color interpolated from the vertices, when lighting is per vertex.
+	SampleMask coverage;		//!< Samples the fragment colors, when the framebuffer is multisampled.
+};
+
+const int LIGHT_TILE_SHIFT = 5;						//!< log2 of the light culling tile size.
+const int LIGHT_TILE_SIZE = 1 << LIGHT_TILE_SHIFT;	//!< Width and height, in pixels, of a light culling tile.
+const float LIGHT_CUTOFF = 1.0f / 256.0f;			//!< Attenuation below which a light is culled. One 8 bit color step.
 
 /**
- * @struct	FogParams
- * @brief	A fog parameters.
+ * @struct	LightBlock
+ * @brief	The culled positional and spot lights, structure of arrays, so
+ * 			shading a fragment walks contiguous light data instead of chasing
+ * 			pointers and virtual calls. Lights whose attenuation is off get
+ * 			1, 0, 0 as their parameters. Non-spot lights get a cone cutoff
+ * 			which every direction passes.
  */
 
-struct FogParams {
-	float start, end, density;
-	fogType type;
-	color color;
-	float fogFactor(const glm::vec3 &fragPos, const glm::vec3 &eyePos) const;
+struct LightBlock {
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> spotX, spotY, spotZ;
+	std::vector<float> cosCutoff;			//!< Cosine of half the spot's fov, or -2 if not a spot.
+	std::vector<float> attenConstant, attenLinear, attenQuadratic;
+	std::vector<color> ambient, diffuse, specular;
+	std::vector<const ShadowMap *> shadowMap;	//!< The light's shadow map, or nullptr if it casts no shadows.
+	void clear();
+	void add(const PositionalLight &light, const ShadowMap *lightShadowMap = nullptr);
+	int size() const { return (int)positionX.size(); }
 };
 
 /**
- * @struct	Fragment
- * @brief	Represents the information relevant to a single fragment. Think
- * 			of a fragment as a pixel competing to get into the framebuffer.
+ * @struct	LightSnapshot
+ * @brief	The settings of a positional or spot light that light culling used,
+ * 			as they were when the lights were culled.
  */
 
-struct Fragment {
-	glm::vec3 windowPosition;
-	Material material;
-	glm::vec3 worldNormal;
-	glm::vec3 worldPosition;
+struct LightSnapshot {
+	const PositionalLight *light;		//!< The light.
+	const SpotLight *spot;				//!< The same light if it is a spot light, otherwise nullptr.
+	glm::vec3 position, spotDirection;
+	float fov;
+	bool isOn, attenuationIsTurnedOn;
+	LightAttenuationParameters attenuationParams;
+	LightColor lightColorComponents;
+	explicit LightSnapshot(const PositionalLight &light);
+	bool isUnchanged() const;
+};
+
+/**
+ * @struct	LightTiles
+ * @brief	Per screen tile light lists for tiled forward+ shading. Each tile
+ * 			lists the lights that can reach any of its pixels, in compressed rows:
+ * 			tile t uses lightIndices[firstLight[t]] .. lightIndices[firstLight[t+1]-1].
+ * 			Lights culled from a tile still contribute their ambient term.
+ * 			The lists only hold for the framebuffer, view and lights they were
+ * 			built for, which are kept so that can be checked.
+ */
+
+struct LightTiles {
+	std::vector<LightSourcePtr> sourceLights;	//!< The lights the lists were built from.
+	std::vector<LightSourcePtr> otherLights;	//!< Lights which aren't positional; never culled.
+	LightBlock block;							//!< The positional lights.
+	int tilesWide, tilesHigh;
+	std::vector<int> firstLight;				//!< Per tile, start of its run in lightIndices. One extra entry at the end.
+	std::vector<int> lightIndices;				//!< Indices into block.
+	std::vector<color> culledAmbient;			//!< Per tile, sum of ambient light from positional lights not listed.
+	bool hasSpotLights;							//!< True ==> some light in block is a spot light.
+	const FrameBuffer *frameBuffer;				//!< The framebuffer the lists were built for.
+	int windowWidth, windowHeight;				//!< Its size then.
+	glm::mat4 viewingMatrix, projectionMatrix, viewportMatrix;	//!< The view the lists were built for.
+	std::vector<LightSnapshot> snapshots;		//!< Each positional light in sourceLights, as it was culled.
+	std::vector<const ShadowMap *> shadowMaps;	//!< The shadow maps the block was given.
+	LightTiles() : tilesWide(0), tilesHigh(0), hasSpotLights(false), frameBuffer(nullptr),
+					windowWidth(0), windowHeight(0) {}
 };
 
+/**
+ * @typedef	FragmentKernel
+ * @brief	Shades a batch of fragments. FragmentOps has one specialization for
+ * 			each reachable combination of depth test, depth and color writes, blending,
+ * 			fog type, light types, per vertex lighting, multisampling and the
+ * 			kind of transparency, so none of those are tested per fragment.
+ */
+
+typedef void (*FragmentKernel)(FrameBuffer &frameBuffer, const RenderState &state,
+								const std::vector<LightSourcePtr> &lights, const LightTiles *tiles,
+								const Fragment fragments[], int count);
+
 /**
  * @class	FragmentOps
  * @brief	Class to encapsulate the methods related to fragment processing.
@@ -44,15 +115,58 @@ class FragmentOps {
 		static bool performDepthTest;		//!< True ==> use depth buffer. Typically true
 		static bool readonlyDepthBuffer;	//!< True ==> rendering will not affect depth buffer. Typically false
 		static bool readonlyColorBuffer;	//!< True ==> rendering will not affect color buffer. Typically false
+		static bool earlyDepthTest;			//!< True ==> depth is tested before attributes are interpolated. False for blending.
+		static bool performBlending;		//!< True ==> fragments are blended into the color buffer by their material's alpha.
+		static transparencyType transparency;	//!< How blended fragments are combined. Typically SORTED_TRANSPARENCY. Draw opaque geometry first with WEIGHTED_BLENDED_TRANSPARENCY
 		static FogParams fogParams;			//!< Parameters controlling fog effects.
+		static std::vector<const ShadowMap *> shadowMaps;	//!< Shadow maps of the lights casting shadows. Typically empty
 		static void FragmentOps::processFragment(FrameBuffer &frameBuffer, const glm::vec3 &eyePositionInWorldCoords,
 														const std::vector<LightSourcePtr> lights, 
 														const Fragment &fragment,
 														const glm::mat4 &viewingMatrix);
+		static void processFragments(FrameBuffer &frameBuffer, const glm::vec3 &eyePositionInWorldCoords,
+										const std::vector<LightSourcePtr> &lights,
+										const Fragment fragments[], int count,
+										const glm::mat4 &viewingMatrix, bool passedDepthTest = false);
+		static void processFragments(FrameBuffer &frameBuffer, const RenderState &state,
+										const std::vector<LightSourcePtr> &lights,
+										const Fragment fragments[], int count, bool passedDepthTest = false);
+		static void cullLights(const FrameBuffer &frameBuffer, const std::vector<LightSourcePtr> &lights,
+								const glm::mat4 &viewingMatrix, const glm::mat4 &projectionMatrix,
+								const glm::mat4 &viewportMatrix);
+		static const LightTiles *currentLightTiles(const FrameBuffer &frameBuffer, const glm::mat4 &viewingMatrix,
+													const std::vector<LightSourcePtr> &lights);
+		static const LightTiles *currentLightTiles(const FrameBuffer &frameBuffer, const RenderState &state,
+													const std::vector<LightSourcePtr> &lights);
+		static void shadeGBufferTile(FrameBuffer &frameBuffer, const std::vector<LightSourcePtr> &lights,
+										const LightTiles *tiles, const Frame &eyeFrame, int tileX, int tileY);
+		static bool isOrderIndependent(const FrameBuffer &frameBuffer, const RenderState &state);
 	protected:
+		static FragmentKernel selectKernel(const FrameBuffer &frameBuffer, const RenderState &state,
+											const std::vector<LightSourcePtr> &lights, bool passedDepthTest,
+											const LightTiles *&tiles);
+		template <int VARIANT>
+		static void shadeFragments(FrameBuffer &frameBuffer, const RenderState &state,
+									const std::vector<LightSourcePtr> &lights, const LightTiles *tiles,
+									const Fragment fragments[], int count);
+		template <int... VARIANTS>
+		static const FragmentKernel *makeKernelTable(std::integer_sequence<int, VARIANTS...>);
+		template <int VARIANT>
+		static FragmentKernel kernelIfReachable(std::true_type);
+		template <int VARIANT>
+		static FragmentKernel kernelIfReachable(std::false_type);
+		template <bool DEPTH_TEST, bool DEPTH_WRITE>
+		static void recordFragments(FrameBuffer &frameBuffer, const RenderState &state,
+									const std::vector<LightSourcePtr> &lights, const LightTiles *tiles,
+									const Fragment fragments[], int count);
 		static color FragmentOps::applyFog(const color &destColor,
 											const glm::vec3 &eyePos, const glm::vec3 &fragPos);
 		static color applyBlending(float alpha, const color &src, const color &dest);
+		template <bool SPOT_LIGHTS>
+		static color lightSurface(const glm::vec3 &position, const glm::vec3 &normal, const Material &material,
+									const Frame &eyeFrame, const std::vector<LightSourcePtr> &lights,
+									const LightTiles *tiles, int x, int y);
+		static LightTiles lightTiles;		//!< Light lists built by the last cullLights. Use through currentLightTiles.
 		static color FragmentOps::applyLighting(const Fragment &fragment, const glm::vec3 &eyePositionInWorldCoords,
 														const std::vector<LightSourcePtr> &lights,
 														const glm::mat4 &viewingMatrix);
@@ -1,14 +1,53 @@
+#include <cstdint>
+#include <cfloat>
+#include <algorithm>
 #include "Utilities.h"
 #include "FrameBuffer.h"
+#include "Rasterization.h"
 
 /**
- * @fn	FrameBuffer::FrameBuffer(const int width, const int height)
+ * @fn	static inline int offsetInTile(int x, int y)
+ * @brief	Computes the index of window pixel (x, y) within its tile.
+ * @param	x	The x coordinate.
+ * @param	y	The y coordinate.
+ * @return	The row-major index of the pixel within its tile.
+ */
+
+static inline int offsetInTile(int x, int y) {
+	return ((y & TILE_MASK) << TILE_SHIFT) + (x & TILE_MASK);
+}
+
+/**
+ * @fn	static char *allocateTiles(size_t bytes, void **aligned)
+ * @brief	Allocates tile storage starting on a cache line boundary. Over-allocates
+ * 			by a cache line and rounds up, since new need not honor the alignment.
+ * @param 		  	bytes  	Number of bytes needed.
+ * @param [out]	aligned	The first cache line boundary within the allocation.
+ * @return	The allocation, which is what must be deleted.
+ */
+
+static char *allocateTiles(size_t bytes, void **aligned) {
+	char *memory = new char[bytes + CACHE_LINE_SIZE];
+	std::uintptr_t address = reinterpret_cast<std::uintptr_t>(memory);
+	address = (address + CACHE_LINE_SIZE - 1) & ~(std::uintptr_t)(CACHE_LINE_SIZE - 1);
+	*aligned = reinterpret_cast<void *>(address);
+	return memory;
+}
+
+/**
+ * @fn	FrameBuffer::FrameBuffer(const int width, const int height, FrameBufferLayout layout)
  * @brief	Constructor
  * @param	width 	The width.
  * @param	height	The height.
+ * @param	layout	The memory layout to use for the color and depth values.
  */
 
-FrameBuffer::FrameBuffer(const int width, const int height) : window(width, height) {
+FrameBuffer::FrameBuffer(const int width, const int height, FrameBufferLayout layout)
+	: window(width, height), layout(layout), colorBuffer(nullptr), depthBuffer(nullptr),
+		tilesWide(0), tilesHigh(0), tiles(nullptr), tileMemory(nullptr), tileClearColor(0xFF000000u),
+		gBufferEnabled(false), gBuffer(nullptr), gBufferMemory(nullptr), sampleCount(1),
+		transparencyEnabled(false), transparency(nullptr), transparencyMemory(nullptr) {
+	clearColorUB[0] = clearColorUB[1] = clearColorUB[2] = 0;
 	setFrameBufferSize(width, height);
 }
 
@@ -18,8 +57,7 @@ FrameBuffer::FrameBuffer(const int width, const int height) : window(width, heig
  */
 
 FrameBuffer::~FrameBuffer() {
-	delete[] colorBuffer;
-	delete[] depthBuffer;
+	releaseBuffers();
 }
 
 /**
@@ -36,11 +74,179 @@ void FrameBuffer::setFrameBufferSize(int width, int height) {
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	glPixelStorei(GL_PACK_ALIGNMENT, 1);
 
-	delete [] colorBuffer;
-	delete [] depthBuffer;
+	releaseBuffers();
+	allocateBuffers();
+}
 
+/**
+ * @fn	void FrameBuffer::allocateBuffers()
+ * @brief	Allocates the buffers needed by the current size and layout. The linear
+ * 			color buffer always exists, since it is what gets handed to OpenGL.
+ */
+
+void FrameBuffer::allocateBuffers() {
+	tilesWide = (window.width + TILE_SIZE - 1) / TILE_SIZE;
+	tilesHigh = (window.height + TILE_SIZE - 1) / TILE_SIZE;
 	colorBuffer = new GLubyte[window.area() * BYTES_PER_PIXEL];
-	depthBuffer = new float[window.area()];
+	tileMinDepth.assign(tilesWide * tilesHigh, 1.0f);
+	tileMaxDepth.assign(tilesWide * tilesHigh, 1.0f);
+
+	if (layout == TILED_LAYOUT) {
+		void *aligned;
+		tileMemory = allocateTiles(tilesWide * tilesHigh * sizeof(FrameBufferTile), &aligned);
+		tiles = static_cast<FrameBufferTile *>(aligned);
+
+		// Fresh tiles read back as cleared, rather than as garbage
+		tileCleared.assign(tilesWide * tilesHigh, 1);
+	} else {
+		depthBuffer = new float[window.area()];
+		std::fill(depthBuffer, depthBuffer + window.area(), 1.0f);
+	}
+
+	if (sampleCount > 1) {
+		sampleColors.assign(window.area() * sampleCount, tileClearColor);
+		sampleDepths.assign(window.area() * sampleCount, 1.0f);
+	}
+
+	if (gBufferEnabled) {
+		allocateGBuffer();
+	}
+	if (transparencyEnabled) {
+		allocateTransparency();
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::allocateGBuffer()
+ * @brief	Allocates an empty G-buffer for the current size.
+ */
+
+void FrameBuffer::allocateGBuffer() {
+	void *aligned;
+	gBufferMemory = allocateTiles(tilesWide * tilesHigh * sizeof(GBufferTile), &aligned);
+	gBuffer = static_cast<GBufferTile *>(aligned);
+	gBufferTileUsed.assign(tilesWide * tilesHigh, 0);
+}
+
+/**
+ * @fn	void FrameBuffer::releaseGBuffer()
+ * @brief	Releases the G-buffer.
+ */
+
+void FrameBuffer::releaseGBuffer() {
+	delete[] gBufferMemory;
+	gBufferMemory = nullptr;
+	gBuffer = nullptr;
+	gBufferTileUsed.clear();
+}
+
+/**
+ * @fn	void FrameBuffer::allocateTransparency()
+ * @brief	Allocates empty transparency buffers for the current size.
+ */
+
+void FrameBuffer::allocateTransparency() {
+	void *aligned;
+	transparencyMemory = allocateTiles(tilesWide * tilesHigh * sizeof(TransparencyTile), &aligned);
+	transparency = static_cast<TransparencyTile *>(aligned);
+	transparencyTileUsed.assign(tilesWide * tilesHigh, 0);
+}
+
+/**
+ * @fn	void FrameBuffer::releaseTransparency()
+ * @brief	Releases the transparency buffers.
+ */
+
+void FrameBuffer::releaseTransparency() {
+	delete[] transparencyMemory;
+	transparencyMemory = nullptr;
+	transparency = nullptr;
+	transparencyTileUsed.clear();
+}
+
+/**
+ * @fn	void FrameBuffer::releaseBuffers()
+ * @brief	Releases all the buffers.
+ */
+
+void FrameBuffer::releaseBuffers() {
+	delete[] colorBuffer;
+	delete[] depthBuffer;
+	delete[] tileMemory;
+	colorBuffer = nullptr;
+	depthBuffer = nullptr;
+	tileMemory = nullptr;
+	tiles = nullptr;
+	tileCleared.clear();
+	tileMinDepth.clear();
+	tileMaxDepth.clear();
+	sampleColors.clear();
+	sampleColors.shrink_to_fit();
+	sampleDepths.clear();
+	sampleDepths.shrink_to_fit();
+	releaseGBuffer();
+	releaseTransparency();
+}
+
+/**
+ * @fn	void FrameBuffer::setLayout(FrameBufferLayout newLayout)
+ * @brief	Switches the memory layout, preserving the current colors and depths.
+ * @param	newLayout	The new layout.
+ */
+
+void FrameBuffer::setLayout(FrameBufferLayout newLayout) {
+	if (newLayout != layout) {
+		reallocateBuffers(newLayout, sampleCount);
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::setSampleCount(int count)
+ * @brief	Turns multisampling on or off, preserving the current colors and depths.
+ * 			Each pixel's samples start out as copies of it.
+ * @param	count	Samples per pixel: 4 or 8, or 1 for none. Anything else means 1.
+ */
+
+void FrameBuffer::setSampleCount(int count) {
+	if (count != 4 && count != 8) {
+		count = 1;
+	}
+	if (count != sampleCount) {
+		reallocateBuffers(layout, count);
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::reallocateBuffers(FrameBufferLayout newLayout, int newSampleCount)
+ * @brief	Switches the layout and sample count, carrying the colors and depths over.
+ * 			Binned triangles are drawn first, into the old buffers.
+ * @param	newLayout	  	The new layout.
+ * @param	newSampleCount	The new number of samples per pixel.
+ */
+
+void FrameBuffer::reallocateBuffers(FrameBufferLayout newLayout, int newSampleCount) {
+	flushTriangleBins();
+	const int W = window.width;
+	const int H = window.height;
+	std::vector<color> colors(window.area());
+	std::vector<float> depths(window.area());
+	for (int y = 0; y < H; ++y) {
+		for (int x = 0; x < W; ++x) {
+			colors[y * W + x] = getColor(x, y);
+			depths[y * W + x] = getDepth(x, y);
+		}
+	}
+
+	releaseBuffers();
+	layout = newLayout;
+	sampleCount = newSampleCount;
+	allocateBuffers();
+
+	for (int y = 0; y < H; ++y) {
+		for (int x = 0; x < W; ++x) {
+			setPixel(x, y, colors[y * W + x], depths[y * W + x]);
+		}
+	}
 }
 
 /**
@@ -57,31 +263,142 @@ void FrameBuffer::setClearColor(const color &clear) {
 
 /**
  * @fn	void FrameBuffer::clearColorAndDepthBuffers()
- * @brief	Clears the color and depth buffers
+ * @brief	Clears the color and depth buffers. When tiled, this just flags every
+ * 			tile as cleared, so the cost is proportional to the number of tiles.
+ * 			When multisampled, every sample is cleared. Binned triangles are drawn
+ * 			first, so none of them land on the cleared frame.
  */
 
 void FrameBuffer::clearColorAndDepthBuffers() {
-	for (int y = 0; y < window.height; ++y) {
-		for (int x = 0; x < window.width; ++x) {
-			std::memcpy(colorBuffer + BYTES_PER_PIXEL * (x + y * window.width),
-				clearColorUB, BYTES_PER_PIXEL);
-		}
+	flushTriangleBins();
+	tileClearColor = clearColorUB[0] | (clearColorUB[1] << 8) |
+						(clearColorUB[2] << 16) | 0xFF000000u;
+	if (sampleCount > 1) {
+		std::fill(sampleColors.begin(), sampleColors.end(), tileClearColor);
+		std::fill(sampleDepths.begin(), sampleDepths.end(), 1.0f);
+	} else if (layout == TILED_LAYOUT) {
+		std::fill(tileCleared.begin(), tileCleared.end(), 1);
+	} else {
+		clearLinearBuffers();
 	}
+	std::fill(tileMinDepth.begin(), tileMinDepth.end(), 1.0f);
+	std::fill(tileMaxDepth.begin(), tileMaxDepth.end(), 1.0f);
+	std::fill(gBufferTileUsed.begin(), gBufferTileUsed.end(), 0);
+	std::fill(transparencyTileUsed.begin(), transparencyTileUsed.end(), 0);
+}
+
+/**
+ * @fn	void FrameBuffer::clearLinearBuffers()
+ * @brief	Clears the linear color and depth buffers. The 3 byte clear color is
+ * 			written once into the first row, which is then copied to the rest of
+ * 			the rows, so every store is a wide memcpy store.
+ */
+
+void FrameBuffer::clearLinearBuffers() {
 	const int SZ = window.area();
+	const int ROW_BYTES = window.width * BYTES_PER_PIXEL;
+
+	if (clearColorUB[0] == clearColorUB[1] && clearColorUB[1] == clearColorUB[2]) {
+		std::memset(colorBuffer, clearColorUB[0], SZ * BYTES_PER_PIXEL);
+	} else if (SZ > 0) {
+		// Double the run of copied pixels until the first row is full
+		std::memcpy(colorBuffer, clearColorUB, BYTES_PER_PIXEL);
+		int filled = BYTES_PER_PIXEL;
+		while (filled < ROW_BYTES) {
+			int chunk = std::min(filled, ROW_BYTES - filled);
+			std::memcpy(colorBuffer + filled, colorBuffer, chunk);
+			filled += chunk;
+		}
+		for (int y = 1; y < window.height; ++y) {
+			std::memcpy(colorBuffer + y * ROW_BYTES, colorBuffer, ROW_BYTES);
+		}
+	}
 	std::fill(depthBuffer, depthBuffer + SZ, 1.0f);
 }
 
+/**
+ * @fn	void FrameBuffer::materializeTile(int tileIndex)
+ * @brief	Fills a cleared tile with the clear values, so it can be written to.
+ * @param	tileIndex	Index of the tile.
+ */
+
+void FrameBuffer::materializeTile(int tileIndex) {
+	FrameBufferTile &tile = tiles[tileIndex];
+	std::fill(tile.color, tile.color + PIXELS_PER_TILE, tileClearColor);
+	std::fill(tile.depth, tile.depth + PIXELS_PER_TILE, 1.0f);
+	tileCleared[tileIndex] = 0;
+}
+
 /**
  * @fn	void FrameBuffer::showColorBuffer() const
  * @brief	Shows the contents of the color buffer to screen.
  */
 
 void FrameBuffer::showColorBuffer() const {
+	if (sampleCount > 1) {
+		resolveSamples();
+	} else if (layout == TILED_LAYOUT) {
+		resolveTiles();
+	}
 	glRasterPos2d(-1, -1);
 	glDrawPixels(window.width, window.height, GL_RGB, GL_UNSIGNED_BYTE, colorBuffer);
 	glFlush();
 }
 
+/**
+ * @fn	void FrameBuffer::resolveTiles() const
+ * @brief	Linearizes the tiles into the RGB color buffer, which is what OpenGL
+ * 			displays. Walks tile by tile, so each tile is read exactly once.
+ */
+
+void FrameBuffer::resolveTiles() const {
+	for (int ty = 0; ty < tilesHigh; ++ty) {
+		const int yStart = ty * TILE_SIZE;
+		const int yEnd = std::min(yStart + TILE_SIZE, window.height);
+		for (int tx = 0; tx < tilesWide; ++tx) {
+			const FrameBufferTile &tile = tiles[ty * tilesWide + tx];
+			const bool cleared = tileCleared[ty * tilesWide + tx] != 0;
+			const int xStart = tx * TILE_SIZE;
+			const int xEnd = std::min(xStart + TILE_SIZE, window.width);
+			for (int y = yStart; y < yEnd; ++y) {
+				const GLuint *src = tile.color + ((y - yStart) << TILE_SHIFT);
+				GLubyte *dest = colorBuffer + BYTES_PER_PIXEL * (xStart + y * window.width);
+				for (int x = xStart; x < xEnd; ++x) {
+					GLuint C = cleared ? tileClearColor : *src;
+					src++;
+					*dest++ = (GLubyte)(C & 0xFF);
+					*dest++ = (GLubyte)((C >> 8) & 0xFF);
+					*dest++ = (GLubyte)((C >> 16) & 0xFF);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::resolveSamples() const
+ * @brief	Averages each pixel's samples into the RGB color buffer, which is what
+ * 			OpenGL displays. Only valid when multisampled.
+ */
+
+void FrameBuffer::resolveSamples() const {
+	const int S = sampleCount;
+	const GLuint *samples = sampleColors.data();
+	GLubyte *dest = colorBuffer;
+	for (int i = 0; i < window.area(); ++i) {
+		GLuint r = S / 2, g = S / 2, b = S / 2;		// Rounds to nearest
+		for (int s = 0; s < S; ++s) {
+			const GLuint C = *samples++;
+			r += C & 0xFF;
+			g += (C >> 8) & 0xFF;
+			b += (C >> 16) & 0xFF;
+		}
+		*dest++ = (GLubyte)(r / S);
+		*dest++ = (GLubyte)(g / S);
+		*dest++ = (GLubyte)(b / S);
+	}
+}
+
 /**
  * @fn	void FrameBuffer::setColor(int x, int y, const color &rgb)
  * @brief	Sets a color at (x, y)
@@ -95,6 +412,15 @@ void FrameBuffer::setColor(int x, int y, const color &rgb) {
 		return;
 	}
 
+	if (sampleCount > 1) {
+		std::fill_n(sampleColors.begin() + sampleIndex(x, y), sampleCount, packColor(rgb));
+		return;
+	}
+	if (layout == TILED_LAYOUT) {
+		getTile(x >> TILE_SHIFT, y >> TILE_SHIFT).color[offsetInTile(x, y)] = packColor(rgb);
+		return;
+	}
+
 	color clampedColor = glm::clamp(rgb, 0.0f, 1.0f);
 
 	GLubyte c[] = { (GLubyte)(clampedColor.r * 255),
@@ -106,7 +432,7 @@ void FrameBuffer::setColor(int x, int y, const color &rgb) {
 
 /**
  * @fn	color FrameBuffer::getColor(int x, int y) const
- * @brief	Gets the color at (x, y)
+ * @brief	Gets the color at (x, y). When multisampled, the average of its samples.
  * @param	x	The x coordinate.
  * @param	y	The y coordinate.
  * @return	The color at (x, y)
@@ -115,7 +441,18 @@ void FrameBuffer::setColor(int x, int y, const color &rgb) {
 color FrameBuffer::getColor(int x, int y) const {
 	float red, green, blue;
 
-	if (checkInWindow(x, y)) {
+	if (checkInWindow(x, y) && sampleCount > 1) {
+		color sum = black;
+		for (int s = 0; s < sampleCount; ++s) {
+			sum += unpackColor(sampleColors[sampleIndex(x, y) + s]);
+		}
+		return sum / (float)sampleCount;
+	} else if (checkInWindow(x, y) && layout == TILED_LAYOUT) {
+		if (isTileCleared(x >> TILE_SHIFT, y >> TILE_SHIFT)) {
+			return unpackColor(tileClearColor);
+		}
+		return unpackColor(tiles[(y >> TILE_SHIFT) * tilesWide + (x >> TILE_SHIFT)].color[offsetInTile(x, y)]);
+	} else if (checkInWindow(x, y)) {
 		GLubyte c[BYTES_PER_PIXEL];
 
 		// Retrieve color values from the color buffer
@@ -155,21 +492,40 @@ void FrameBuffer::setDepth(float x, float y, float depth) {
  */
 
 void FrameBuffer::setDepth(int x, int y, float depth) {
-	if (checkInWindow(x, y)) {
+	if (!checkInWindow(x, y)) {
+		return;
+	}
+	if (sampleCount > 1) {
+		std::fill_n(sampleDepths.begin() + sampleIndex(x, y), sampleCount, depth);
+	} else if (layout == TILED_LAYOUT) {
+		getTile(x >> TILE_SHIFT, y >> TILE_SHIFT).depth[offsetInTile(x, y)] = depth;
+	} else {
 		depthBuffer[y * window.width + x] = depth;
 	}
+
+	const int tileIndex = (y >> TILE_SHIFT) * tilesWide + (x >> TILE_SHIFT);
+	tileMinDepth[tileIndex] = std::min(tileMinDepth[tileIndex], depth);
+	tileMaxDepth[tileIndex] = std::max(tileMaxDepth[tileIndex], depth);
 }
 
 /**
 * @fn	float FrameBuffer::getDepth(float x, float y) const
-* @brief	Gets a depth at (x, y)
+* @brief	Gets a depth at (x, y). When multisampled, the nearest of its samples.
 * @param	x	The x coordinate.
 * @param	y	The y coordinate.
 * @return	The depth at (x, y).
 */
 
 float FrameBuffer::getDepth(int x, int y) const {
-	if (checkInWindow(x, y)) {
+	if (checkInWindow(x, y) && sampleCount > 1) {
+		const float *depths = sampleDepths.data() + sampleIndex(x, y);
+		return *std::min_element(depths, depths + sampleCount);
+	} else if (checkInWindow(x, y) && layout == TILED_LAYOUT) {
+		if (isTileCleared(x >> TILE_SHIFT, y >> TILE_SHIFT)) {
+			return 1.0f;
+		}
+		return tiles[(y >> TILE_SHIFT) * tilesWide + (x >> TILE_SHIFT)].depth[offsetInTile(x, y)];
+	} else if (checkInWindow(x, y)) {
 		return depthBuffer[y * window.width + x];
 	} else {
 		return 0.0f;
@@ -214,3 +570,549 @@ void FrameBuffer::setPixel(int x, int y, const color &C, float depth) {
 	setDepth(x, y, depth);
 	setColor(x, y, C);
 }
+
+/**
+ * @fn	SampleMask FrameBuffer::testSampleDepths(int x, int y, SampleMask covered, const float depths[MAX_SAMPLES], bool depthTest, bool depthWrite)
+ * @brief	Depth tests the samples of one pixel that a primitive covers, and
+ * 			optionally writes the depths of the ones that pass. Only valid when
+ * 			multisampled, and (x, y) must be in the window.
+ * @param	x		  	The x coordinate.
+ * @param	y		  	The y coordinate.
+ * @param	covered   	The samples covered.
+ * @param	depths	  	The primitive's depth at each sample.
+ * @param	depthTest 	False ==> every covered sample passes.
+ * @param	depthWrite	True ==> passing samples take their new depths.
+ * @return	The samples that passed.
+ */
+
+SampleMask FrameBuffer::testSampleDepths(int x, int y, SampleMask covered, const float depths[MAX_SAMPLES],
+											bool depthTest, bool depthWrite) {
+	float *stored = sampleDepths.data() + sampleIndex(x, y);
+	SampleMask passed = 0;
+	for (int s = 0; s < sampleCount; ++s) {
+		if ((covered & (1 << s)) && (!depthTest || depths[s] < stored[s])) {
+			passed |= 1 << s;
+		}
+	}
+	if (depthWrite && passed != 0) {
+		const int tileIndex = (y >> TILE_SHIFT) * tilesWide + (x >> TILE_SHIFT);
+		float minDepth = tileMinDepth[tileIndex], maxDepth = tileMaxDepth[tileIndex];
+		for (int s = 0; s < sampleCount; ++s) {
+			if (passed & (1 << s)) {
+				stored[s] = depths[s];
+				minDepth = std::min(minDepth, depths[s]);
+				maxDepth = std::max(maxDepth, depths[s]);
+			}
+		}
+		tileMinDepth[tileIndex] = minDepth;
+		tileMaxDepth[tileIndex] = maxDepth;
+	}
+	return passed;
+}
+
+/**
+ * @fn	void FrameBuffer::setSampleColors(int x, int y, SampleMask mask, const color &C)
+ * @brief	Sets the color of some of a pixel's samples. Only valid when
+ * 			multisampled, and (x, y) must be in the window.
+ * @param	x   	The x coordinate.
+ * @param	y   	The y coordinate.
+ * @param	mask	The samples to set.
+ * @param	C   	The color.
+ */
+
+void FrameBuffer::setSampleColors(int x, int y, SampleMask mask, const color &C) {
+	GLuint *colors = sampleColors.data() + sampleIndex(x, y);
+	const GLuint packed = packColor(C);
+	for (int s = 0; s < sampleCount; ++s) {
+		if (mask & (1 << s)) {
+			colors[s] = packed;
+		}
+	}
+}
+
+/**
+ * @fn	bool FrameBuffer::isTileCleared(int tileX, int tileY) const
+ * @brief	Determines if a tile still holds nothing but the clear values. Only valid
+ * 			in TILED_LAYOUT, without multisampling.
+ * @param	tileX	The tile column.
+ * @param	tileY	The tile row.
+ * @return	True iff nothing has been written to the tile since the last clear.
+ */
+
+bool FrameBuffer::isTileCleared(int tileX, int tileY) const {
+	return tileCleared[tileY * tilesWide + tileX] != 0;
+}
+
+/**
+ * @fn	FrameBufferTile &FrameBuffer::getTile(int tileX, int tileY)
+ * @brief	Gets a tile, for direct access by tile renderers. Only valid in TILED_LAYOUT,
+ * 			without multisampling. A cleared tile is filled with the clear values first.
+ * @param	tileX	The tile column.
+ * @param	tileY	The tile row.
+ * @return	The tile.
+ */
+
+FrameBufferTile &FrameBuffer::getTile(int tileX, int tileY) {
+	const int index = tileY * tilesWide + tileX;
+	if (tileCleared[index]) {
+		materializeTile(index);
+	}
+	return tiles[index];
+}
+
+/**
+ * @fn	const FrameBufferTile &FrameBuffer::getTile(int tileX, int tileY) const
+ * @brief	Gets a tile, for direct read access by tile renderers. Only valid in
+ * 			TILED_LAYOUT, without multisampling. The contents are stale if isTileCleared(tileX, tileY) is true.
+ * @param	tileX	The tile column.
+ * @param	tileY	The tile row.
+ * @return	The tile.
+ */
+
+const FrameBufferTile &FrameBuffer::getTile(int tileX, int tileY) const {
+	return tiles[tileY * tilesWide + tileX];
+}
+
+/**
+ * @fn	void FrameBuffer::writeTile(int tileX, int tileY, const color colors[PIXELS_PER_TILE], const float depths[PIXELS_PER_TILE], TileMask mask)
+ * @brief	Writes a batch of pixels belonging to one tile. In TILED_LAYOUT there are
+ * 			no per pixel bounds checks; pixels that fall in the padding beyond the
+ * 			window's edge are simply never shown.
+ * @param	tileX 	The tile column.
+ * @param	tileY 	The tile row.
+ * @param	colors	The colors, row-major within the tile.
+ * @param	depths	The depths, row-major within the tile.
+ * @param	mask  	Which of the pixels to write.
+ */
+
+void FrameBuffer::writeTile(int tileX, int tileY, const color colors[PIXELS_PER_TILE],
+							const float depths[PIXELS_PER_TILE], TileMask mask) {
+	if (layout != TILED_LAYOUT || sampleCount > 1) {
+		for (int i = 0; i < PIXELS_PER_TILE; i++) {
+			if (mask & (1ULL << i)) {
+				setPixel((tileX << TILE_SHIFT) + (i & TILE_MASK), (tileY << TILE_SHIFT) + (i >> TILE_SHIFT),
+						colors[i], depths[i]);
+			}
+		}
+		return;
+	}
+
+	const int index = tileY * tilesWide + tileX;
+	if (mask == ~0ULL) {
+		tileCleared[index] = 0;		// Every pixel is overwritten, no need to fill in the clear values
+	}
+	FrameBufferTile &tile = getTile(tileX, tileY);
+	float minDepth = tileMinDepth[index], maxDepth = tileMaxDepth[index];
+	for (int i = 0; i < PIXELS_PER_TILE; i++) {
+		if (mask & (1ULL << i)) {
+			tile.color[i] = packColor(colors[i]);
+			tile.depth[i] = depths[i];
+			minDepth = std::min(minDepth, depths[i]);
+			maxDepth = std::max(maxDepth, depths[i]);
+		}
+	}
+	tileMinDepth[index] = minDepth;
+	tileMaxDepth[index] = maxDepth;
+}
+
+/**
+ * @fn	void FrameBuffer::refreshTileDepthBounds(int tileX, int tileY)
+ * @brief	Recomputes a tile's depth bounds from the depths it holds. Writing a
+ * 			depth only ever widens the bounds, so renderers call this after drawing
+ * 			into a tile to let the maximum come back down as the tile fills in.
+ * @param	tileX	The tile column.
+ * @param	tileY	The tile row.
+ */
+
+void FrameBuffer::refreshTileDepthBounds(int tileX, int tileY) {
+	const int index = tileY * tilesWide + tileX;
+	if (sampleCount == 1 && layout == TILED_LAYOUT && tileCleared[index]) {
+		tileMinDepth[index] = tileMaxDepth[index] = 1.0f;
+		return;
+	}
+
+	// Only pixels inside the window count; edge tiles' padding is never drawn
+	const int xStart = tileX << TILE_SHIFT, xEnd = std::min(xStart + TILE_SIZE, window.width);
+	const int yStart = tileY << TILE_SHIFT, yEnd = std::min(yStart + TILE_SIZE, window.height);
+	float minDepth = FLT_MAX, maxDepth = -FLT_MAX;
+	for (int y = yStart; y < yEnd; ++y) {
+		const float *depths = sampleCount > 1 ? sampleDepths.data() + sampleIndex(xStart, y) :
+								layout == TILED_LAYOUT ? tiles[index].depth + ((y - yStart) << TILE_SHIFT)
+													: depthBuffer + y * window.width + xStart;
+		for (int i = 0; i < (xEnd - xStart) * sampleCount; ++i) {
+			minDepth = std::min(minDepth, depths[i]);
+			maxDepth = std::max(maxDepth, depths[i]);
+		}
+	}
+	tileMinDepth[index] = minDepth;
+	tileMaxDepth[index] = maxDepth;
+}
+
+/**
+ * @fn	void FrameBuffer::readTileDepths(int tileX, int tileY, float depths[PIXELS_PER_TILE]) const
+ * @brief	Copies out a tile's depths, in either layout, so a tile renderer can
+ * 			depth test a whole tile without per pixel calls. When multisampled,
+ * 			each pixel's depth is the nearest of its samples.
+ * @param	tileX 	The tile column.
+ * @param	tileY 	The tile row.
+ * @param	depths	Receives the depths, row-major within the tile. Pixels beyond the
+ * 					window's edge read as the clear depth.
+ */
+
+void FrameBuffer::readTileDepths(int tileX, int tileY, float depths[PIXELS_PER_TILE]) const {
+	const int index = tileY * tilesWide + tileX;
+	if (sampleCount > 1) {
+		for (int i = 0; i < PIXELS_PER_TILE; i++) {
+			const int x = (tileX << TILE_SHIFT) + (i & TILE_MASK), y = (tileY << TILE_SHIFT) + (i >> TILE_SHIFT);
+			depths[i] = checkInWindow(x, y) ? getDepth(x, y) : 1.0f;
+		}
+		return;
+	}
+	if (layout == TILED_LAYOUT) {
+		if (tileCleared[index]) {
+			std::fill(depths, depths + PIXELS_PER_TILE, 1.0f);
+		} else {
+			std::memcpy(depths, tiles[index].depth, sizeof(tiles[index].depth));
+		}
+		return;
+	}
+
+	const int xStart = tileX << TILE_SHIFT, width = std::min(TILE_SIZE, window.width - xStart);
+	const int yStart = tileY << TILE_SHIFT, height = std::min(TILE_SIZE, window.height - yStart);
+	if (width < TILE_SIZE || height < TILE_SIZE) {
+		std::fill(depths, depths + PIXELS_PER_TILE, 1.0f);
+	}
+	for (int row = 0; row < height; ++row) {
+		std::memcpy(depths + (row << TILE_SHIFT), depthBuffer + (yStart + row) * window.width + xStart,
+					width * sizeof(float));
+	}
+}
+
+/**
+ * @fn	bool FrameBuffer::isRegionOccluded(int left, int right, int bottom, int top, float nearestDepth) const
+ * @brief	Hierarchical Z test. Determines if anything in a rectangle of pixels, no
+ * 			nearer than nearestDepth, is certain to fail the depth test.
+ * @param	left			Leftmost pixel column.
+ * @param	right			Rightmost pixel column.
+ * @param	bottom			Bottom pixel row.
+ * @param	top				Top pixel row.
+ * @param	nearestDepth	The smallest depth anything in the rectangle can have.
+ * @return	True iff every tile overlapping the rectangle is already nearer.
+ */
+
+bool FrameBuffer::isRegionOccluded(int left, int right, int bottom, int top, float nearestDepth) const {
+	left = std::max(left, 0);
+	bottom = std::max(bottom, 0);
+	right = std::min(right, window.width - 1);
+	top = std::min(top, window.height - 1);
+	for (int ty = bottom >> TILE_SHIFT; ty <= top >> TILE_SHIFT; ++ty) {
+		for (int tx = left >> TILE_SHIFT; tx <= right >> TILE_SHIFT; ++tx) {
+			if (nearestDepth < tileMaxDepth[ty * tilesWide + tx]) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	void FrameBuffer::setGBufferEnabled(bool enabled)
+ * @brief	Turns deferred rendering on or off, allocating or releasing the G-buffer.
+ * 			The color and depth contents are kept. Only opaque draws lit per pixel
+ * 			are deferred. Depth only draws just write depth. Blended draws are
+ * 			shaded forward without writing depth, so the lighting pass overwrites
+ * 			them wherever an opaque surface is behind them: draw them after
+ * 			shadeGBuffer, or use order-independent transparency, which is
+ * 			composited after it.
+ * @param	enabled	True ==> fragments fill the G-buffer and are lit in a later pass.
+ */
+
+void FrameBuffer::setGBufferEnabled(bool enabled) {
+	if (enabled == gBufferEnabled) {
+		return;
+	}
+	gBufferEnabled = enabled;
+	if (enabled) {
+		allocateGBuffer();
+	} else {
+		releaseGBuffer();
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::setGBufferTexel(int x, int y, const glm::vec3 &normal, const glm::vec3 &position, int materialID)
+ * @brief	Records the surface seen at (x, y), to be lit by the deferred lighting pass.
+ * @param	x		  	The x coordinate.
+ * @param	y		  	The y coordinate.
+ * @param	normal	  	World space normal.
+ * @param	position  	World space position.
+ * @param	materialID	Index of the material in the MaterialTable.
+ */
+
+void FrameBuffer::setGBufferTexel(int x, int y, const glm::vec3 &normal, const glm::vec3 &position, int materialID) {
+	if (!checkInWindow(x, y)) {
+		return;
+	}
+	const int tileIndex = (y >> TILE_SHIFT) * tilesWide + (x >> TILE_SHIFT);
+	GBufferTile &tile = gBuffer[tileIndex];
+	if (!gBufferTileUsed[tileIndex]) {
+		std::fill(tile.materialID, tile.materialID + PIXELS_PER_TILE, NO_MATERIAL);
+		gBufferTileUsed[tileIndex] = 1;
+	}
+	const int i = offsetInTile(x, y);
+	tile.normalX[i] = normal.x;
+	tile.normalY[i] = normal.y;
+	tile.normalZ[i] = normal.z;
+	tile.positionX[i] = position.x;
+	tile.positionY[i] = position.y;
+	tile.positionZ[i] = position.z;
+	tile.materialID[i] = materialID;
+}
+
+/**
+ * @fn	void FrameBuffer::setTransparencyEnabled(bool enabled)
+ * @brief	Allocates or releases the buffers order-independent transparency
+ * 			gathers transparent fragments in. The color and depth contents are kept.
+ * @param	enabled	True ==> the transparency buffers are wanted.
+ */
+
+void FrameBuffer::setTransparencyEnabled(bool enabled) {
+	if (enabled == transparencyEnabled) {
+		return;
+	}
+	transparencyEnabled = enabled;
+	if (enabled) {
+		allocateTransparency();
+	} else {
+		releaseTransparency();
+	}
+}
+
+/**
+ * @fn	TransparencyTile &FrameBuffer::getTransparencyTile(int x, int y)
+ * @brief	Gets the transparency tile holding (x, y), emptying it first if
+ * 			nothing has been gathered in it since the last clear or composite.
+ * @param	x	The x coordinate.
+ * @param	y	The y coordinate.
+ * @return	The tile.
+ */
+
+TransparencyTile &FrameBuffer::getTransparencyTile(int x, int y) {
+	const int tileIndex = (y >> TILE_SHIFT) * tilesWide + (x >> TILE_SHIFT);
+	TransparencyTile &tile = transparency[tileIndex];
+	if (!transparencyTileUsed[tileIndex]) {
+		for (float *plane : { tile.accumRed, tile.accumGreen, tile.accumBlue, tile.accumAlpha }) {
+			std::fill(plane, plane + PIXELS_PER_TILE, 0.0f);
+		}
+		std::fill(tile.revealage, tile.revealage + PIXELS_PER_TILE, 1.0f);
+		std::fill(tile.layerCount, tile.layerCount + PIXELS_PER_TILE, 0);
+		transparencyTileUsed[tileIndex] = 1;
+	}
+	return tile;
+}
+
+/**
+ * @fn	void FrameBuffer::accumulateTransparentFragment(int x, int y, const color &C, float alpha, float weight)
+ * @brief	Adds a transparent fragment to the weighted blended accumulation at
+ * 			(x, y). The order fragments arrive in makes no difference.
+ * @param	x	  	The x coordinate.
+ * @param	y	  	The y coordinate.
+ * @param	C	  	The fragment's color.
+ * @param	alpha 	The fragment's opacity.
+ * @param	weight	How much the fragment counts, relative to the others at the pixel.
+ * 					Should fall off with distance, so nearer surfaces dominate.
+ */
+
+void FrameBuffer::accumulateTransparentFragment(int x, int y, const color &C, float alpha, float weight) {
+	if (!checkInWindow(x, y)) {
+		return;
+	}
+	TransparencyTile &tile = getTransparencyTile(x, y);
+	const int i = offsetInTile(x, y);
+	const float aw = alpha * weight;
+	tile.accumRed[i] += C.r * aw;
+	tile.accumGreen[i] += C.g * aw;
+	tile.accumBlue[i] += C.b * aw;
+	tile.accumAlpha[i] += aw;
+	tile.revealage[i] *= 1.0f - alpha;
+}
+
+/**
+ * @fn	static GLuint packPremultiplied(const glm::vec4 &C)
+ * @brief	Packs a premultiplied color and its alpha into RGBA8.
+ * @param	C	The color. It is clamped to [0,1].
+ * @return	The packed color.
+ */
+
+static GLuint packPremultiplied(const glm::vec4 &C) {
+	glm::vec4 clamped = glm::clamp(C, 0.0f, 1.0f);
+	return (GLuint)(GLubyte)(clamped.r * 255 + 0.5f) | ((GLuint)(GLubyte)(clamped.g * 255 + 0.5f) << 8) |
+			((GLuint)(GLubyte)(clamped.b * 255 + 0.5f) << 16) | ((GLuint)(GLubyte)(clamped.a * 255 + 0.5f) << 24);
+}
+
+/**
+ * @fn	static glm::vec4 unpackPremultiplied(GLuint C)
+ * @brief	Unpacks a color packed by packPremultiplied.
+ * @param	C	The packed color.
+ * @return	The premultiplied color and its alpha.
+ */
+
+static glm::vec4 unpackPremultiplied(GLuint C) {
+	return glm::vec4(C & 0xFF, (C >> 8) & 0xFF, (C >> 16) & 0xFF, C >> 24) / 255.0f;
+}
+
+/**
+ * @fn	void FrameBuffer::insertTransparentFragment(int x, int y, const color &C, float alpha, float depth)
+ * @brief	Inserts a transparent fragment into the k-buffer at (x, y), keeping
+ * 			the layers sorted by depth. When there is no room, the two farthest
+ * 			layers are merged, the nearer over the farther, so the error stays
+ * 			behind the first K_BUFFER_LAYERS - 1 layers.
+ * @param	x	 	The x coordinate.
+ * @param	y	 	The y coordinate.
+ * @param	C	 	The fragment's color.
+ * @param	alpha	The fragment's opacity.
+ * @param	depth	The fragment's depth.
+ */
+
+void FrameBuffer::insertTransparentFragment(int x, int y, const color &C, float alpha, float depth) {
+	if (!checkInWindow(x, y)) {
+		return;
+	}
+	TransparencyTile &tile = getTransparencyTile(x, y);
+	const int i = offsetInTile(x, y);
+	const int count = tile.layerCount[i];
+	const GLuint layer = packPremultiplied(glm::vec4(C * alpha, alpha));
+	int pos = count;
+	while (pos > 0 && depth < tile.layerDepth[pos - 1][i]) {
+		pos--;
+	}
+
+	const int LAST = K_BUFFER_LAYERS - 1;
+	if (count == K_BUFFER_LAYERS && pos == K_BUFFER_LAYERS) {
+		// Behind every layer, so it goes under the farthest
+		const glm::vec4 nearer = unpackPremultiplied(tile.layerColor[LAST][i]);
+		tile.layerColor[LAST][i] = packPremultiplied(nearer + (1.0f - nearer.a) * unpackPremultiplied(layer));
+		return;
+	}
+	const GLuint evicted = tile.layerColor[LAST][i];
+	for (int j = std::min(count, LAST); j > pos; j--) {
+		tile.layerColor[j][i] = tile.layerColor[j - 1][i];
+		tile.layerDepth[j][i] = tile.layerDepth[j - 1][i];
+	}
+	tile.layerColor[pos][i] = layer;
+	tile.layerDepth[pos][i] = depth;
+	if (count == K_BUFFER_LAYERS) {
+		// The layer pushed off the end goes under the new farthest
+		const glm::vec4 nearer = unpackPremultiplied(tile.layerColor[LAST][i]);
+		tile.layerColor[LAST][i] = packPremultiplied(nearer + (1.0f - nearer.a) * unpackPremultiplied(evicted));
+	} else {
+		tile.layerCount[i] = (unsigned char)(count + 1);
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::compositeOver(int x, int y, const color &C, float transmittance)
+ * @brief	Composites a premultiplied color over (x, y): dest = C + transmittance * dest.
+ * 			When multisampled, over each of its samples.
+ * @param	x			 	The x coordinate.
+ * @param	y			 	The y coordinate.
+ * @param	C			 	The premultiplied color.
+ * @param	transmittance	Fraction of the existing color that shows through.
+ */
+
+void FrameBuffer::compositeOver(int x, int y, const color &C, float transmittance) {
+	if (sampleCount > 1) {
+		GLuint *colors = sampleColors.data() + sampleIndex(x, y);
+		for (int s = 0; s < sampleCount; ++s) {
+			colors[s] = packColor(C + transmittance * unpackColor(colors[s]));
+		}
+	} else {
+		setColor(x, y, C + transmittance * getColor(x, y));
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::compositeTransparencyTile(int tileX, int tileY)
+ * @brief	Composites the transparent fragments gathered in a tile over its
+ * 			colors, and empties the tile. The weighted blended accumulation is
+ * 			resolved to its weighted average color, covering what the product of
+ * 			the alphas says it covers; the k-buffer's layers are then composited
+ * 			front to back over that, except those at or behind the opaque depth,
+ * 			per sample when multisampled. Weighted blended fragments keep no
+ * 			depth, so anything opaque must be drawn before them.
+ * @param	tileX	The tile column.
+ * @param	tileY	The tile row.
+ */
+
+void FrameBuffer::compositeTransparencyTile(int tileX, int tileY) {
+	const int tileIndex = tileY * tilesWide + tileX;
+	if (transparency == nullptr || !transparencyTileUsed[tileIndex]) {
+		return;
+	}
+	const TransparencyTile &tile = transparency[tileIndex];
+	const int xStart = tileX << TILE_SHIFT, xEnd = std::min(xStart + TILE_SIZE, window.width);
+	const int yStart = tileY << TILE_SHIFT, yEnd = std::min(yStart + TILE_SIZE, window.height);
+	for (int y = yStart; y < yEnd; ++y) {
+		for (int x = xStart; x < xEnd; ++x) {
+			const int i = offsetInTile(x, y);
+			if (tile.accumAlpha[i] > 0.0f) {
+				const color average = color(tile.accumRed[i], tile.accumGreen[i], tile.accumBlue[i]) /
+										std::max(tile.accumAlpha[i], 1.0e-5f);
+				compositeOver(x, y, average * (1.0f - tile.revealage[i]), tile.revealage[i]);
+			}
+			if (tile.layerCount[i] == 0) {
+				continue;
+			}
+			// Layers are sorted front to back, so stop at the first one hidden by opaque depth
+			auto layersInFront = [&](float opaqueDepth, color &C, float &transmittance) {
+				C = black;
+				transmittance = 1.0f;
+				for (int layer = 0; layer < tile.layerCount[i] && tile.layerDepth[layer][i] < opaqueDepth; ++layer) {
+					const glm::vec4 L = unpackPremultiplied(tile.layerColor[layer][i]);
+					C += transmittance * color(L.r, L.g, L.b);
+					transmittance *= 1.0f - L.a;
+				}
+			};
+			color C;
+			float transmittance;
+			if (sampleCount > 1) {
+				GLuint *colors = sampleColors.data() + sampleIndex(x, y);
+				const float *depths = sampleDepths.data() + sampleIndex(x, y);
+				for (int s = 0; s < sampleCount; ++s) {
+					layersInFront(depths[s], C, transmittance);
+					colors[s] = packColor(C + transmittance * unpackColor(colors[s]));
+				}
+			} else {
+				layersInFront(getDepth(x, y), C, transmittance);
+				compositeOver(x, y, C, transmittance);
+			}
+		}
+	}
+	transparencyTileUsed[tileIndex] = 0;
+}
+
+/**
+ * @fn	GLuint FrameBuffer::packColor(const color &C)
+ * @brief	Packs a color into RGBA8, with red in the low byte.
+ * @param	C	The color to pack. It is clamped to [0,1].
+ * @return	The packed color.
+ */
+
+GLuint FrameBuffer::packColor(const color &C) {
+	color clampedColor = glm::clamp(C, 0.0f, 1.0f);
+	return (GLuint)(GLubyte)(clampedColor.r * 255) |
+			((GLuint)(GLubyte)(clampedColor.g * 255) << 8) |
+			((GLuint)(GLubyte)(clampedColor.b * 255) << 16) |
+			0xFF000000u;
+}
+
+/**
+ * @fn	color FrameBuffer::unpackColor(GLuint C)
+ * @brief	Unpacks an RGBA8 color.
+ * @param	C	The packed color.
+ * @return	The unpacked color.
+ */
+
+color FrameBuffer::unpackColor(GLuint C) {
+	return color((C & 0xFF) / 255.0f, ((C >> 8) & 0xFF) / 255.0f, ((C >> 16) & 0xFF) / 255.0f);
+}
@@ -4,18 +4,96 @@
 #include "ColorAndMaterials.h"
 
 const int BYTES_PER_PIXEL = 3;			//!< RGB requires 3 bytes.
+const int TILE_SHIFT = 3;				//!< log2 of the tile size.
+const int TILE_SIZE = 1 << TILE_SHIFT;	//!< Width and height, in pixels, of a framebuffer tile.
+const int TILE_MASK = TILE_SIZE - 1;	//!< Masks a window coordinate down to its offset within a tile.
+const int PIXELS_PER_TILE = TILE_SIZE * TILE_SIZE;	//!< Number of pixels in one tile.
+const int CACHE_LINE_SIZE = 64;			//!< Alignment of tiles, so neighboring tiles never share a cache line.
+
+typedef unsigned long long TileMask;	//!< One bit per pixel of a tile, bit i is pixel i in row-major order.
+typedef unsigned char SampleMask;		//!< One bit per sample of a pixel.
+const int MAX_SAMPLES = 8;				//!< Most samples a multisampled framebuffer keeps per pixel.
+const int K_BUFFER_LAYERS = 4;			//!< Transparent layers the k-buffer keeps per pixel.
+const int NO_MATERIAL = -1;				//!< G-buffer material ID of a pixel nothing was drawn into.
+
+/**
+ * @enum	FrameBufferLayout
+ * @brief	The memory layouts a framebuffer can use for its color and depth values.
+ */
+
+enum FrameBufferLayout { LINEAR_LAYOUT, TILED_LAYOUT };
+
+/**
+ * @struct	FrameBufferTile
+ * @brief	A TILE_SIZE x TILE_SIZE block of pixels. Colors are packed RGBA8 and
+ * 			depths are kept in their own plane, both row-major within the tile.
+ */
+
+struct alignas(CACHE_LINE_SIZE) FrameBufferTile {
+	GLuint color[PIXELS_PER_TILE];		//!< Packed RGBA8 colors.
+	float depth[PIXELS_PER_TILE];		//!< Depth values.
+};
+
+/**
+ * @struct	GBufferTile
+ * @brief	Deferred shading inputs for a TILE_SIZE x TILE_SIZE block of pixels.
+ * 			Each component has its own plane, row-major within the tile, so the
+ * 			lighting pass can stream through them.
+ */
+
+struct alignas(CACHE_LINE_SIZE) GBufferTile {
+	float normalX[PIXELS_PER_TILE], normalY[PIXELS_PER_TILE], normalZ[PIXELS_PER_TILE];
+	float positionX[PIXELS_PER_TILE], positionY[PIXELS_PER_TILE], positionZ[PIXELS_PER_TILE];
+	int materialID[PIXELS_PER_TILE];	//!< Index into the MaterialTable, or NO_MATERIAL.
+};
+
+/**
+ * @struct	TransparencyTile
+ * @brief	Order-independent transparency inputs for a TILE_SIZE x TILE_SIZE block
+ * 			of pixels, row-major within the tile. The accumulation planes hold
+ * 			weighted blended transparency: weighted sums of premultiplied colors
+ * 			and of alphas, and the revealage, the fraction of the background
+ * 			still showing through. The k-buffer holds each pixel's nearest
+ * 			transparent layers, premultiplied RGBA8, sorted near to far.
+ */
+
+struct alignas(CACHE_LINE_SIZE) TransparencyTile {
+	float accumRed[PIXELS_PER_TILE], accumGreen[PIXELS_PER_TILE], accumBlue[PIXELS_PER_TILE];
+	float accumAlpha[PIXELS_PER_TILE];
+	float revealage[PIXELS_PER_TILE];
+	float layerDepth[K_BUFFER_LAYERS][PIXELS_PER_TILE];
+	GLuint layerColor[K_BUFFER_LAYERS][PIXELS_PER_TILE];
+	unsigned char layerCount[PIXELS_PER_TILE];
+};
 
 /**
  * @struct	FrameBuffer
  * @brief	Represents a framebuffer. Two identically sized 2D arrays. The color
  * 			buffer stores the colors and the depth buffer stores the corresponding
- * 			depth at each pixel.
+ * 			depth at each pixel. In TILED_LAYOUT the pixels live in cache aligned
+ * 			tiles and the color buffer is only filled in (resolved) when it is shown.
+ * 			Clearing a tiled framebuffer only flags the tiles; a tile is filled with
+ * 			the clear values the first time something is written to it.
+ * 			In either layout, conservative per tile depth bounds form a
+ * 			hierarchical Z buffer, used to reject hidden geometry early.
+ * 			With the G-buffer enabled, rendering is deferred: fragments record their
+ * 			world space normal, position and material here, and are lit afterward.
+ * 			When multisampled, each pixel keeps a color and depth per sample instead,
+ * 			in either layout, and the samples are averaged (resolved) into the color
+ * 			buffer when it is shown. Per pixel accesses then apply to every sample.
+ * 			With the transparency buffers enabled, transparent fragments can be
+ * 			gathered in any order, and are composited over the opaque colors after.
  */
 
 struct FrameBuffer {
-	FrameBuffer(const int width, const int height);
+	FrameBuffer(const int width, const int height, FrameBufferLayout layout = LINEAR_LAYOUT);
 	~FrameBuffer();
 	void setFrameBufferSize(int width, int height);
+	void setLayout(FrameBufferLayout newLayout);
+	FrameBufferLayout getLayout() const { return layout; }
+	void setSampleCount(int count);
+	int getSampleCount() const { return sampleCount; }
+	bool isMultisampled() const { return sampleCount > 1; }
 	void setClearColor(const color &clearColor);
 	void setColor(int x, int y, const color &C);
 	color getColor(int x, int y) const;
@@ -31,10 +109,76 @@ struct FrameBuffer {
 	float getDepth(float x, float y) const;
 
 	void setPixel(int x, int y, const color &C, float depth);
+
+	SampleMask testSampleDepths(int x, int y, SampleMask covered, const float depths[MAX_SAMPLES],
+								bool depthTest, bool depthWrite);
+	void setSampleColors(int x, int y, SampleMask mask, const color &C);
+	void resolveSamples() const;
+
+	int getTilesWide() const { return tilesWide; }
+	int getTilesHigh() const { return tilesHigh; }
+	bool isTileCleared(int tileX, int tileY) const;
+	FrameBufferTile &getTile(int tileX, int tileY);
+	const FrameBufferTile &getTile(int tileX, int tileY) const;
+	void writeTile(int tileX, int tileY, const color colors[PIXELS_PER_TILE],
+					const float depths[PIXELS_PER_TILE], TileMask mask);
+	void resolveTiles() const;
+
+	float getTileMinDepth(int tileX, int tileY) const { return tileMinDepth[tileY * tilesWide + tileX]; }
+	float getTileMaxDepth(int tileX, int tileY) const { return tileMaxDepth[tileY * tilesWide + tileX]; }
+	void refreshTileDepthBounds(int tileX, int tileY);
+	void readTileDepths(int tileX, int tileY, float depths[PIXELS_PER_TILE]) const;
+	bool isRegionOccluded(int left, int right, int bottom, int top, float nearestDepth) const;
+
+	void setGBufferEnabled(bool enabled);
+	bool hasGBuffer() const { return gBuffer != nullptr; }
+	void setGBufferTexel(int x, int y, const glm::vec3 &normal, const glm::vec3 &position, int materialID);
+	bool isGBufferTileUsed(int tileX, int tileY) const { return gBufferTileUsed[tileY * tilesWide + tileX] != 0; }
+	const GBufferTile &getGBufferTile(int tileX, int tileY) const { return gBuffer[tileY * tilesWide + tileX]; }
+
+	void setTransparencyEnabled(bool enabled);
+	bool hasTransparencyBuffers() const { return transparency != nullptr; }
+	void accumulateTransparentFragment(int x, int y, const color &C, float alpha, float weight);
+	void insertTransparentFragment(int x, int y, const color &C, float alpha, float depth);
+	void compositeTransparencyTile(int tileX, int tileY);
+	static GLuint packColor(const color &C);
+	static color unpackColor(GLuint C);
 protected:
 	bool checkInWindow(int x, int y) const;
+	int sampleIndex(int x, int y) const { return (y * window.width + x) * sampleCount; }
+	void reallocateBuffers(FrameBufferLayout newLayout, int newSampleCount);
+	void allocateBuffers();
+	void releaseBuffers();
+	void materializeTile(int tileIndex);
+	void clearLinearBuffers();
+	void allocateGBuffer();
+	void releaseGBuffer();
+	void allocateTransparency();
+	void releaseTransparency();
+	TransparencyTile &getTransparencyTile(int x, int y);
+	void compositeOver(int x, int y, const color &C, float transmittance);
 	Window window;							//!< Dimensions of framebuffer
+	FrameBufferLayout layout;				//!< Memory layout of the color and depth values
 	GLubyte clearColorUB[BYTES_PER_PIXEL];	//!< Clear color
-	GLubyte *colorBuffer;					//!< 2D array for holding colors
-	float *depthBuffer;						//!< 2D array for holding depths
+	GLubyte *colorBuffer;					//!< 2D array for holding colors. Resolve target when tiled or multisampled.
+	float *depthBuffer;						//!< 2D array for holding depths. Unused when tiled or multisampled.
+	int tilesWide;							//!< Number of tile columns
+	int tilesHigh;							//!< Number of tile rows
+	FrameBufferTile *tiles;					//!< Tile storage, row-major. Only used when tiled.
+	char *tileMemory;						//!< Allocation backing tiles, before alignment.
+	std::vector<unsigned char> tileCleared;	//!< Per tile, nonzero ==> holds only clear values. Bytes, not bits, so threads writing different tiles never race on a flag (neighboring flags may still share a cache line).
+	GLuint tileClearColor;					//!< Packed clear color, captured by the last clear.
+	std::vector<float> tileMinDepth;		//!< Per tile, no more than the smallest depth in it. Both layouts.
+	std::vector<float> tileMaxDepth;		//!< Per tile, no less than the largest depth in it. Both layouts.
+	bool gBufferEnabled;					//!< True ==> the G-buffer is allocated and rendering is deferred
+	GBufferTile *gBuffer;					//!< G-buffer tiles, row-major. nullptr unless enabled.
+	char *gBufferMemory;					//!< Allocation backing gBuffer, before alignment.
+	std::vector<unsigned char> gBufferTileUsed;	//!< Per tile, nonzero ==> drawn into since the last clear.
+	int sampleCount;						//!< Samples per pixel: 1, 4 or 8
+	std::vector<GLuint> sampleColors;		//!< Packed RGBA8 color of each sample, pixel by pixel, row-major. Only used when multisampled.
+	std::vector<float> sampleDepths;		//!< Depth of each sample, laid out like sampleColors.
+	bool transparencyEnabled;				//!< True ==> the transparency buffers are allocated
+	TransparencyTile *transparency;			//!< Transparency tiles, row-major. nullptr unless enabled.
+	char *transparencyMemory;				//!< Allocation backing transparency, before alignment.
+	std::vector<unsigned char> transparencyTileUsed;	//!< Per tile, nonzero ==> holds transparent fragments not yet composited.
 };
@@ -2,7 +2,7 @@
 
 #include <vector>
 #include "defs.h"
-#include "ColorAndMaterials.h"
+#include "MaterialTable.h"
 #include "Image.h"
 #include "Utilities.h"
 
@@ -15,7 +15,7 @@ struct HitRecord {
 	float t;					//!< the t value where the intersection took place.
 	glm::vec3 interceptPoint;	//!< the (x,y,z) value where the intersection took place.
 	glm::vec3 surfaceNormal;	//!< the normal vector at the intersection point.
-	Material material;			//!< the Material value of the object.
+	MaterialIndex materialID;	//!< the object's material, in the MaterialTable.
 	Image *texture;				//!< the texture associated with this object, if any.
 	float u, v;					//!< (u,v) correpsonding to intersection point.
 
@@ -26,6 +26,7 @@ struct HitRecord {
 
 	HitRecord() {
 		t = FLT_MAX;
+		materialID = DEFAULT_MATERIAL;
 		texture = nullptr; 
 	}
 
@@ -36,13 +36,16 @@ void IScene::addObject(const VisibleIShapePtr &obj) {
 
 /**
  * @fn	void IScene::addTransparentObject(const VisibleIShapePtr &obj, float alpha)
- * @brief	Adds a transparent object to the scene
+ * @brief	Adds a transparent object to the scene. The object gets its own
+ * 			copy of its material, so others sharing the material stay opaque.
  * @param	obj  	The transparent object to be added.
  * @param	alpha	The alpha value of the object.
  */
 
 void IScene::addTransparentObject(const VisibleIShapePtr &obj, float alpha) {
-	obj->material.alpha = alpha;
+	Material mat = MaterialTable::get(obj->materialID);
+	mat.alpha = alpha;
+	obj->materialID = MaterialTable::add(mat);
 	transparentObjects.push_back(obj);
 }
 
@@ -38,11 +38,11 @@ glm::vec3 IShape::movePointOffSurface(const glm::vec3 &pt, const glm::vec3 &n) {
  * @fn	VisibleIShape::VisibleIShape(IShapePtr shapePtr, const Material &mat)
  * @brief	Represents an visible, implicit shape.
  * @param	shapePtr	Pointer to the implicit shape.
- * @param	mat			Material
+ * @param	mat			Material, added to the MaterialTable.
  */
 
 VisibleIShape::VisibleIShape(IShapePtr shapePtr, const Material &mat)
-	: material(mat), shape(shapePtr) {
+	: materialID(MaterialTable::add(mat)), shape(shapePtr) {
 	texture = nullptr;
 	lu = lv = 0.0f;
 	ru = rv = 1.0f;
@@ -58,7 +58,7 @@ VisibleIShape::VisibleIShape(IShapePtr shapePtr, const Material &mat)
 void VisibleIShape::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
 	shape->findClosestIntersection(ray, hit);
 	if (hit.t < FLT_MAX) {
-		hit.material = material;
+		hit.materialID = materialID;
 	}
 }
 
@@ -107,7 +107,7 @@ HitRecord VisibleIShape::findIntersection(const Ray &ray, const std::vector<Visi
 		surfaces[i]->findClosestIntersection(ray, thisHit);
 		if (thisHit.t < theHit.t && thisHit.t > 0) {
 			theHit = thisHit;
-			theHit.material = surfaces[i]->material;
+			theHit.materialID = surfaces[i]->materialID;
 			theHit.texture = surfaces[i]->texture;
 			if (theHit.texture != nullptr) {
 				surfaces[i]->shape->getTexCoords(theHit.interceptPoint,
@@ -41,7 +41,7 @@ struct IShape {
  */
 
 struct VisibleIShape {
-	Material material;	//!< Material for this shape.
+	MaterialIndex materialID;	//!< Material for this shape, in the MaterialTable.
 	IShapePtr shape;	//!< Pointer to underlying implicit shape.
 	Image *texture;		//!< Texture associated with this shape, if any.
 	float lu;			//!< left u value
@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include "IndexedMesh.h"
+
+/**
+ * @fn	static size_t hashVertex(const VertexData &v)
+ * @brief	Hashes a vertex's position and normal.
+ * @param	v	The vertex.
+ * @return	The hash.
+ */
+
+static size_t hashVertex(const VertexData &v) {
+	const float F[] = { v.position.x, v.position.y, v.position.z, v.position.w,
+						v.normal.x, v.normal.y, v.normal.z };
+	size_t h = 0;
+	for (float f : F) {
+		uint32_t bits;
+		std::memcpy(&bits, &f, sizeof(bits));
+		h = h * 31 + bits;
+	}
+	return h;
+}
+
+/**
+ * @fn	static bool sameVertex(const VertexData &a, const VertexData &b)
+ * @brief	Tests if two vertices are identical, and so can be welded into one.
+ * @param	a	The first vertex.
+ * @param	b	The second vertex.
+ * @return	True iff every attribute matches.
+ */
+
+static bool sameVertex(const VertexData &a, const VertexData &b) {
+	return a.position == b.position && a.normal == b.normal &&
+			a.worldPosition == b.worldPosition && a.materialID == b.materialID;
+}
+
+/**
+ * @fn	ObjectBounds::ObjectBounds(const std::vector<VertexData> &verts)
+ * @brief	Computes the bounds of some vertices.
+ * @param	verts	The vertices, in object coordinates.
+ */
+
+ObjectBounds::ObjectBounds(const std::vector<VertexData> &verts)
+	: lo(FLT_MAX), hi(-FLT_MAX), center(0.0f), radius(0.0f) {
+	for (const VertexData &vd : verts) {
+		lo = glm::min(lo, vd.position.xyz());
+		hi = glm::max(hi, vd.position.xyz());
+	}
+	if (isEmpty()) {
+		return;
+	}
+	center = (lo + hi) / 2.0f;
+	float radiusSquared = 0.0f;
+	for (const VertexData &vd : verts) {
+		const glm::vec3 d = vd.position.xyz() - center;
+		radiusSquared = std::max(radiusSquared, glm::dot(d, d));
+	}
+	radius = std::sqrt(radiusSquared);
+}
+
+/**
+ * @fn	IndexedMesh::IndexedMesh(const std::vector<VertexData> &triangles)
+ * @brief	Builds a mesh from a list of vertex triplets. Identical vertices are
+ * 			welded into one, and the triangles are reordered for the vertex cache.
+ * @param	triangles	The vertices, where each successive triplet is a triangle.
+ */
+
+IndexedMesh::IndexedMesh(const std::vector<VertexData> &triangles) {
+	const int N = (int)triangles.size() / 3 * 3;
+	std::unordered_multimap<size_t, uint32_t> welded;
+	welded.reserve(N);
+	indices.reserve(N);
+
+	for (int i = 0; i < N; i++) {
+		const VertexData &v = triangles[i];
+		const size_t h = hashVertex(v);
+		uint32_t index = (uint32_t)vertices.size();
+		auto range = welded.equal_range(h);
+		for (auto it = range.first; it != range.second; ++it) {
+			if (sameVertex(vertices[it->second], v)) {
+				index = it->second;
+				break;
+			}
+		}
+		if (index == vertices.size()) {
+			vertices.push_back(v);
+			welded.insert(std::make_pair(h, index));
+		}
+		indices.push_back(index);
+	}
+	bounds = ObjectBounds(vertices);
+	streams = VertexStreams(vertices);
+	optimizeVertexCache();
+}
+
+/**
+ * @fn	std::vector<VertexData> IndexedMesh::toTriangles() const
+ * @brief	Expands the mesh back into a list of vertex triplets.
+ * @return	The vertices, where each successive triplet is a triangle.
+ */
+
+std::vector<VertexData> IndexedMesh::toTriangles() const {
+	std::vector<VertexData> triangles;
+	triangles.reserve(indices.size());
+	for (uint32_t i : indices) {
+		triangles.push_back(vertices[i]);
+	}
+	return triangles;
+}
+
+/**
+ * @fn	static float vertexScore(int cachePosition, int remainingTriangles)
+ * @brief	Forsyth's score for a vertex: high if it is recently used, or if few
+ * 			triangles still need it.
+ * @param	cachePosition	  	Position in the LRU cache. -1 ==> not in the cache.
+ * @param	remainingTriangles	Number of triangles using it that are not yet placed.
+ * @return	The score.
+ */
+
+static float vertexScore(int cachePosition, int remainingTriangles) {
+	if (remainingTriangles == 0) {
+		return -1.0f;
+	}
+	float score = 0.0f;
+	if (cachePosition >= 0) {
+		if (cachePosition < 3) {	// Used by the last triangle
+			score = 0.75f;
+		} else {
+			score = std::pow(1.0f - (cachePosition - 3) / (float)(VERTEX_CACHE_SIZE - 3), 1.5f);
+		}
+	}
+	return score + 2.0f / std::sqrt((float)remainingTriangles);
+}
+
+/**
+ * @fn	void IndexedMesh::optimizeVertexCache()
+ * @brief	Reorders the triangles so that triangles sharing vertices are close
+ * 			together, using Forsyth's linear-speed vertex cache optimisation.
+ * 			Each step places the unplaced triangle whose vertices score highest
+ * 			in a simulated LRU cache of VERTEX_CACHE_SIZE vertices.
+ */
+
+void IndexedMesh::optimizeVertexCache() {
+	const int vertexCount = (int)vertices.size();
+	const int triCount = triangleCount();
+	if (triCount == 0) {
+		return;
+	}
+
+	// Triangles using each vertex. The unplaced ones are kept at the front of each list.
+	std::vector<int> firstTriangle(vertexCount + 1, 0);
+	for (int i = 0; i < 3 * triCount; i++) {
+		firstTriangle[indices[i] + 1]++;
+	}
+	for (int v = 0; v < vertexCount; v++) {
+		firstTriangle[v + 1] += firstTriangle[v];
+	}
+	std::vector<int> remaining(vertexCount, 0);
+	std::vector<int> vertexTriangles(3 * triCount);
+	for (int t = 0; t < triCount; t++) {
+		for (int k = 0; k < 3; k++) {
+			const uint32_t v = indices[3 * t + k];
+			vertexTriangles[firstTriangle[v] + remaining[v]++] = t;
+		}
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> score(vertexCount);
+	for (int v = 0; v < vertexCount; v++) {
+		score[v] = vertexScore(-1, remaining[v]);
+	}
+	std::vector<bool> placed(triCount, false);
+	std::vector<uint32_t> reordered;
+	reordered.reserve(indices.size());
+	int cache[VERTEX_CACHE_SIZE + 3];
+	int cacheCount = 0;
+	int best = 0;
+	int nextUnplaced = 0;
+
+	for (int n = 0; n < triCount; n++) {
+		if (best < 0) {			// Nothing in the cache has work left; start anywhere
+			while (placed[nextUnplaced]) {
+				nextUnplaced++;
+			}
+			best = nextUnplaced;
+		}
+		placed[best] = true;
+		const uint32_t *tri = &indices[3 * best];
+		reordered.insert(reordered.end(), tri, tri + 3);
+
+		// Take the triangle off its vertices' lists
+		for (int k = 0; k < 3; k++) {
+			const uint32_t v = tri[k];
+			int *list = &vertexTriangles[firstTriangle[v]];
+			int last = --remaining[v];
+			for (int i = 0; i <= last; i++) {
+				if (list[i] == best) {
+					std::swap(list[i], list[last]);
+					break;
+				}
+			}
+		}
+
+		// Move its vertices to the front of the cache
+		int newCache[VERTEX_CACHE_SIZE + 3];
+		int newCount = 0;
+		for (int k = 0; k < 3; k++) {
+			newCache[newCount++] = tri[k];
+		}
+		for (int i = 0; i < cacheCount; i++) {
+			const int v = cache[i];
+			if (v != (int)tri[0] && v != (int)tri[1] && v != (int)tri[2]) {
+				newCache[newCount++] = v;
+			}
+		}
+		for (int i = 0; i < newCount; i++) {
+			cachePosition[newCache[i]] = i < VERTEX_CACHE_SIZE ? i : -1;
+			score[newCache[i]] = vertexScore(cachePosition[newCache[i]], remaining[newCache[i]]);
+		}
+		cacheCount = std::min(newCount, VERTEX_CACHE_SIZE);
+		std::copy(newCache, newCache + cacheCount, cache);
+
+		// Rescore the triangles of the cached vertices and pick the best
+		best = -1;
+		float bestScore = -FLT_MAX;
+		for (int i = 0; i < cacheCount; i++) {
+			const int v = cache[i];
+			for (int j = 0; j < remaining[v]; j++) {
+				const int t = vertexTriangles[firstTriangle[v] + j];
+				const float triangleScore = score[indices[3 * t]] + score[indices[3 * t + 1]] + score[indices[3 * t + 2]];
+				if (triangleScore > bestScore) {
+					bestScore = triangleScore;
+					best = t;
+				}
+			}
+		}
+	}
+	indices.swap(reordered);
+}
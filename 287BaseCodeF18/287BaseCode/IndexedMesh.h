@@ -0,0 +1,45 @@
+#pragma once
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+#include "VertexData.h"
+#include "VertexStreams.h"
+
+const int VERTEX_CACHE_SIZE = 32;		//!< Size of the LRU vertex cache optimizeVertexCache orders triangles for.
+
+/**
+ * @struct	ObjectBounds
+ * @brief	Bounding volumes of an object, in object coordinates: an axis aligned
+ * 			box and a sphere around the box's center. Used to cull and occlusion
+ * 			test whole objects before any of their vertices are transformed.
+ */
+
+struct ObjectBounds {
+	glm::vec3 lo, hi;		//!< Corners of the box. lo > hi ==> no vertices.
+	glm::vec3 center;		//!< Center of the sphere.
+	float radius;			//!< Radius of the sphere.
+
+	ObjectBounds() : lo(FLT_MAX), hi(-FLT_MAX), center(0.0f), radius(0.0f) {}
+	explicit ObjectBounds(const std::vector<VertexData> &verts);
+	bool isEmpty() const { return lo.x > hi.x; }
+};
+
+/**
+ * @struct	IndexedMesh
+ * @brief	A triangle mesh that stores each distinct vertex once. Each successive
+ * 			triplet of indices is a triangle. Built from the triangle lists the
+ * 			EShape generators return, e.g. IndexedMesh(EShape::createECylinder(chrome)).
+ */
+
+struct IndexedMesh {
+	std::vector<VertexData> vertices;	//!< The distinct vertices.
+	std::vector<uint32_t> indices;		//!< Index triplets, one per triangle.
+	ObjectBounds bounds;				//!< Bounds of the vertices, computed once when the mesh is built.
+	VertexStreams streams;				//!< Positions and normals of the vertices, for batch transforms. Rebuild after editing vertices.
+
+	IndexedMesh() {}
+	explicit IndexedMesh(const std::vector<VertexData> &triangles);
+	int triangleCount() const { return (int)indices.size() / 3; }
+	std::vector<VertexData> toTriangles() const;
+	void optimizeVertexCache();
+};
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include "LODShape.h"
+#include "VertexOps.h"
+
+/**
+ * @fn	LODShape::LODShape(const Generator &generator)
+ * @brief	Builds every level of detail of a shape.
+ * @param	generator	Creates the shape's triangles with a given number of slices.
+ */
+
+LODShape::LODShape(const Generator &generator) : level(-1) {
+	for (int i = 0; i < LOD_LEVELS; i++) {
+		levels[i] = IndexedMesh(generator(LOD_SLICES[i]));
+	}
+}
+
+/**
+ * @fn	LODShape LODShape::createCylinder(const Material &mat, float radius, float height)
+ * @brief	Creates a cylinder with levels of detail. See EShape::createECylinder.
+ * @param	mat   	Material.
+ * @param	radius	Radius.
+ * @param	height	Height.
+ * @return	The new cylinder.
+ */
+
+LODShape LODShape::createCylinder(const Material &mat, float radius, float height) {
+	return LODShape([=](int slices) { return EShape::createECylinder(mat, radius, height, slices, slices); });
+}
+
+/**
+ * @fn	LODShape LODShape::createCone(const Material &mat, float radius, float height)
+ * @brief	Creates a cone with levels of detail. See EShape::createECone.
+ * @param	mat   	Material.
+ * @param	radius	Radius.
+ * @param	height	Height.
+ * @return	The new cone.
+ */
+
+LODShape LODShape::createCone(const Material &mat, float radius, float height) {
+	return LODShape([=](int slices) { return EShape::createECone(mat, radius, height, slices, slices); });
+}
+
+/**
+ * @fn	LODShape LODShape::createDisk(const Material &mat, float radius)
+ * @brief	Creates a disk with levels of detail. See EShape::createEDisk.
+ * @param	mat   	Material.
+ * @param	radius	Radius.
+ * @return	The new disk.
+ */
+
+LODShape LODShape::createDisk(const Material &mat, float radius) {
+	return LODShape([=](int slices) { return EShape::createEDisk(mat, radius, slices); });
+}
+
+/**
+ * @fn	float LODShape::projectedRadius(const RenderState &state) const
+ * @brief	Estimates the radius, in pixels, of the shape's bounding sphere on the
+ * 			screen. Under a perspective projection the sphere's radius in NDC is
+ * 			r * scale / depth, with the projection's y scale; under a parallel
+ * 			projection it is just r * scale, so distance doesn't matter.
+ * @param	state	The state of the draw.
+ * @return	The radius. FLT_MAX if, under a perspective projection, the sphere
+ * 			reaches the eye.
+ */
+
+float LODShape::projectedRadius(const RenderState &state) const {
+	const ObjectBounds &bounds = levels[LOD_LEVELS - 1].bounds;
+	const glm::mat4 VM = state.viewingMatrix * state.modelMatrix;
+	const float scale = std::max({ glm::length(glm::vec3(VM[0])),
+									glm::length(glm::vec3(VM[1])),
+									glm::length(glm::vec3(VM[2])) });
+	const float radius = bounds.radius * scale;
+	float ndcRadius = radius * std::abs(state.projectionMatrix[1][1]);
+	if (state.projectionMatrix[2][3] != 0.0f) {
+		const float depth = -(VM * glm::vec4(bounds.center, 1.0f)).z;
+		if (depth <= radius) {
+			return FLT_MAX;
+		}
+		ndcRadius /= depth;
+	}
+	return ndcRadius * state.viewport.height() / 2.0f;
+}
+
+/**
+ * @fn	int LODShape::selectLevel(const RenderState &state)
+ * @brief	Picks the level to draw: the coarsest whose silhouette edges are at
+ * 			most LOD_EDGE_PIXELS long. The level drawn last is kept until the
+ * 			number of slices needed is LOD_HYSTERESIS past its range.
+ * @param	state	The state of the draw.
+ * @return	The level.
+ */
+
+int LODShape::selectLevel(const RenderState &state) {
+	const float radius = projectedRadius(state);
+	const float needed = radius == FLT_MAX ? FLT_MAX : M_2PI * radius / LOD_EDGE_PIXELS;
+	int ideal = 0;
+	while (ideal < LOD_LEVELS - 1 && LOD_SLICES[ideal] < needed) {
+		ideal++;
+	}
+
+	if (level < 0) {
+		level = ideal;
+	} else if (ideal > level && needed > LOD_SLICES[level] * (1.0f + LOD_HYSTERESIS)) {
+		level = ideal;
+	} else if (ideal < level && needed < LOD_SLICES[level - 1] * (1.0f - LOD_HYSTERESIS)) {
+		level = ideal;
+	}
+	return level;
+}
+
+/**
+ * @fn	void LODShape::render(FrameBuffer &frameBuffer, const std::vector<LightSourcePtr> &lights, const glm::mat4 &TM)
+ * @brief	Renders the shape at the level of detail its size on the screen calls for.
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	lights	   	The lights.
+ * @param 		  	TM		   	The modeling transformation.
+ */
+
+void LODShape::render(FrameBuffer &frameBuffer, const std::vector<LightSourcePtr> &lights, const glm::mat4 &TM) {
+	const int drawLevel = selectLevel(VertexOps::currentState(TM));
+	VertexOps::render(frameBuffer, levels[drawLevel], lights, TM);
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <functional>
+#include <vector>
+#include "EShape.h"
+#include "RenderState.h"
+
+const int LOD_LEVELS = 5;						//!< Number of tessellations an LODShape caches.
+const int LOD_SLICES[LOD_LEVELS] = { 4, 8, 16, 32, 64 };	//!< Slices of each level, coarsest first.
+const float LOD_EDGE_PIXELS = 6.0f;				//!< Target on-screen length, in pixels, of an edge around the silhouette.
+const float LOD_HYSTERESIS = 0.25f;				//!< Fraction past a level's range the size must move before the level changes.
+
+/**
+ * @class	LODShape
+ * @brief	A procedural shape that caches several tessellations of itself, and
+ * 			draws the one whose edges come out about LOD_EDGE_PIXELS long on the
+ * 			screen under the current VertexOps transforms. Each level only
+ * 			changes once the projected size has moved LOD_HYSTERESIS past the
+ * 			level's range, so objects hovering at a boundary don't pop. The
+ * 			level is remembered per LODShape, so use one per drawn object.
+ * 			e.g., LODShape cone(LODShape::createCone(gold, 2, 2));
+ */
+
+class LODShape {
+	public:
+		typedef std::function<EShapeData(int slices)> Generator;
+		explicit LODShape(const Generator &generator);
+		static LODShape createCylinder(const Material &mat, float radius = 1.0f, float height = 1.0f);
+		static LODShape createCone(const Material &mat, float radius = 1.0f, float height = 1.0f);
+		static LODShape createDisk(const Material &mat, float radius = 1.0f);
+		int selectLevel(const RenderState &state);
+		void render(FrameBuffer &frameBuffer, const std::vector<LightSourcePtr> &lights, const glm::mat4 &TM);
+		const IndexedMesh &mesh(int level) const { return levels[level]; }
+		int currentLevel() const { return level; }
+	protected:
+		float projectedRadius(const RenderState &state) const;
+		IndexedMesh levels[LOD_LEVELS];		//!< The tessellations, coarsest first.
+		int level;							//!< Level drawn last; -1 ==> not drawn yet.
+};
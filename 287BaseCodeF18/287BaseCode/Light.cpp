@@ -1,49 +1,6 @@
 #include "Light.h"
 #include <algorithm>
-
-/**
- * @fn	color ambientColor(const color &mat, const color &light)
- * @brief	Computes the ambient color produced by a single light at a single point.
- * @param	mat  	Ambient material property.
- * @param	light	Light's ambient color.
- * @return	Ambient color.
-  */
-
-color ambientColor(const color &mat, const color &light) {
-	return light * mat;
-}
-
-/**
- * @fn	color diffuseColor(const color &mat, const color &light, const glm::vec3 &l, const glm::vec3 &n)
- * @brief	Computes diffuse color produce by a single light at a single point.
- * @param	mat		 	Material.
- * @param	light	 	The light.
- * @param	l		 	Light vector.
- * @param	n		 	Normal vector.
- * @return	Diffuse color.
- */
-
-color diffuseColor(const color &mat, const color &light,
-					const glm::vec3 &l, const glm::vec3 &n) {
-	return light * mat * glm::max(0.0f, glm::dot(l, n));
-}
-
-/**
- * @fn	color specularColor(const color &mat, const color &light, float shininess, const glm::vec3 &r, const glm::vec3 &v)
- * @brief	Computes specular color produce by a single light at a single point.
- * @param	mat		 	Material.
- * @param	light	 	The light's color.
- * @param	shininess	Material shininess.
- * @param	r		 	Reflection vector.
- * @param	v		 	Viewing vector.
- * @return	Specular color.
- */
-
-color specularColor(const color &mat, const color &light,
-					float shininess,
-					const glm::vec3 &r, const glm::vec3 &v) {
-	return light * mat * glm::pow(glm::max(0.0f, glm::dot(v, -r)), shininess);
-}
+#include <cfloat>
 
 /**
  * @fn	color totalColor(const Material &mat, const LightColor &lightColor, const glm::vec3 &viewingDir, const glm::vec3 &normal, const glm::vec3 &lightPos, const glm::vec3 &intersectionPt, bool attenuationOn, const LightAttenuationParameters &ATparams)
@@ -126,9 +83,8 @@ color SpotLight::illuminate(const glm::vec3 &interceptWorldCoords,
 							const Frame &eyeFrame, bool inShadow) const {
 
 	glm::vec3 v = glm::normalize(eyeFrame.origin - interceptWorldCoords);
-	glm::vec3 l = glm::normalize(interceptWorldCoords - this->lightPosition);
 
-	if (!isOn || inShadow || glm::dot(this->spotDirection, l) > (this->fov / 2.0f)) {
+	if (!isOn || inShadow || !isInCone(interceptWorldCoords)) {
 		return ambientColor(material.ambient, this->lightColorComponents.ambient);
 	}
 	else if (!inShadow) {
@@ -137,6 +93,85 @@ color SpotLight::illuminate(const glm::vec3 &interceptWorldCoords,
 	}
 }
 
+/**
+ * @fn	bool SpotLight::isInCone(const glm::vec3 &interceptWorldCoords) const
+ * @brief	Determines if a point is within the spot light's cone, which has an
+ * 			apex angle of fov.
+ * @param	interceptWorldCoords	The point.
+ * @return	True iff the point is lit by the spot.
+ */
+
+bool SpotLight::isInCone(const glm::vec3 &interceptWorldCoords) const {
+	glm::vec3 l = glm::normalize(interceptWorldCoords - this->lightPosition);
+	return glm::dot(glm::normalize(this->spotDirection), l) >= std::cos(this->fov / 2.0f);
+}
+
+/**
+ * @fn	float LightAttenuationParameters::cutoffDistance(float minFactor) const
+ * @brief	Finds how far away the attenuation factor drops to minFactor.
+ * @param	minFactor	The smallest factor considered to have any effect.
+ * @return	The distance, or FLT_MAX if the factor never gets that small.
+ */
+
+float LightAttenuationParameters::cutoffDistance(float minFactor) const {
+	// Solve constant + linear*d + quadratic*d^2 = 1/minFactor for d
+	const float target = 1.0f / minFactor;
+	if (constant >= target) {
+		return 0.0f;
+	} else if (quadratic > 0.0f) {
+		return (-linear + std::sqrt(linear * linear - 4.0f * quadratic * (constant - target))) / (2.0f * quadratic);
+	} else if (linear > 0.0f) {
+		return (target - constant) / linear;
+	}
+	return FLT_MAX;
+}
+
+/**
+ * @fn	bool PositionalLight::getBoundingSphere(float minFactor, glm::vec3 &center, float &radius) const
+ * @brief	Finds a sphere outside of which the light's diffuse and specular
+ * 			contributions are attenuated below minFactor. Used for light culling.
+ * @param 		  	minFactor	The smallest attenuation factor considered to have any effect.
+ * @param [out]	center   	The sphere's center.
+ * @param [out]	radius   	The sphere's radius.
+ * @return	False if the light's reach is unbounded.
+ */
+
+bool PositionalLight::getBoundingSphere(float minFactor, glm::vec3 &center, float &radius) const {
+	if (!attenuationIsTurnedOn) {
+		return false;
+	}
+	radius = attenuationParams.cutoffDistance(minFactor);
+	center = lightPosition;
+	return radius < FLT_MAX;
+}
+
+/**
+ * @fn	bool SpotLight::getBoundingSphere(float minFactor, glm::vec3 &center, float &radius) const
+ * @brief	Finds a sphere around the part of the spot's cone within reach of
+ * 			the light, as limited by attenuation.
+ * @param 		  	minFactor	The smallest attenuation factor considered to have any effect.
+ * @param [out]	center   	The sphere's center.
+ * @param [out]	radius   	The sphere's radius.
+ * @return	False if the light's reach is unbounded.
+ */
+
+bool SpotLight::getBoundingSphere(float minFactor, glm::vec3 &center, float &radius) const {
+	float range;
+	if (!PositionalLight::getBoundingSphere(minFactor, center, range)) {
+		return false;
+	}
+	// The sphere through the apex and the rim of the cone's cap. Past 60 degrees
+	// it is bigger than the sphere around the apex, which is kept instead.
+	const float cosHalfAngle = std::cos(fov / 2.0f);
+	if (cosHalfAngle > 0.5f) {
+		radius = range / (2.0f * cosHalfAngle);
+		center = lightPosition + radius * glm::normalize(spotDirection);
+	} else {
+		radius = range;
+	}
+	return true;
+}
+
 /**
 * @fn	ostream &operator << (std::ostream &os, const LightAttenuationParameters &at)
 * @brief	Output stream for light attenuation parameters.
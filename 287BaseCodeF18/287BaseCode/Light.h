@@ -18,6 +18,7 @@ struct LightAttenuationParameters {
 	float factor(float distance) const {
 		return 1.0f / (constant + linear * distance + quadratic * distance * distance);
 	}
+	float cutoffDistance(float minFactor) const;
 	friend std::ostream &operator << (std::ostream &os, const LightAttenuationParameters &at);
 };
 
@@ -87,6 +88,7 @@ struct PositionalLight : public LightSource {
 							const glm::vec3 &normal,
 							const Material &material,
 							const Frame &eyeFrame, bool inShadow) const;
+	virtual bool getBoundingSphere(float minFactor, glm::vec3 &center, float &radius) const;
 	friend std::ostream &operator << (std::ostream &os, const PositionalLight &pl);
 };
 
@@ -107,6 +109,8 @@ struct SpotLight : public PositionalLight {
 							const glm::vec3 &normal,
 							const Material &material,
 							const Frame &eyeFrame, bool inShadow) const;
+	virtual bool getBoundingSphere(float minFactor, glm::vec3 &center, float &radius) const;
+	bool isInCone(const glm::vec3 &interceptWorldCoords) const;
 	friend std::ostream &operator << (std::ostream &os, const SpotLight &pl);
 };
 
@@ -114,12 +118,50 @@ const LightColor pureWhiteLight(std::vector<float>{1, 1, 1, 1, 1, 1, 1, 1, 1});
 const LightColor standardWhiteLight(std::vector<float>{0.2f, 0.2f, 0.2f, 1, 1, 1, 1, 1, 1});
 const LightColor testLight(std::vector<float>{0.3f, 0.2f, 0.1f, 1, 1, 1, 0.5f, 0.6f, 0.7f});
 
-color ambientColor(const color &matAmbient, const color &lightAmbient);
-color diffuseColor(const color &matDiffuse, const color &lightDiffuse,
-					const glm::vec3 &l, const glm::vec3 &n);
-color specularColor(const color &mat, const color &light,
-					float shininess,
-					const glm::vec3 &r, const glm::vec3 &v);
+/**
+ * @fn	color ambientColor(const color &mat, const color &light)
+ * @brief	Computes the ambient color produced by a single light at a single point.
+ * @param	mat  	Ambient material property.
+ * @param	light	Light's ambient color.
+ * @return	Ambient color.
+  */
+
+inline color ambientColor(const color &mat, const color &light) {
+	return light * mat;
+}
+
+/**
+ * @fn	color diffuseColor(const color &mat, const color &light, const glm::vec3 &l, const glm::vec3 &n)
+ * @brief	Computes diffuse color produce by a single light at a single point.
+ * @param	mat		 	Material.
+ * @param	light	 	The light.
+ * @param	l		 	Light vector.
+ * @param	n		 	Normal vector.
+ * @return	Diffuse color.
+ */
+
+inline color diffuseColor(const color &mat, const color &light,
+							const glm::vec3 &l, const glm::vec3 &n) {
+	return light * mat * glm::max(0.0f, glm::dot(l, n));
+}
+
+/**
+ * @fn	color specularColor(const color &mat, const color &light, float shininess, const glm::vec3 &r, const glm::vec3 &v)
+ * @brief	Computes specular color produce by a single light at a single point.
+ * @param	mat		 	Material.
+ * @param	light	 	The light's color.
+ * @param	shininess	Material shininess.
+ * @param	r		 	Reflection vector.
+ * @param	v		 	Viewing vector.
+ * @return	Specular color.
+ */
+
+inline color specularColor(const color &mat, const color &light,
+							float shininess,
+							const glm::vec3 &r, const glm::vec3 &v) {
+	return light * mat * glm::pow(glm::max(0.0f, glm::dot(v, -r)), shininess);
+}
+
 color totalColor(const Material &mat, const LightColor &lightColor,
 					const glm::vec3 &viewingDir, const glm::vec3 &normal,
 					const glm::vec3 &lightPos, const glm::vec3 &intersectionPt,
@@ -0,0 +1,40 @@
+#include <iostream>
+#include "MaterialTable.h"
+
+/**
+ * @fn	MaterialIndex MaterialTable::add(const Material &mat)
+ * @brief	Finds a material in the table, adding it if it isn't there yet.
+ * 			Equal materials share an index.
+ * @param	mat	The material.
+ * @return	The material's index. DEFAULT_MATERIAL if the table is full.
+ */
+
+MaterialIndex MaterialTable::add(const Material &mat) {
+	std::vector<Material> &materials = table();
+	for (int i = (int)materials.size() - 1; i >= 0; i--) {
+		if (materials[i] == mat) {
+			return (MaterialIndex)i;
+		}
+	}
+	if ((int)materials.size() == MAX_MATERIALS) {
+		std::cerr << "Material table is full" << std::endl;
+		return DEFAULT_MATERIAL;
+	}
+	materials.push_back(mat);
+	return (MaterialIndex)(materials.size() - 1);
+}
+
+/**
+ * @fn	void MaterialTable::set(MaterialIndex index, const Material &mat)
+ * @brief	Replaces a material. Everything that refers to the index, in
+ * 			either renderer, is drawn with the new material from then on.
+ * @param	index	The material's index.
+ * @param	mat  	The new material.
+ */
+
+void MaterialTable::set(MaterialIndex index, const Material &mat) {
+	std::vector<Material> &materials = table();
+	if (index < materials.size()) {
+		materials[index] = mat;
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "ColorAndMaterials.h"
+
+typedef uint16_t MaterialIndex;				//!< Index of a material in the MaterialTable.
+const int MAX_MATERIALS = 1 << 16;			//!< Most materials the MaterialTable can hold.
+const MaterialIndex DEFAULT_MATERIAL = 0;	//!< Index of bronze, the default material.
+
+/**
+ * @class	MaterialTable
+ * @brief	The palette of materials shared by the rasterizer and the ray tracer.
+ * 			Geometry, fragments and hit records refer to a material by its 16 bit
+ * 			index, and shading looks it up once. Entries are never removed, so an
+ * 			index stays valid for the run. Materials are added while a scene is
+ * 			built, not while it is drawn, as adding can move the entries.
+ * 			The table is built on first use, so globals in any file may add to it.
+ */
+
+class MaterialTable {
+	public:
+		static MaterialIndex add(const Material &mat);
+		static void set(MaterialIndex index, const Material &mat);
+		static const Material &get(MaterialIndex index) { return table()[index]; }
+		static int size() { return (int)table().size(); }
+	protected:
+		static std::vector<Material> &table();
+};
+
+/**
+ * @fn	inline std::vector<Material> &MaterialTable::table()
+ * @brief	The materials, by index. Bronze is spelled out rather than copied from
+ * 			the bronze global, which may not be initialized yet when a global in
+ * 			another file first adds a material.
+ * @return	The materials.
+ */
+
+inline std::vector<Material> &MaterialTable::table() {
+	static std::vector<Material> materials = {
+		Material(color(0.2125f, 0.1275f, 0.054f), color(0.714f, 0.4284f, 0.18144f),
+					color(0.393548f, 0.271906f, 0.166721f), 25.6f)	// bronze
+	};
+	return materials;
+}
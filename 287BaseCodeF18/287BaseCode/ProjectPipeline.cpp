@@ -21,13 +21,13 @@ bool isMoving = true;
 bool twoViewOn = false;
 const float SPEED = 0.1;
 
-FrameBuffer frameBuffer(WINDOW_WIDTH, WINDOW_HEIGHT);
+FrameBuffer frameBuffer(WINDOW_WIDTH, WINDOW_HEIGHT, TILED_LAYOUT);
 
-//EShapeData plane = EShape::createECheckerBoard(copper, tin, 10, 10, 10);
-EShapeData plane = EShape::createECheckerBoard(silver, blackPlastic, 10, 10, 10);
+//IndexedMesh plane(EShape::createECheckerBoard(copper, tin, 10, 10, 10));
+IndexedMesh plane(EShape::createECheckerBoard(silver, blackPlastic, 10, 10, 10));
 
-//EShapeData cone = EShape::createECone(gold, 2, 2, 10, 10);
-//EShapeData cylinder = EShape::createECylinder(chrome, 3, 1, 10, 10);
+//IndexedMesh cone(EShape::createECone(gold, 2, 2, 10, 10));
+//IndexedMesh cylinder(EShape::createECylinder(chrome, 3, 1, 10, 10));
 
 void renderObjects() {
 	//VertexOps::render(frameBuffer, cylinder, lights, glm::mat3(T(1, 2, 3)));
@@ -43,7 +43,11 @@ static void render() {
 	float AR = (float)width / height;
 	VertexOps::projectionTransformation = glm::perspective(glm::radians(125.0), 2.0, 0.1, 5.0);
 	VertexOps::setViewport(0, width - 1, 0, height - 1);
+	FragmentOps::cullLights(frameBuffer, lights, VertexOps::viewingTransformation,
+							VertexOps::projectionTransformation, VertexOps::viewportTransformation);
 	renderObjects();
+	flushTriangleBins();
+	shadeGBuffer(frameBuffer, lights, VertexOps::viewingTransformation);
 	frameBuffer.showColorBuffer();
 }
 
@@ -80,6 +84,10 @@ void keyboard(unsigned char key, int x, int y) {
 				break;
 	case '?':	twoViewOn = !twoViewOn;
 				break;
+	case 'D':
+	case 'd':	frameBuffer.setGBufferEnabled(!frameBuffer.hasGBuffer());
+				std::cout << (frameBuffer.hasGBuffer() ? "Deferred" : "Forward") << " shading" << std::endl;
+				break;
 	case ESCAPE:
 		glutLeaveMainLoop();
 		break;
@@ -146,6 +154,7 @@ int main(int argc, char *argv[]) {
 	glutMouseFunc(mouseUtility);
 
 	frameBuffer.setClearColor(lightGray);
+	setParallelRasterization(true);
 
 	glutMainLoop();
 
@@ -11,6 +11,7 @@
 #include "Camera.h"
 #include "Utilities.h"
 #include "VertexOps.h"
+#include "ShadowMap.h"
 
 PositionalLightPtr theLight = new PositionalLight(glm::vec3(2, 1, 3), pureWhiteLight);
 std::vector<LightSourcePtr> lights = { theLight };
@@ -19,15 +20,36 @@ glm::vec3 position(0, 1, 4);
 float angle = 0;
 bool isMoving = true;
 bool twoViewOn = false;
+bool shadowsOn = false;
 const float SPEED = 0.1;
 
-FrameBuffer frameBuffer(WINDOW_WIDTH, WINDOW_HEIGHT);
+FrameBuffer frameBuffer(WINDOW_WIDTH, WINDOW_HEIGHT, TILED_LAYOUT);
 
-//EShapeData plane = EShape::createECheckerBoard(copper, tin, 10, 10, 10);
-EShapeData plane = EShape::createECheckerBoard(silver, blackPlastic, 10, 10, 10);
+//StaticMesh plane(IndexedMesh(EShape::createECheckerBoard(copper, tin, 10, 10, 10)));
+StaticMesh plane(IndexedMesh(EShape::createECheckerBoard(silver, blackPlastic, 10, 10, 10)));
+IndexedMesh cone(EShape::createECone(redPlastic, 0.3f, 0.6f, 20, 1));
+const glm::mat4 CONE_TM = T(0.5f, 0.0f, 1.0f);		// Standing on the board, so it shadows it
+
+ShadowMap *shadowMap = nullptr;
 
 void renderObjects() {
-	VertexOps::render(frameBuffer, plane, lights, glm::mat3());
+	VertexOps::render(frameBuffer, plane, lights);
+	VertexOps::render(frameBuffer, cone, lights, CONE_TM);
+}
+
+static void renderShadowMaps() {
+	if (shadowsOn) {
+		if (shadowMap == nullptr) {
+			shadowMap = new ShadowMap(*theLight);
+		}
+		shadowMap->render([](FrameBuffer &casters) {
+			VertexOps::render(casters, plane, lights);
+			VertexOps::render(casters, cone, lights, CONE_TM);
+		});
+		FragmentOps::shadowMaps = { shadowMap };
+	} else {
+		FragmentOps::shadowMaps.clear();
+	}
 }
 
 static void render() {
@@ -38,6 +60,7 @@ static void render() {
 	float AR = (float)width / height;
 	VertexOps::projectionTransformation = glm::perspective(glm::radians(125.0), 2.0, 0.1, 5.0);
 	VertexOps::setViewport(0, width - 1, 0, height - 1);
+	renderShadowMaps();
 	renderObjects();
 	frameBuffer.showColorBuffer();
 }
@@ -73,6 +96,17 @@ void keyboard(unsigned char key, int x, int y) {
 	case 'c':	break;
 	case '?':	twoViewOn = !twoViewOn;
 				break;
+	case 'G':
+	case 'g':	VertexOps::perVertexLighting = !VertexOps::perVertexLighting;
+				break;
+	case 'A':
+	case 'a':	frameBuffer.setSampleCount(frameBuffer.getSampleCount() == 1 ? 4 :
+									frameBuffer.getSampleCount() == 4 ? 8 : 1);
+				std::cout << frameBuffer.getSampleCount() << " samples per pixel" << std::endl;
+				break;
+	case 'S':
+	case 's':	shadowsOn = !shadowsOn;
+				break;
 	case ESCAPE:
 		glutLeaveMainLoop();
 		break;
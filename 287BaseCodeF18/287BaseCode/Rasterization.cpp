@@ -1,5 +1,21 @@
 #include <cmath>
+#include <climits>
+#include <algorithm>
 #include "Rasterization.h"
+#include "ThreadPool.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define HAS_X86_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define HAS_X86_SIMD 0
+#endif
 
 /**
 * @fn	template <class T> T barycentricWeighting(float w1, float w2, float w3, const T &i1, const T &i2, const T &i3)
@@ -224,19 +240,17 @@ static float cheapNonPerspectiveCorrectInterpolationForLines(const glm::vec2 &st
 }
 
 /**
- * @fn	void drawVerticalLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos, const std::vector<LightSourcePtr> &lights, VertexData v0, VertexData v1, const glm::mat4 &viewingMatrix)
+ * @fn	void drawVerticalLine(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, VertexData v0, VertexData v1)
  * @brief	Draw vertical line
  * @param [in,out]	frameBuffer  	Framebuffer.
- * @param 		  	eyePos		 	Eye position.
+ * @param 		  	state		 	The state of the draw.
  * @param 		  	lights		 	Vector of lights in scene.
  * @param 		  	v0			 	The first endpoint.
  * @param 		  	v1			 	The second endpoint.
- * @param 		  	viewingMatrix	The viewing matrix.
  */
 
-static void drawVerticalLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
-						const std::vector<LightSourcePtr> &lights, VertexData v0, VertexData v1,
-						const glm::mat4 &viewingMatrix) {
+static void drawVerticalLine(FrameBuffer &frameBuffer, const RenderState &state,
+						const std::vector<LightSourcePtr> &lights, VertexData v0, VertexData v1) {
 	if (v1.position.y < v0.position.y) {
 		std::swap(v0, v1);
 	}
@@ -251,30 +265,29 @@ static void drawVerticalLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
 
 		// Interpolate vertex attributes using alpha, beta, and gamma weights
 		float oneMinusW = 1.0f - weight;
-		fragment.material = weightedAverage(oneMinusW, v0.material, weight, v1.material);
+		fragment.materialID = weight < 0.5f ? v0.materialID : v1.materialID;
+		fragment.litColor = weightedAverage(1.0f - weight, v0.litColor, weight, v1.litColor);
 		float z = weightedAverage(oneMinusW, v0.position.z, weight, v1.position.z);
 		fragment.worldNormal = weightedAverage(oneMinusW, v0.normal, weight, v1.normal);
 		fragment.worldPosition = weightedAverage(oneMinusW, v0.worldPosition, weight, v1.worldPosition);
 		fragment.windowPosition = glm::vec3(v0.position.x, y, z);
 
-		FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, viewingMatrix);
+		FragmentOps::processFragments(frameBuffer, state, lights, &fragment, 1);
 	}
 }
 
 /**
- * @fn	static void drawHorizontalLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos, const std::vector<LightSourcePtr> &lights, VertexData v0, VertexData v1, const glm::mat4 &viewingMatrix)
+ * @fn	static void drawHorizontalLine(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, VertexData v0, VertexData v1)
  * @brief	Draw horizontal line
  * @param [in,out]	frameBuffer  	Framebuffer.
- * @param 		  	eyePos		 	Eye position.
+ * @param 		  	state		 	The state of the draw.
  * @param 		  	lights		 	Vector of lights in scene.
  * @param 		  	v0			 	The first endpoint.
  * @param 		  	v1			 	The second endpoint.
- * @param 		  	viewingMatrix	The viewing matrix.
  */
 
-static void drawHorizontalLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
-					const std::vector<LightSourcePtr> &lights, VertexData v0, VertexData v1,
-					const glm::mat4 &viewingMatrix) {
+static void drawHorizontalLine(FrameBuffer &frameBuffer, const RenderState &state,
+					const std::vector<LightSourcePtr> &lights, VertexData v0, VertexData v1) {
 	if (v1.position.x < v0.position.x) {
 		std::swap(v0, v1);
 	}
@@ -286,30 +299,29 @@ static void drawHorizontalLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos
 		Fragment fragment;
 
 		// Interpolate vertex attributes using alpha, beta, and gamma weights
-		fragment.material = weightedAverage(1.0f - weight, v0.material, weight, v1.material);
+		fragment.materialID = weight < 0.5f ? v0.materialID : v1.materialID;
+		fragment.litColor = weightedAverage(1.0f - weight, v0.litColor, weight, v1.litColor);
 		float z = weightedAverage(1 - weight, v0.position.z, weight, v1.position.z);
 		fragment.worldNormal = weightedAverage(1.0f - weight, v0.normal, weight, v1.normal);
 		fragment.worldPosition = weightedAverage(1.0f - weight, v0.worldPosition, weight, v1.worldPosition);
 		fragment.windowPosition = glm::vec3(x, v1.position.y, z);
 
-		FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, viewingMatrix);
+		FragmentOps::processFragments(frameBuffer, state, lights, &fragment, 1);
 	}
 }
 
 /**
- * @fn	static void midPointLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos, const std::vector<LightSourcePtr> &lights, VertexData v0, VertexData v1, const glm::mat4 &viewingMatrix)
+ * @fn	static void midPointLine(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, VertexData v0, VertexData v1)
  * @brief	Middle point line
  * @param [in,out]	frameBuffer  	Framebuffer.
- * @param 		  	eyePos		 	Eye position.
+ * @param 		  	state		 	The state of the draw.
  * @param 		  	lights		 	Vector of lights in scene.
  * @param 		  	v0			 	The first endpoint.
  * @param 		  	v1			 	The second endpoint.
- * @param 		  	viewingMatrix	The viewing matrix.
  */
 
-static void midPointLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos, 
-					const std::vector<LightSourcePtr> &lights, VertexData v0, VertexData v1,
-					const glm::mat4 &viewingMatrix) {
+static void midPointLine(FrameBuffer &frameBuffer, const RenderState &state,
+					const std::vector<LightSourcePtr> &lights, VertexData v0, VertexData v1) {
 	if (v1.position.x < v0.position.x) {
 		std::swap(v0, v1);
 	}
@@ -328,13 +340,14 @@ static void midPointLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
 			Fragment fragment;
 
 			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0f - weight, v0.material, weight, v1.material);
+			fragment.materialID = weight < 0.5f ? v0.materialID : v1.materialID;
+			fragment.litColor = weightedAverage(1.0f - weight, v0.litColor, weight, v1.litColor);
 			float z = weightedAverage(1 - weight, v0.position.z, weight, v1.position.z);
 			fragment.worldNormal = weightedAverage(1.0f - weight, v0.normal, weight, v1.normal);
 			fragment.worldPosition = weightedAverage(1.0f - weight, v0.worldPosition, weight, v1.worldPosition);
 			fragment.windowPosition = glm::vec3(x, y, z);
 
-			FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, viewingMatrix);
+			FragmentOps::processFragments(frameBuffer, state, lights, &fragment, 1);
 
 			// Evaluate the implicit equation for the line to determine if
 			// the line will be above the midpoint between the pixel centers.
@@ -357,13 +370,14 @@ static void midPointLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
 			Fragment fragment;
 
 			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0f - weight, v0.material, weight, v1.material);
+			fragment.materialID = weight < 0.5f ? v0.materialID : v1.materialID;
+			fragment.litColor = weightedAverage(1.0f - weight, v0.litColor, weight, v1.litColor);
 			float z = weightedAverage(1 - weight, v0.position.z, weight, v1.position.z);
 			fragment.worldNormal = weightedAverage(1.0f - weight, v0.normal, weight, v1.normal);
 			fragment.worldPosition = weightedAverage(1.0f - weight, v0.worldPosition, weight, v1.worldPosition);
 			fragment.windowPosition = glm::vec3(x, y, z);
 
-			FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, viewingMatrix);
+			FragmentOps::processFragments(frameBuffer, state, lights, &fragment, 1);
 
 			// Evaluate the implicit equation for the line to determine if
 			// the line will be left or right the midpoint between the pixel centers.
@@ -386,13 +400,14 @@ static void midPointLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
 			Fragment fragment;
 
 			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0f - weight, v0.material, weight, v1.material);
+			fragment.materialID = weight < 0.5f ? v0.materialID : v1.materialID;
+			fragment.litColor = weightedAverage(1.0f - weight, v0.litColor, weight, v1.litColor);
 			float z = weightedAverage(1 - weight, v0.position.z, weight, v1.position.z);
 			fragment.worldNormal = weightedAverage(1.0f - weight, v0.normal, weight, v1.normal);
 			fragment.worldPosition = weightedAverage(1.0f - weight, v0.worldPosition, weight, v1.worldPosition);
 			fragment.windowPosition = glm::vec3(x, y, z);
 
-			FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, viewingMatrix);
+			FragmentOps::processFragments(frameBuffer, state, lights, &fragment, 1);
 
 			// Evaluate the implicit equation for the line to determine if
 			// the line will be below the midpoint between the pixel centers.
@@ -416,13 +431,14 @@ static void midPointLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
 			Fragment fragment;
 
 			// Interpolate vertex attributes using alpha, beta, and gamma weights
-			fragment.material = weightedAverage(1.0f - weight, v0.material, weight, v1.material);
+			fragment.materialID = weight < 0.5f ? v0.materialID : v1.materialID;
+			fragment.litColor = weightedAverage(1.0f - weight, v0.litColor, weight, v1.litColor);
 			float z = weightedAverage(1 - weight, v0.position.z, weight, v1.position.z);
 			fragment.worldNormal = weightedAverage(1.0f - weight, v0.normal, weight, v1.normal);
 			fragment.worldPosition = weightedAverage(1.0f - weight, v0.worldPosition, weight, v1.worldPosition);
 			fragment.windowPosition = glm::vec3(x, y, z);
 
-			FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, viewingMatrix);
+			FragmentOps::processFragments(frameBuffer, state, lights, &fragment, 1);
 
 			// Evaluate the implicit equation for the line to determine if
 			// the line will be left or right the midpoint between the pixel centers.
@@ -437,6 +453,45 @@ static void midPointLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
 	}
 }
 
+/**
+ * @fn	static RenderState stateForViewingMatrix(const FrameBuffer &frameBuffer, const glm::mat4 &viewingMatrix)
+ * @brief	The state used by the drawing functions that are given a viewing
+ * 			matrix instead of a RenderState. Only the eye and the current
+ * 			FragmentOps settings matter once vertices are in window coordinates.
+ * @param	frameBuffer  	Framebuffer.
+ * @param	viewingMatrix	Viewing matrix.
+ * @return	The state.
+ */
+
+static RenderState stateForViewingMatrix(const FrameBuffer &frameBuffer, const glm::mat4 &viewingMatrix) {
+	return RenderState(glm::mat4(1.0f), viewingMatrix, glm::mat4(1.0f),
+						BoundingBoxi(0, frameBuffer.getWindowWidth() - 1, 0, frameBuffer.getWindowHeight() - 1));
+}
+
+/**
+ * @fn	static void drawLineSegment(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, const VertexData &v0, const VertexData &v1)
+ * @brief	Draw line. Lines aren't binned, so binned triangles are drawn first,
+ * 			to keep draws in order.
+ * @param [in,out]	frameBuffer  	Framebuffer.
+ * @param 		  	state		 	The state of the draw.
+ * @param 		  	lights		 	Vector of lights in scene.
+ * @param 		  	v0			 	The first endpoint.
+ * @param 		  	v1			 	The second endpoint.
+ */
+
+static void drawLineSegment(FrameBuffer &frameBuffer, const RenderState &state,
+							const std::vector<LightSourcePtr> &lights,
+							const VertexData &v0, const VertexData &v1) {
+	flushTriangleBins();
+	if (v0.position.x == v1.position.x) {
+		drawVerticalLine(frameBuffer, state, lights, v0, v1);
+	} else if (v0.position.y == v1.position.y) {
+		drawHorizontalLine(frameBuffer, state, lights, v0, v1);
+	} else {
+		midPointLine(frameBuffer, state, lights, v0, v1);
+	}
+}
+
 /**
  * @fn	void drawLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos, const std::vector<LightSourcePtr> &lights, const VertexData &v0, const VertexData &v1, const glm::mat4 &viewingMatrix)
  * @brief	Draw line
@@ -452,13 +507,7 @@ void drawLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
 				const std::vector<LightSourcePtr> &lights, 
 				const VertexData &v0, const VertexData &v1,
 					const glm::mat4 &viewingMatrix) {
-	if (v0.position.x == v1.position.x) {
-		drawVerticalLine(frameBuffer, eyePos, lights, v0, v1, viewingMatrix);
-	} else if (v0.position.y == v1.position.y) {
-		drawHorizontalLine(frameBuffer, eyePos, lights, v0, v1, viewingMatrix);
-	} else {
-		midPointLine(frameBuffer, eyePos, lights, v0, v1, viewingMatrix);
-	}
+	drawLineSegment(frameBuffer, stateForViewingMatrix(frameBuffer, viewingMatrix), lights, v0, v1);
 }
 
 /**
@@ -475,8 +524,23 @@ void drawManyLines(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
 					const std::vector<LightSourcePtr> &lights, 
 					const std::vector<VertexData> &vertices,
 					const glm::mat4 &viewingMatrix) {
+	drawManyLines(frameBuffer, stateForViewingMatrix(frameBuffer, viewingMatrix), lights, vertices);
+}
+
+/**
+ * @fn	void drawManyLines(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &vertices)
+ * @brief	Draw many lines
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	state	   	The state of the draw.
+ * @param 		  	lights	   	Vector of lights in scene.
+ * @param 		  	vertices   	Vector of vertice-pairs.
+ */
+
+void drawManyLines(FrameBuffer &frameBuffer, const RenderState &state,
+					const std::vector<LightSourcePtr> &lights,
+					const std::vector<VertexData> &vertices) {
 	for (unsigned int i = 0; (i + 1) < vertices.size(); i += 2) {
-		drawLine(frameBuffer, eyePos, lights, vertices[i], vertices[i + 1], viewingMatrix);
+		drawLineSegment(frameBuffer, state, lights, vertices[i], vertices[i + 1]);
 	}
 }
 
@@ -499,9 +563,10 @@ void drawWireFrameTriangle(FrameBuffer &frameBuffer,
 							const VertexData &v1, 
 							const VertexData &v2,
 							const glm::mat4 &viewingMatrix) {
-	drawLine(frameBuffer, eyePos, lights, v0, v1, viewingMatrix);
-	drawLine(frameBuffer, eyePos, lights, v1, v2, viewingMatrix);
-	drawLine(frameBuffer, eyePos, lights, v2, v0, viewingMatrix);
+	RenderState state = stateForViewingMatrix(frameBuffer, viewingMatrix);
+	drawLineSegment(frameBuffer, state, lights, v0, v1);
+	drawLineSegment(frameBuffer, state, lights, v1, v2);
+	drawLineSegment(frameBuffer, state, lights, v2, v0);
 }
 
 /**
@@ -519,64 +584,639 @@ void drawManyWireFrameTriangles(FrameBuffer &frameBuffer,
 									const std::vector<LightSourcePtr> &lights,
 									const std::vector<VertexData> &vertices,
 									const glm::mat4 &viewingMatrix) {
+	RenderState state = stateForViewingMatrix(frameBuffer, viewingMatrix);
 	for (unsigned int i = 0; (i + 2) < vertices.size(); i += 3) {
-		drawWireFrameTriangle(frameBuffer, eyePos, lights, 
-								vertices[i], vertices[i + 1], vertices[i + 2], viewingMatrix);
+		drawLineSegment(frameBuffer, state, lights, vertices[i], vertices[i + 1]);
+		drawLineSegment(frameBuffer, state, lights, vertices[i + 1], vertices[i + 2]);
+		drawLineSegment(frameBuffer, state, lights, vertices[i + 2], vertices[i]);
+	}
+}
+
+const int SUBPIXEL_BITS = 4;						//!< Fractional bits of fixed-point window coordinates.
+const int SUBPIXEL_ONE = 1 << SUBPIXEL_BITS;		//!< One pixel, in fixed-point units.
+const int RASTER_BLOCK_SHIFT = 3;					//!< log2 of the rasterizer's block size.
+const int RASTER_BLOCK_SIZE = 1 << RASTER_BLOCK_SHIFT;	//!< Blocks of this many pixels square are rejected or accepted whole.
+const int SAMPLE_REACH = SUBPIXEL_ONE / 2;			//!< No sample lies farther than this from its pixel's position, in x or y.
+
+// Standard multisample positions, in subpixels from the pixel's position. Each is a
+// rotated grid: no two samples share a row or column, so near horizontal and near
+// vertical edges get as many coverage levels as there are samples.
+static const int SAMPLE_POSITIONS_4[4][2] = { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } };
+static const int SAMPLE_POSITIONS_8[8][2] = { { 1, -3 }, { -1, 3 }, { 5, 1 }, { -3, -5 },
+												{ -5, 5 }, { -7, -1 }, { 3, 7 }, { 7, -7 } };
+static_assert(SUBPIXEL_ONE == 16, "sample positions are in sixteenths of a pixel");
+
+/**
+ * @struct	EdgeFunction
+ * @brief	Fixed-point implicit equation of one triangle edge, E(x,y) = A*x + B*y + C,
+ * 			evaluated at integer pixel positions. E is positive on the triangle's side
+ * 			of the edge, and moving one pixel in x (or y) adds A (or B), so scanning
+ * 			needs only additions. Values are in 1/(SUBPIXEL_ONE^2) units, which is why
+ * 			they are kept in 64 bits.
+ */
+
+struct EdgeFunction {
+	long long A;		//!< Change in E per pixel in x
+	long long B;		//!< Change in E per pixel in y
+	long long C;		//!< E at pixel (0,0)
+	long long bias;		//!< A pixel is inside iff E >= bias. 0 for top-left edges, 1 otherwise.
+
+	/**
+	 * @fn	void setup(int x0, int y0, int x1, int y1)
+	 * @brief	Sets up the equation of the edge from (x0,y0) to (x1,y1), given in fixed-point.
+	 */
+
+	void setup(int x0, int y0, int x1, int y1) {
+		A = (long long)(y0 - y1) << SUBPIXEL_BITS;
+		B = (long long)(x1 - x0) << SUBPIXEL_BITS;
+		C = (long long)x0 * y1 - (long long)x1 * y0;
+	}
+
+	/**
+	 * @fn	void orient(bool flip)
+	 * @brief	Makes the edge positive on the triangle's side and applies the top-left
+	 * 			fill rule, so pixels exactly on an edge shared by two triangles are
+	 * 			drawn by exactly one of them.
+	 */
+
+	void orient(bool flip) {
+		if (flip) {
+			A = -A;
+			B = -B;
+			C = -C;
+		}
+		bool isTopLeft = A > 0 || (A == 0 && B < 0);
+		bias = isTopLeft ? 0 : 1;
+	}
+
+	long long evaluate(int x, int y) const {
+		return A * x + B * y + C;
+	}
+
+	/**
+	 * @fn	long long minOverBlock(int x, int y) const
+	 * @brief	Smallest value of E over the block whose lower left pixel is (x,y).
+	 */
+
+	long long minOverBlock(int x, int y) const {
+		const int LAST = RASTER_BLOCK_SIZE - 1;
+		return evaluate(x, y) + std::min(0LL, A * LAST) + std::min(0LL, B * LAST);
+	}
+
+	/**
+	 * @fn	long long maxOverBlock(int x, int y) const
+	 * @brief	Largest value of E over the block whose lower left pixel is (x,y).
+	 */
+
+	long long maxOverBlock(int x, int y) const {
+		const int LAST = RASTER_BLOCK_SIZE - 1;
+		return evaluate(x, y) + std::max(0LL, A * LAST) + std::max(0LL, B * LAST);
+	}
+};
+
+/**
+ * @fn	static inline int toFixedPoint(float coord)
+ * @brief	Converts a window coordinate to fixed-point, rounding to the nearest subpixel.
+ * @param	coord	The window coordinate.
+ * @return	The fixed-point coordinate.
+ */
+
+static inline int toFixedPoint(float coord) {
+	return (int)std::lround(coord * SUBPIXEL_ONE);
+}
+
+/**
+ * @struct	TriangleSetup
+ * @brief	Everything the block kernels need to know about the triangle being drawn.
+ */
+
+struct TriangleSetup {
+	const VertexData *v0, *v1, *v2;	//!< The triangle's vertices, in window coordinates
+	EdgeFunction e12, e20, e01;		//!< Edge functions; their values weight v0, v1 and v2 respectively
+	float invArea;					//!< Reciprocal of the (positive) edge function sum
+	int xMin, xMax, yMin, yMax;		//!< Pixels to be considered, clipped to the window
+	bool fitsIn32Bits;				//!< True ==> edge values over every visited block fit in an int
+	MaterialIndex materialID;		//!< v0's material, which the whole triangle is drawn with
+	bool vertexLighting;			//!< True ==> the vertices' lit colors are interpolated instead of normals
+	int sampleCount;				//!< The framebuffer's samples per pixel
+	long long sampleOffset[3][MAX_SAMPLES];	//!< Per edge (e12, e20, e01), change in E from a pixel's position to each sample
+	float sampleDepthOffset[MAX_SAMPLES];	//!< Change in depth from a pixel's position to each sample
+};
+
+/**
+ * @struct	FragmentBatch
+ * @brief	The fragments produced from one block, handed to fragment processing together.
+ */
+
+struct FragmentBatch {
+	Fragment fragments[RASTER_BLOCK_SIZE * RASTER_BLOCK_SIZE];
+	int count;
+};
+
+/**
+ * @fn	static void setupFragment(Fragment &fragment, const TriangleSetup &tri, float alpha, float beta, float gamma, int x, int y, float z)
+ * @brief	Interpolates the remaining vertex attributes at a covered pixel whose
+ * 			depth is already known. The triangle's material is flat and only copied.
+ * 			When lighting is per vertex, the color replaces the normal.
+ * @param [out]	fragment	The fragment to fill in.
+ * @param 	   	tri			The triangle.
+ * @param 	   	alpha   	v0's barycentric weight.
+ * @param 	   	beta		v1's barycentric weight.
+ * @param 	   	gamma   	v2's barycentric weight.
+ * @param 	   	x			Window x coordinate.
+ * @param 	   	y			Window y coordinate.
+ * @param 	   	z			Window depth.
+ */
+
+static void setupFragment(Fragment &fragment, const TriangleSetup &tri,
+							float alpha, float beta, float gamma, int x, int y, float z) {
+	const VertexData &v0 = *tri.v0, &v1 = *tri.v1, &v2 = *tri.v2;
+
+	// Interpolate vertex attributes using alpha, beta, and gamma weights
+	fragment.materialID = tri.materialID;
+	if (tri.vertexLighting) {
+		fragment.litColor = barycentricWeighting(alpha, beta, gamma,
+												v0.litColor, v1.litColor, v2.litColor);
+	} else {
+		fragment.worldNormal = barycentricWeighting(alpha, beta, gamma,
+													v0.normal, v1.normal, v2.normal);
 	}
+	fragment.worldPosition = barycentricWeighting(alpha, beta, gamma,
+												v0.worldPosition, v1.worldPosition, v2.worldPosition);
+	fragment.windowPosition = glm::vec3(x, y, z);
 }
 
 /**
- * @fn	static inline float f01(const VertexData &v0, const VertexData &v1, const VertexData &v2, float x, float y)
- * @brief	Computes f01. Implicit equation for the line between v0 and v1.
- * @see		*** page in textbook.
- * @param	v0	v0.
- * @param	v1	v1.
- * @param	v2	v2.
- * @param	x 	x coordinate.
- * @param	y 	y coordinate.
- * @return	f01.
+ * @fn	static void rasterizeBlockScalar(const TriangleSetup &tri, int bx, int by, bool isCovered, const float *tileDepths, FragmentBatch &batch)
+ * @brief	Reference block kernel. Steps the edge functions one pixel at a time.
+ * 			Each covered pixel's depth is interpolated first, and only pixels that
+ * 			pass the early depth test have their other attributes interpolated.
+ * @param 		  	tri		  	The triangle.
+ * @param 		  	bx		  	Block's lower left x coordinate.
+ * @param 		  	by		  	Block's lower left y coordinate.
+ * @param 		  	isCovered 	True ==> the block lies entirely inside the triangle.
+ * @param 		  	tileDepths	The block's depths, row-major. nullptr ==> no early depth test.
+ * @param [in,out]	batch	  	Receives the block's fragments.
  */
 
-static inline float f01(const VertexData &v0, const VertexData &v1, const VertexData &v2, float x, float y) {
-	return (v0.position.y - v1.position.y) * x + (v1.position.x - v0.position.x) * y +
-		(v0.position.x * v1.position.y) - (v1.position.x * v0.position.y);
+static void rasterizeBlockScalar(const TriangleSetup &tri, int bx, int by, bool isCovered,
+								const float *tileDepths, FragmentBatch &batch) {
+	const EdgeFunction &e12 = tri.e12, &e20 = tri.e20, &e01 = tri.e01;
+	const int xStart = std::max(bx, tri.xMin), xEnd = std::min(bx + RASTER_BLOCK_SIZE - 1, tri.xMax);
+	const int yStart = std::max(by, tri.yMin), yEnd = std::min(by + RASTER_BLOCK_SIZE - 1, tri.yMax);
+	const float z0 = tri.v0->position.z, z1 = tri.v1->position.z, z2 = tri.v2->position.z;
+
+	long long w0Row = e12.evaluate(xStart, yStart);
+	long long w1Row = e20.evaluate(xStart, yStart);
+	long long w2Row = e01.evaluate(xStart, yStart);
+	for (int y = yStart; y <= yEnd; y++) {
+		long long w0 = w0Row, w1 = w1Row, w2 = w2Row;
+		for (int x = xStart; x <= xEnd; x++) {
+			if (isCovered || (w0 >= e12.bias && w1 >= e20.bias && w2 >= e01.bias)) {
+				float alpha = w0 * tri.invArea, beta = w1 * tri.invArea, gamma = w2 * tri.invArea;
+				float z = barycentricWeighting(alpha, beta, gamma, z0, z1, z2);
+				if (tileDepths == nullptr || z < tileDepths[((y - by) << RASTER_BLOCK_SHIFT) + (x - bx)]) {
+					setupFragment(batch.fragments[batch.count++], tri, alpha, beta, gamma, x, y, z);
+				}
+			}
+			w0 += e12.A;
+			w1 += e20.A;
+			w2 += e01.A;
+		}
+		w0Row += e12.B;
+		w1Row += e20.B;
+		w2Row += e01.B;
+	}
+}
+
+/**
+ * @fn	static void rasterizeBlockMultisampled(const TriangleSetup &tri, int bx, int by, bool isCovered, bool depthTest, bool depthWrite, FrameBuffer &frameBuffer, FragmentBatch &batch)
+ * @brief	Block kernel for a multisampled framebuffer. Coverage and depth are found
+ * 			at each sample position, and the covered samples are depth tested, and
+ * 			their depths written, here. A pixel with any sample passing becomes one
+ * 			fragment, interpolated at the pixel's position, whose coverage says which
+ * 			samples it colors. So a pixel is shaded once per triangle, however many
+ * 			samples it has.
+ * @param 		  	tri		   	The triangle.
+ * @param 		  	bx		   	Block's lower left x coordinate.
+ * @param 		  	by		   	Block's lower left y coordinate.
+ * @param 		  	isCovered  	True ==> every sample in the block lies inside the triangle.
+ * @param 		  	depthTest  	True ==> samples are depth tested.
+ * @param 		  	depthWrite 	True ==> passing samples write their depths.
+ * @param [in,out]	frameBuffer	Framebuffer, multisampled.
+ * @param [in,out]	batch	   	Receives the block's fragments.
+ */
 
+static void rasterizeBlockMultisampled(const TriangleSetup &tri, int bx, int by, bool isCovered,
+										bool depthTest, bool depthWrite, FrameBuffer &frameBuffer,
+										FragmentBatch &batch) {
+	const EdgeFunction &e12 = tri.e12, &e20 = tri.e20, &e01 = tri.e01;
+	const long long *offset0 = tri.sampleOffset[0], *offset1 = tri.sampleOffset[1], *offset2 = tri.sampleOffset[2];
+	const int S = tri.sampleCount;
+	const SampleMask ALL_SAMPLES = (SampleMask)((1 << S) - 1);
+	const int xStart = std::max(bx, tri.xMin), xEnd = std::min(bx + RASTER_BLOCK_SIZE - 1, tri.xMax);
+	const int yStart = std::max(by, tri.yMin), yEnd = std::min(by + RASTER_BLOCK_SIZE - 1, tri.yMax);
+	const float z0 = tri.v0->position.z, z1 = tri.v1->position.z, z2 = tri.v2->position.z;
+	float depths[MAX_SAMPLES];
+
+	long long w0Row = e12.evaluate(xStart, yStart);
+	long long w1Row = e20.evaluate(xStart, yStart);
+	long long w2Row = e01.evaluate(xStart, yStart);
+	for (int y = yStart; y <= yEnd; y++) {
+		long long w0 = w0Row, w1 = w1Row, w2 = w2Row;
+		for (int x = xStart; x <= xEnd; x++) {
+			SampleMask covered = ALL_SAMPLES;
+			if (!isCovered) {
+				covered = 0;
+				for (int s = 0; s < S; s++) {
+					if (w0 + offset0[s] >= e12.bias && w1 + offset1[s] >= e20.bias && w2 + offset2[s] >= e01.bias) {
+						covered |= 1 << s;
+					}
+				}
+			}
+			if (covered != 0) {
+				float alpha = w0 * tri.invArea, beta = w1 * tri.invArea, gamma = w2 * tri.invArea;
+				float z = barycentricWeighting(alpha, beta, gamma, z0, z1, z2);
+				for (int s = 0; s < S; s++) {
+					depths[s] = z + tri.sampleDepthOffset[s];
+				}
+				SampleMask passed = frameBuffer.testSampleDepths(x, y, covered, depths, depthTest, depthWrite);
+				if (passed != 0) {
+					Fragment &fragment = batch.fragments[batch.count++];
+					setupFragment(fragment, tri, alpha, beta, gamma, x, y, z);
+					fragment.coverage = passed;
+				}
+			}
+			w0 += e12.A;
+			w1 += e20.A;
+			w2 += e01.A;
+		}
+		w0Row += e12.B;
+		w1Row += e20.B;
+		w2Row += e01.B;
+	}
 }
 
+#if HAS_X86_SIMD
+
 /**
- * @fn	static inline float f12(const VertexData &v0, const VertexData &v1, const VertexData &v2, float x, float y)
- * @brief	Computes f12. Implicit equation for the line between v1 and v2.
- * @see		*** page in textbook.
- * @param	v0	v0.
- * @param	v1	v1.
- * @param	v2	v2.
- * @param	x 	x coordinate.
- * @param	y 	y coordinate.
- * @return	f12.
+ * @fn	static void rasterizeBlockAVX2(const TriangleSetup &tri, int bx, int by, bool isCovered, const float *tileDepths, FragmentBatch &batch)
+ * @brief	AVX2 block kernel. Each row of the block is one vector of 8 pixels: the
+ * 			edge functions, coverage mask, barycentric weights and depth are
+ * 			computed and depth tested 8 pixels at a time, and the normal and world
+ * 			position are interpolated only for rows with surviving pixels. Gives the
+ * 			same fragments as rasterizeBlockScalar, but requires tri.fitsIn32Bits.
+ * @param 		  	tri		  	The triangle.
+ * @param 		  	bx		  	Block's lower left x coordinate.
+ * @param 		  	by		  	Block's lower left y coordinate.
+ * @param 		  	isCovered 	True ==> the block lies entirely inside the triangle.
+ * @param 		  	tileDepths	The block's depths, row-major. nullptr ==> no early depth test.
+ * @param [in,out]	batch	  	Receives the block's fragments.
  */
 
-static inline float f12(const VertexData &v0, const VertexData &v1, const VertexData &v2, float x, float y) {
-	return (v1.position.y - v2.position.y) * x + (v2.position.x - v1.position.x) * y +
-		(v1.position.x * v2.position.y) - (v2.position.x * v1.position.y);
+TARGET_AVX2 static void rasterizeBlockAVX2(const TriangleSetup &tri, int bx, int by, bool isCovered,
+											const float *tileDepths, FragmentBatch &batch) {
+	static_assert(RASTER_BLOCK_SIZE == 8, "one block row must fill one AVX2 vector");
+	const VertexData &v0 = *tri.v0, &v1 = *tri.v1, &v2 = *tri.v2;
+	const EdgeFunction &e12 = tri.e12, &e20 = tri.e20, &e01 = tri.e01;
+	const int yStart = std::max(by, tri.yMin), yEnd = std::min(by + RASTER_BLOCK_SIZE - 1, tri.yMax);
+
+	// Lanes outside [xMin, xMax] are never covered
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i inRange = _mm256_andnot_si256(
+		_mm256_or_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(tri.xMin - bx), lane),
+						_mm256_cmpgt_epi32(lane, _mm256_set1_epi32(tri.xMax - bx))),
+		_mm256_set1_epi32(-1));
+
+	const __m256i step0 = _mm256_mullo_epi32(lane, _mm256_set1_epi32((int)e12.A));
+	const __m256i step1 = _mm256_mullo_epi32(lane, _mm256_set1_epi32((int)e20.A));
+	const __m256i step2 = _mm256_mullo_epi32(lane, _mm256_set1_epi32((int)e01.A));
+	const __m256i bias0 = _mm256_set1_epi32((int)e12.bias - 1);
+	const __m256i bias1 = _mm256_set1_epi32((int)e20.bias - 1);
+	const __m256i bias2 = _mm256_set1_epi32((int)e01.bias - 1);
+	const __m256 invArea = _mm256_set1_ps(tri.invArea);
+
+	alignas(32) float z[8];
+	alignas(32) float nx[8], ny[8], nz[8], px[8], py[8], pz[8];
+
+	for (int y = yStart; y <= yEnd; y++) {
+		__m256i w0 = _mm256_add_epi32(_mm256_set1_epi32((int)e12.evaluate(bx, y)), step0);
+		__m256i w1 = _mm256_add_epi32(_mm256_set1_epi32((int)e20.evaluate(bx, y)), step1);
+		__m256i w2 = _mm256_add_epi32(_mm256_set1_epi32((int)e01.evaluate(bx, y)), step2);
+
+		__m256i covered = inRange;
+		if (!isCovered) {
+			covered = _mm256_and_si256(covered, _mm256_cmpgt_epi32(w0, bias0));
+			covered = _mm256_and_si256(covered, _mm256_cmpgt_epi32(w1, bias1));
+			covered = _mm256_and_si256(covered, _mm256_cmpgt_epi32(w2, bias2));
+		}
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(covered));
+		if (mask == 0) {
+			continue;
+		}
 
+		const __m256 a = _mm256_mul_ps(_mm256_cvtepi32_ps(w0), invArea);
+		const __m256 b = _mm256_mul_ps(_mm256_cvtepi32_ps(w1), invArea);
+		const __m256 c = _mm256_mul_ps(_mm256_cvtepi32_ps(w2), invArea);
+
+		// Same operation order as barycentricWeighting, so both kernels agree exactly
+#define INTERPOLATE(f0, f1, f2)														\
+		_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a, _mm256_set1_ps(f0)),			\
+									_mm256_mul_ps(b, _mm256_set1_ps(f1))),			\
+									_mm256_mul_ps(c, _mm256_set1_ps(f2)))
+		const __m256 depth = INTERPOLATE(v0.position.z, v1.position.z, v2.position.z);
+		if (tileDepths != nullptr) {
+			const __m256 stored = _mm256_loadu_ps(tileDepths + ((y - by) << RASTER_BLOCK_SHIFT));
+			mask &= _mm256_movemask_ps(_mm256_cmp_ps(depth, stored, _CMP_LT_OQ));
+			if (mask == 0) {
+				continue;
+			}
+		}
+		_mm256_store_ps(z, depth);
+		if (tri.vertexLighting) {		// The color takes the normal's place
+			_mm256_store_ps(nx, INTERPOLATE(v0.litColor.r, v1.litColor.r, v2.litColor.r));
+			_mm256_store_ps(ny, INTERPOLATE(v0.litColor.g, v1.litColor.g, v2.litColor.g));
+			_mm256_store_ps(nz, INTERPOLATE(v0.litColor.b, v1.litColor.b, v2.litColor.b));
+		} else {
+			_mm256_store_ps(nx, INTERPOLATE(v0.normal.x, v1.normal.x, v2.normal.x));
+			_mm256_store_ps(ny, INTERPOLATE(v0.normal.y, v1.normal.y, v2.normal.y));
+			_mm256_store_ps(nz, INTERPOLATE(v0.normal.z, v1.normal.z, v2.normal.z));
+		}
+		_mm256_store_ps(px, INTERPOLATE(v0.worldPosition.x, v1.worldPosition.x, v2.worldPosition.x));
+		_mm256_store_ps(py, INTERPOLATE(v0.worldPosition.y, v1.worldPosition.y, v2.worldPosition.y));
+		_mm256_store_ps(pz, INTERPOLATE(v0.worldPosition.z, v1.worldPosition.z, v2.worldPosition.z));
+#undef INTERPOLATE
+
+		for (int i = 0; i < 8; i++) {
+			if (mask & (1 << i)) {
+				Fragment &fragment = batch.fragments[batch.count++];
+				fragment.materialID = tri.materialID;
+				if (tri.vertexLighting) {
+					fragment.litColor = color(nx[i], ny[i], nz[i]);
+				} else {
+					fragment.worldNormal = glm::vec3(nx[i], ny[i], nz[i]);
+				}
+				fragment.worldPosition = glm::vec3(px[i], py[i], pz[i]);
+				fragment.windowPosition = glm::vec3(bx + i, y, z[i]);
+			}
+		}
+	}
 }
 
+#endif
+
 /**
- * @fn	static inline float f20(const VertexData &v0, const VertexData &v1, const VertexData &v2, float x, float y)
- * @brief	Computes f20. Implicit equation for the line between v2 and v0.
- * @see		*** page in textbook.
- * @param	v0	v0.
- * @param	v1	v1.
- * @param	v2	v2.
- * @param	x 	x coordinate.
- * @param	y 	y coordinate.
- * @return	f02.
+ * @fn	bool cpuSupportsAVX2()
+ * @brief	Determines if the processor and operating system support AVX2.
+ * @return	True iff AVX2 instructions can be used.
  */
 
-static inline float f20(const VertexData &v0, const VertexData &v1, const VertexData &v2, float x, float y) {
-	return (v2.position.y - v0.position.y) * x + (v0.position.x - v2.position.x) * y +
-		(v2.position.x * v0.position.y) - (v0.position.x * v2.position.y);
+bool cpuSupportsAVX2() {
+#if HAS_X86_SIMD && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool hasOSXSAVE = (info[2] & (1 << 27)) != 0;
+	bool hasAVX = (info[2] & (1 << 28)) != 0;
+	if (!hasOSXSAVE || !hasAVX || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif HAS_X86_SIMD
+	return __builtin_cpu_supports("avx2") != 0;
+#else
+	return false;
+#endif
+}
+
+static RasterKernel rasterKernel = cpuSupportsAVX2() ? AVX2_RASTER_KERNEL : SCALAR_RASTER_KERNEL;
+
+/**
+ * @fn	void setRasterKernel(RasterKernel kernel)
+ * @brief	Selects the block kernel used by drawFilledTriangle. By default the fastest
+ * 			kernel the processor supports is used; SCALAR_RASTER_KERNEL is the
+ * 			reference the others can be checked against.
+ * @param	kernel	The kernel. Falls back to SCALAR_RASTER_KERNEL if it is not supported.
+ */
 
+void setRasterKernel(RasterKernel kernel) {
+	rasterKernel = (kernel == AVX2_RASTER_KERNEL && !cpuSupportsAVX2()) ? SCALAR_RASTER_KERNEL : kernel;
+}
+
+/**
+ * @fn	RasterKernel getRasterKernel()
+ * @brief	Gets the block kernel used by drawFilledTriangle.
+ * @return	The raster kernel.
+ */
+
+RasterKernel getRasterKernel() {
+	return rasterKernel;
+}
+
+/**
+ * @fn	static bool edgeFitsIn32Bits(const EdgeFunction &edge, int xLo, int yLo, int xHi, int yHi)
+ * @brief	Determines if an edge function's values over a rectangle all fit in an int.
+ * 			The function is linear, so it is enough to check the corners.
+ * @return	True iff every value fits.
+ */
+
+static bool edgeFitsIn32Bits(const EdgeFunction &edge, int xLo, int yLo, int xHi, int yHi) {
+	long long corners[4] = { edge.evaluate(xLo, yLo), edge.evaluate(xHi, yLo),
+							edge.evaluate(xLo, yHi), edge.evaluate(xHi, yHi) };
+	for (long long value : corners) {
+		if (value <= INT_MIN || value > INT_MAX) {
+			return false;
+		}
+	}
+	return true;
+}
+
+const float HIZ_EPSILON = 1.0e-6f;		//!< Allows for rounding in interpolated depths, so ties are never rejected.
+
+/**
+ * @struct	DepthPlane
+ * @brief	Window depth over the triangle's plane, z(x,y) = z00 + dzdx*x + dzdy*y.
+ */
+
+struct DepthPlane {
+	double z00, dzdx, dzdy;
+
+	/**
+	 * @fn	void setup(const TriangleSetup &tri)
+	 * @brief	Finds the plane from the edge functions, which are the unnormalized
+	 * 			barycentric weights.
+	 */
+
+	void setup(const TriangleSetup &tri) {
+		const double z0 = tri.v0->position.z, z1 = tri.v1->position.z, z2 = tri.v2->position.z;
+		const double invArea = tri.invArea;
+		dzdx = invArea * (z0 * tri.e12.A + z1 * tri.e20.A + z2 * tri.e01.A);
+		dzdy = invArea * (z0 * tri.e12.B + z1 * tri.e20.B + z2 * tri.e01.B);
+		z00 = invArea * (z0 * tri.e12.C + z1 * tri.e20.C + z2 * tri.e01.C);
+	}
+
+	/**
+	 * @fn	float minOverBlock(int x, int y) const
+	 * @brief	Smallest depth of the plane over the block whose lower left pixel is (x,y).
+	 */
+
+	float minOverBlock(int x, int y) const {
+		const int LAST = RASTER_BLOCK_SIZE - 1;
+		return (float)(z00 + dzdx * x + dzdy * y + std::min(0.0, dzdx * LAST) + std::min(0.0, dzdy * LAST));
+	}
+};
+
+/**
+ * @fn	static void rasterizeTriangle(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, const VertexData &v0, const VertexData &v1, const VertexData &v2, const BoundingBoxi &scissor)
+ * @brief	Draws the part of a filled triangle that falls within a scissor rectangle.
+ * 			Uses fixed-point edge functions that are stepped incrementally, and walks
+ * 			the bounding box in RASTER_BLOCK_SIZE blocks: blocks entirely outside an
+ * 			edge are skipped, and blocks entirely inside all three edges are filled
+ * 			without any per pixel coverage tests. Each block's fragments are
+ * 			processed as one batch. When depth testing, the triangle and then each
+ * 			block is first checked against the framebuffer's hierarchical Z, and
+ * 			skipped if it is entirely hidden. With early depth testing, pixels are
+ * 			also depth tested before their attributes are interpolated. A
+ * 			multisampled framebuffer always has its samples depth tested early,
+ * 			and each pixel is shaded once for all the samples the triangle covers.
+ * @param [in,out]	frameBuffer  	Framebuffer.
+ * @param 		  	state		 	The state of the draw.
+ * @param 		  	lights		 	Vector of lights in scene.
+ * @param 		  	v0			 	v0.
+ * @param 		  	v1			 	v1.
+ * @param 		  	v2			 	v2.
+ * @param 		  	scissor		 	Only pixels within this rectangle are drawn. Its
+ * 									lower left corner must be on the block grid.
+ */
+
+static void rasterizeTriangle(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights,
+								const VertexData &v0, const VertexData &v1, const VertexData &v2,
+								const BoundingBoxi &scissor) {
+	const int X0 = toFixedPoint(v0.position.x), Y0 = toFixedPoint(v0.position.y);
+	const int X1 = toFixedPoint(v1.position.x), Y1 = toFixedPoint(v1.position.y);
+	const int X2 = toFixedPoint(v2.position.x), Y2 = toFixedPoint(v2.position.y);
+
+	// Twice the signed area; the sign gives the winding
+	long long area = (long long)(X1 - X0) * (Y2 - Y0) - (long long)(X2 - X0) * (Y1 - Y0);
+	if (area == 0) {
+		return;
+	}
+	const bool isClockwise = area < 0;
+
+	TriangleSetup tri;
+	tri.v0 = &v0;
+	tri.v1 = &v1;
+	tri.v2 = &v2;
+
+	// e12 is zero along v1-v2 and largest at v0, so it yields v0's weight (alpha), etc.
+	tri.e12.setup(X1, Y1, X2, Y2);
+	tri.e20.setup(X2, Y2, X0, Y0);
+	tri.e01.setup(X0, Y0, X1, Y1);
+	tri.e12.orient(isClockwise);
+	tri.e20.orient(isClockwise);
+	tri.e01.orient(isClockwise);
+	tri.invArea = 1.0f / (float)(isClockwise ? -area : area);
+
+	// Pixels whose (integer) positions, or samples, fall within the triangle's extent, clipped to the scissor
+	const bool multisampled = frameBuffer.isMultisampled();
+	const int reach = multisampled ? SAMPLE_REACH : 0;
+	tri.xMin = std::max((std::min({ X0, X1, X2 }) - reach + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS, scissor.lx);
+	tri.xMax = std::min((std::max({ X0, X1, X2 }) + reach) >> SUBPIXEL_BITS, scissor.rx);
+	tri.yMin = std::max((std::min({ Y0, Y1, Y2 }) - reach + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS, scissor.ly);
+	tri.yMax = std::min((std::max({ Y0, Y1, Y2 }) + reach) >> SUBPIXEL_BITS, scissor.ry);
+	if (tri.xMin > tri.xMax || tri.yMin > tri.yMax) {
+		return;
+	}
+
+	const bool useHiZ = state.performDepthTest;
+	const float zNearest = std::min({ v0.position.z, v1.position.z, v2.position.z }) - HIZ_EPSILON;
+	if (useHiZ && frameBuffer.isRegionOccluded(tri.xMin, tri.xMax, tri.yMin, tri.yMax, zNearest)) {
+		return;
+	}
+	DepthPlane depthPlane;
+	depthPlane.setup(tri);
+	tri.materialID = v0.materialID;
+	tri.vertexLighting = state.perVertexLighting;
+
+	// How far the edge functions and depth can move between a pixel's position and its samples
+	long long edgeReach[3] = { 0, 0, 0 };
+	float depthReach = 0.0f;
+	tri.sampleCount = frameBuffer.getSampleCount();
+	if (multisampled) {
+		const int (*positions)[2] = tri.sampleCount == 4 ? SAMPLE_POSITIONS_4 : SAMPLE_POSITIONS_8;
+		const EdgeFunction *edges[3] = { &tri.e12, &tri.e20, &tri.e01 };
+		for (int e = 0; e < 3; e++) {
+			for (int s = 0; s < tri.sampleCount; s++) {
+				tri.sampleOffset[e][s] = (edges[e]->A * positions[s][0] + edges[e]->B * positions[s][1]) / SUBPIXEL_ONE;
+			}
+			edgeReach[e] = (std::abs(edges[e]->A) + std::abs(edges[e]->B)) * SAMPLE_REACH / SUBPIXEL_ONE;
+		}
+		for (int s = 0; s < tri.sampleCount; s++) {
+			tri.sampleDepthOffset[s] = (float)((depthPlane.dzdx * positions[s][0] + depthPlane.dzdy * positions[s][1]) / SUBPIXEL_ONE);
+		}
+		depthReach = (float)((std::abs(depthPlane.dzdx) + std::abs(depthPlane.dzdy)) * SAMPLE_REACH / SUBPIXEL_ONE);
+	}
+
+	const int MASK = ~(RASTER_BLOCK_SIZE - 1);
+	const int bxFirst = tri.xMin & MASK, bxLast = tri.xMax | (RASTER_BLOCK_SIZE - 1);
+	const int byFirst = tri.yMin & MASK, byLast = tri.yMax | (RASTER_BLOCK_SIZE - 1);
+	tri.fitsIn32Bits = edgeFitsIn32Bits(tri.e12, bxFirst, byFirst, bxLast, byLast) &&
+						edgeFitsIn32Bits(tri.e20, bxFirst, byFirst, bxLast, byLast) &&
+						edgeFitsIn32Bits(tri.e01, bxFirst, byFirst, bxLast, byLast);
+
+	void (*rasterizeBlock)(const TriangleSetup &, int, int, bool, const float *, FragmentBatch &) = rasterizeBlockScalar;
+#if HAS_X86_SIMD
+	if (rasterKernel == AVX2_RASTER_KERNEL && tri.fitsIn32Bits) {
+		rasterizeBlock = rasterizeBlockAVX2;
+	}
+#endif
+
+	// Early depth testing needs each pixel's final depth before shading; late testing is kept for cases that don't
+	const bool testDepthEarly = useHiZ && state.earlyDepthTest;
+	const bool writeDepth = !state.readonlyDepthBuffer && !FragmentOps::isOrderIndependent(frameBuffer, state);
+	static_assert(RASTER_BLOCK_SIZE == TILE_SIZE, "each block must be exactly one framebuffer tile");
+	static thread_local FragmentBatch batch;
+	alignas(32) float tileDepths[PIXELS_PER_TILE];
+	for (int by = byFirst; by <= tri.yMax; by += RASTER_BLOCK_SIZE) {
+		for (int bx = bxFirst; bx <= tri.xMax; bx += RASTER_BLOCK_SIZE) {
+			// Skip the block if it is entirely outside any one edge
+			if (tri.e12.maxOverBlock(bx, by) + edgeReach[0] < tri.e12.bias ||
+				tri.e20.maxOverBlock(bx, by) + edgeReach[1] < tri.e20.bias ||
+				tri.e01.maxOverBlock(bx, by) + edgeReach[2] < tri.e01.bias) {
+				continue;
+			}
+			const bool isCovered = tri.e12.minOverBlock(bx, by) - edgeReach[0] >= tri.e12.bias &&
+									tri.e20.minOverBlock(bx, by) - edgeReach[1] >= tri.e20.bias &&
+									tri.e01.minOverBlock(bx, by) - edgeReach[2] >= tri.e01.bias;
+
+			// Skip the block if its tile is already nearer than all of it
+			const int tileX = bx >> TILE_SHIFT, tileY = by >> TILE_SHIFT;
+			if (useHiZ) {
+				float blockNearest = std::max(depthPlane.minOverBlock(bx, by) - depthReach - HIZ_EPSILON, zNearest);
+				if (blockNearest >= frameBuffer.getTileMaxDepth(tileX, tileY)) {
+					continue;
+				}
+			}
+
+			batch.count = 0;
+			if (multisampled) {
+				rasterizeBlockMultisampled(tri, bx, by, isCovered, state.performDepthTest,
+											writeDepth, frameBuffer, batch);
+			} else {
+				if (testDepthEarly) {
+					frameBuffer.readTileDepths(tileX, tileY, tileDepths);
+				}
+				rasterizeBlock(tri, bx, by, isCovered, testDepthEarly ? tileDepths : nullptr, batch);
+			}
+			if (batch.count > 0) {
+				FragmentOps::processFragments(frameBuffer, state, lights, batch.fragments, batch.count,
+												testDepthEarly || multisampled);
+				if (useHiZ) {
+					frameBuffer.refreshTileDepthBounds(tileX, tileY);
+				}
+			}
+		}
+	}
 }
 
 /**
@@ -594,52 +1234,281 @@ static inline float f20(const VertexData &v0, const VertexData &v1, const Vertex
 void drawFilledTriangle(FrameBuffer &frameBuffer, const glm::vec3 &eyePos, const std::vector<LightSourcePtr> &lights,
 						const VertexData &v0, const VertexData &v1, const VertexData &v2,
 						const glm::mat4 &viewingMatrix) {
-	// Find minimimum and maximum x and y limits for the triangle
-	float xMin = glm::floor(min(v0.position.x, v1.position.x, v2.position.x));
-	float xMax = glm::ceil(max(v0.position.x, v1.position.x, v2.position.x));
-	float yMin = glm::floor(min(v0.position.y, v1.position.y, v2.position.y));
-	float yMax = glm::ceil(max(v0.position.y, v1.position.y, v2.position.y));
-
-	float fAlpha = f12(v0, v1, v2, v0.position.x, v0.position.y);
-	float fBeta = f20(v0, v1, v2, v1.position.x, v1.position.y);
-	float fGamma = f01(v0, v1, v2, v2.position.x, v2.position.y);
-
-	for (float y = yMin; y <= yMax; y++) {
-		for (float x = xMin; x <= xMax; x++) {	
-			// Calculate the weights for Gouraud inperpolation
-			// If any weight is negative, the fragment is not in the triangle
-			float alpha = f12(v0, v1, v2, x, y) / fAlpha;
-			float beta = f20(v0, v1, v2, x, y) / fBeta;
-			float gamma = f01(v0, v1, v2, x, y) / fGamma;
-
-			// Determine if the pixel position is inside the triangle
-			if (alpha >= 0 && beta >= 0 && gamma >= 0) {
-				if ((alpha > 0 || fAlpha * f12(v0, v1, v2, -1, -1) > 0) &&
-					(beta > 0 || fBeta * f20(v0, v1, v2, -1, -1) > 0) &&
-					(gamma > 0 || fGamma * f01(v0, v1, v2, -1, -1) > 0)) {
-
-					Fragment fragment;
-
-					// Interpolate vertex attributes using alpha, beta, and gamma weights
-					fragment.material = barycentricWeighting(alpha, beta, gamma,
-															v0.material, v1.material, v2.material);
-					fragment.worldNormal = barycentricWeighting(alpha, beta, gamma,
-																v0.normal, v1.normal, v2.normal);
-					fragment.worldPosition = barycentricWeighting(alpha, beta, gamma,
-																v0.worldPosition, v1.worldPosition, v2.worldPosition);
-					float z = barycentricWeighting(alpha, beta, gamma,
-													v0.position.z, v1.position.z, v2.position.z);
-					fragment.windowPosition = glm::vec3(x, y, z);
-					FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, viewingMatrix);
-				}
+	drawFilledTriangle(frameBuffer, stateForViewingMatrix(frameBuffer, viewingMatrix), lights, v0, v1, v2);
+}
+
+/**
+ * @fn	static BoundingBoxi scissorToViewport(const RenderState &state, int left, int right, int bottom, int top)
+ * @brief	Intersects a rectangle with the draw's viewport. Triangles in the
+ * 			guard band reach outside the viewport, and are scissored to it here
+ * 			instead of being clipped.
+ * @param	state 	The state of the draw.
+ * @param	left  	The rectangle's left edge.
+ * @param	right 	The rectangle's right edge.
+ * @param	bottom	The rectangle's bottom edge.
+ * @param	top   	The rectangle's top edge.
+ * @return	The scissor rectangle. Empty if they don't overlap.
+ */
+
+static BoundingBoxi scissorToViewport(const RenderState &state, int left, int right, int bottom, int top) {
+	return BoundingBoxi(std::max(left, state.viewport.lx), std::min(right, state.viewport.rx),
+						std::max(bottom, state.viewport.ly), std::min(top, state.viewport.ry));
+}
+
+/**
+ * @fn	void drawFilledTriangle(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, const VertexData &v0, const VertexData &v1, const VertexData &v2)
+ * @brief	Draw filled triangle, at once. Binned triangles are drawn first, to
+ * 			keep draws in order.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	state	   	The state of the draw.
+ * @param 		  	lights	   	Vector of lights in scene.
+ * @param 		  	v0		   	v0.
+ * @param 		  	v1		   	v1.
+ * @param 		  	v2		   	v2.
+ */
+
+void drawFilledTriangle(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights,
+						const VertexData &v0, const VertexData &v1, const VertexData &v2) {
+	flushTriangleBins();
+	BoundingBoxi scissor = scissorToViewport(state, 0, frameBuffer.getWindowWidth() - 1,
+												0, frameBuffer.getWindowHeight() - 1);
+	rasterizeTriangle(frameBuffer, state, lights, v0, v1, v2, scissor);
+}
+
+const int BIN_SHIFT = 6;				//!< log2 of the bin size.
+const int BIN_SIZE = 1 << BIN_SHIFT;	//!< Width and height, in pixels, of a screen bin. A multiple of RASTER_BLOCK_SIZE and TILE_SIZE.
+
+/**
+ * @struct	BinnedDraw
+ * @brief	The state shared by the triangles of one drawManyFilledTriangles call
+ * 			while they wait in the bins.
+ */
+
+struct BinnedDraw {
+	RenderState state;
+	std::vector<LightSourcePtr> lights;
+};
+
+/**
+ * @struct	TriangleBins
+ * @brief	Window coordinate triangles sorted into screen bins. Each bin lists its
+ * 			triangles in submission order, and no two bins share a pixel, so bins
+ * 			can be drawn in parallel with the same result as drawing serially.
+ */
+
+struct TriangleBins {
+	FrameBuffer *frameBuffer;				//!< Framebuffer all pending triangles are drawn into
+	int binsWide, binsHigh;					//!< Number of bin columns and rows
+	std::vector<std::vector<int>> bins;		//!< Per bin, indices of the triangles touching it
+	std::vector<VertexData> vertices;		//!< Vertex triplets of the pending triangles
+	std::vector<int> triangleDraws;			//!< Per triangle, index of its BinnedDraw
+	std::vector<BinnedDraw> draws;			//!< Pending draws. Only the first drawCount are in use; the rest keep their storage for reuse.
+	int drawCount;							//!< Number of pending draws
+	std::vector<int> activeBins;			//!< Scratch: the nonempty bins
+};
+
+static TriangleBins triangleBins = { nullptr, 0, 0 };
+static ThreadPool *rasterThreadPool = nullptr;
+
+/**
+ * @fn	void setParallelRasterization(bool enabled, int threadCount)
+ * @brief	Turns the sort-middle parallel rasterizer on or off. When it is on,
+ * 			drawManyFilledTriangles only sorts triangles into screen bins, and
+ * 			flushTriangleBins draws the bins in parallel. Pending triangles are
+ * 			flushed before the mode changes.
+ * @param	enabled	   	True ==> rasterize in parallel.
+ * @param	threadCount	Number of threads to use. 0 ==> one per hardware thread.
+ */
+
+void setParallelRasterization(bool enabled, int threadCount) {
+	flushTriangleBins();
+	delete rasterThreadPool;
+	rasterThreadPool = enabled ? new ThreadPool(threadCount) : nullptr;
+}
+
+/**
+ * @fn	bool isParallelRasterization()
+ * @brief	Query if the sort-middle parallel rasterizer is on.
+ * @return	True if parallel, false if not.
+ */
+
+bool isParallelRasterization() {
+	return rasterThreadPool != nullptr;
+}
+
+/**
+ * @fn	static void binTriangles(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &vertices)
+ * @brief	Adds triangles to every bin their bounding box overlaps. A copy of the
+ * 			state is kept, so it may change before the bins are flushed.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	state	   	The state of the draw.
+ * @param 		  	lights	   	Vector of lights in scene.
+ * @param 		  	vertices   	The vector of vertice-triplets.
+ */
+
+static void binTriangles(FrameBuffer &frameBuffer, const RenderState &state,
+						const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &vertices) {
+	TriangleBins &tb = triangleBins;
+	const int W = frameBuffer.getWindowWidth(), H = frameBuffer.getWindowHeight();
+	const int binsWide = (W + BIN_SIZE - 1) >> BIN_SHIFT;
+	const int binsHigh = (H + BIN_SIZE - 1) >> BIN_SHIFT;
+	if (tb.frameBuffer != &frameBuffer || tb.binsWide != binsWide || tb.binsHigh != binsHigh) {
+		flushTriangleBins();
+		tb.frameBuffer = &frameBuffer;
+		tb.binsWide = binsWide;
+		tb.binsHigh = binsHigh;
+		tb.bins.assign(binsWide * binsHigh, std::vector<int>());
+	}
+
+	const int drawIndex = tb.drawCount++;
+	if (drawIndex < (int)tb.draws.size()) {
+		tb.draws[drawIndex].state = state;
+		tb.draws[drawIndex].lights.assign(lights.begin(), lights.end());
+	} else {
+		BinnedDraw draw = { state, lights };
+		tb.draws.push_back(draw);
+	}
+
+	for (int i = 0; i < (int)vertices.size() - 2; i += 3) {
+		const glm::vec4 &p0 = vertices[i].position;
+		const glm::vec4 &p1 = vertices[i + 1].position;
+		const glm::vec4 &p2 = vertices[i + 2].position;
+		int xLo = std::max((int)std::floor(std::min({ p0.x, p1.x, p2.x })), std::max(state.viewport.lx, 0));
+		int xHi = std::min((int)std::ceil(std::max({ p0.x, p1.x, p2.x })), std::min(state.viewport.rx, W - 1));
+		int yLo = std::max((int)std::floor(std::min({ p0.y, p1.y, p2.y })), std::max(state.viewport.ly, 0));
+		int yHi = std::min((int)std::ceil(std::max({ p0.y, p1.y, p2.y })), std::min(state.viewport.ry, H - 1));
+		if (xLo > xHi || yLo > yHi) {
+			continue;
+		}
+
+		const int triangle = (int)tb.triangleDraws.size();
+		tb.vertices.push_back(vertices[i]);
+		tb.vertices.push_back(vertices[i + 1]);
+		tb.vertices.push_back(vertices[i + 2]);
+		tb.triangleDraws.push_back(drawIndex);
+		for (int by = yLo >> BIN_SHIFT; by <= yHi >> BIN_SHIFT; by++) {
+			for (int bx = xLo >> BIN_SHIFT; bx <= xHi >> BIN_SHIFT; bx++) {
+				tb.bins[by * binsWide + bx].push_back(triangle);
 			}
 		}
 	}
 }
 
+/**
+ * @fn	void flushTriangleBins()
+ * @brief	Draws every triangle waiting in the bins, one bin per task, and empties
+ * 			the bins. Must be called before the framebuffer is read or shown.
+ */
+
+void flushTriangleBins() {
+	TriangleBins &tb = triangleBins;
+	if (tb.triangleDraws.empty()) {
+		tb.drawCount = 0;
+		return;
+	}
+
+	tb.activeBins.clear();
+	for (int i = 0; i < (int)tb.bins.size(); i++) {
+		if (!tb.bins[i].empty()) {
+			tb.activeBins.push_back(i);
+		}
+	}
+
+	auto drawBin = [&tb](int task) {
+		const int binIndex = tb.activeBins[task];
+		const int bx = (binIndex % tb.binsWide) << BIN_SHIFT;
+		const int by = (binIndex / tb.binsWide) << BIN_SHIFT;
+		const int right = std::min(bx + BIN_SIZE, tb.frameBuffer->getWindowWidth()) - 1;
+		const int top = std::min(by + BIN_SIZE, tb.frameBuffer->getWindowHeight()) - 1;
+		for (int triangle : tb.bins[binIndex]) {
+			const BinnedDraw &draw = tb.draws[tb.triangleDraws[triangle]];
+			const VertexData *v = &tb.vertices[3 * triangle];
+			rasterizeTriangle(*tb.frameBuffer, draw.state, draw.lights, v[0], v[1], v[2],
+								scissorToViewport(draw.state, bx, right, by, top));
+		}
+	};
+	if (rasterThreadPool != nullptr) {
+		rasterThreadPool->parallelFor((int)tb.activeBins.size(), drawBin);
+	} else {
+		for (int i = 0; i < (int)tb.activeBins.size(); i++) {
+			drawBin(i);
+		}
+	}
+
+	for (int binIndex : tb.activeBins) {
+		tb.bins[binIndex].clear();
+	}
+	tb.vertices.clear();
+	tb.triangleDraws.clear();
+	tb.drawCount = 0;
+}
+
+/**
+ * @fn	void shadeGBuffer(FrameBuffer &frameBuffer, const std::vector<LightSourcePtr> &lights, const glm::mat4 &viewingMatrix)
+ * @brief	Deferred lighting pass. Lights every pixel recorded in the framebuffer's
+ * 			G-buffer once, over all the lights, one tile per task when rasterizing
+ * 			in parallel. The cost depends on the visible pixels, not on overdraw.
+ * @param [in,out]	frameBuffer  	Framebuffer, with its G-buffer enabled.
+ * @param 		  	lights		 	Vector of lights in scene.
+ * @param 		  	viewingMatrix	Viewing matrix.
+ */
+
+void shadeGBuffer(FrameBuffer &frameBuffer, const std::vector<LightSourcePtr> &lights,
+					const glm::mat4 &viewingMatrix) {
+	flushTriangleBins();
+	if (!frameBuffer.hasGBuffer()) {
+		return;
+	}
+	const Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
+	const LightTiles *tiles = FragmentOps::currentLightTiles(frameBuffer, viewingMatrix, lights);
+	const int tilesWide = frameBuffer.getTilesWide();
+	auto shadeTile = [&](int task) {
+		FragmentOps::shadeGBufferTile(frameBuffer, lights, tiles, eyeFrame, task % tilesWide, task / tilesWide);
+	};
+	const int tileCount = tilesWide * frameBuffer.getTilesHigh();
+	if (rasterThreadPool != nullptr) {
+		rasterThreadPool->parallelFor(tileCount, shadeTile);
+	} else {
+		for (int i = 0; i < tileCount; i++) {
+			shadeTile(i);
+		}
+	}
+}
+
+/**
+ * @fn	void compositeTransparency(FrameBuffer &frameBuffer)
+ * @brief	Composites the transparent fragments gathered for order-independent
+ * 			transparency over the framebuffer's colors, one tile per task when
+ * 			rasterizing in parallel. Call once the frame's geometry is drawn, and
+ * 			after shadeGBuffer when rendering deferred. K-buffer layers behind
+ * 			the opaque depth are dropped here, but weighted blended fragments
+ * 			are not, so with WEIGHTED_BLENDED_TRANSPARENCY opaque geometry must
+ * 			be drawn before the transparent draws.
+ * @param [in,out]	frameBuffer	Framebuffer, with its transparency buffers enabled.
+ */
+
+void compositeTransparency(FrameBuffer &frameBuffer) {
+	flushTriangleBins();
+	if (!frameBuffer.hasTransparencyBuffers()) {
+		return;
+	}
+	const int tilesWide = frameBuffer.getTilesWide();
+	auto compositeTile = [&](int task) {
+		frameBuffer.compositeTransparencyTile(task % tilesWide, task / tilesWide);
+	};
+	const int tileCount = tilesWide * frameBuffer.getTilesHigh();
+	if (rasterThreadPool != nullptr) {
+		rasterThreadPool->parallelFor(tileCount, compositeTile);
+	} else {
+		for (int i = 0; i < tileCount; i++) {
+			compositeTile(i);
+		}
+	}
+}
+
 /**
  * @fn	void drawManyFilledTriangles(FrameBuffer &frameBuffer, const glm::vec3 &eyePos, const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &vertices, const glm::mat4 &viewingMatrix)
- * @brief	Draw many filled triangles,
+ * @brief	Draw many filled triangles, with the current FragmentOps settings.
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
@@ -650,10 +1519,26 @@ void drawFilledTriangle(FrameBuffer &frameBuffer, const glm::vec3 &eyePos, const
 void drawManyFilledTriangles(FrameBuffer &frameBuffer, const glm::vec3 &eyePos, 
 							const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &vertices,
 							const glm::mat4 &viewingMatrix) {
+	drawManyFilledTriangles(frameBuffer, stateForViewingMatrix(frameBuffer, viewingMatrix), lights, vertices);
+}
+
+/**
+ * @fn	void drawManyFilledTriangles(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &vertices)
+ * @brief	Draw many filled triangles. With parallel rasterization on, the triangles
+ * 			are only binned, and are drawn by the next flushTriangleBins.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	state	   	The state of the draw.
+ * @param 		  	lights	   	Vector of lights in scene.
+ * @param 		  	vertices   	The vector of vertice-triplets.
+ */
+
+void drawManyFilledTriangles(FrameBuffer &frameBuffer, const RenderState &state,
+							const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &vertices) {
+	if (isParallelRasterization()) {
+		binTriangles(frameBuffer, state, lights, vertices);
+		return;
+	}
 	for (int i = 0; i < (int)vertices.size() - 2; i += 3) {
-		const VertexData &Vi = vertices[i];
-		const VertexData &Vi1 = vertices[i+1];
-		const VertexData &Vi2 = vertices[i+2];
-		drawFilledTriangle(frameBuffer, eyePos, lights, Vi, Vi1, Vi2, viewingMatrix);
+		drawFilledTriangle(frameBuffer, state, lights, vertices[i], vertices[i + 1], vertices[i + 2]);
 	}
-}
\ No newline at end of file
+}
@@ -4,6 +4,23 @@
 #include "FragmentOps.h"
 #include "VertexData.h"
 
+/**
+ * @enum	RasterKernel
+ * @brief	The implementations drawFilledTriangle can use for each block of pixels.
+ */
+
+enum RasterKernel { SCALAR_RASTER_KERNEL, AVX2_RASTER_KERNEL };
+
+bool cpuSupportsAVX2();
+void setRasterKernel(RasterKernel kernel);
+RasterKernel getRasterKernel();
+void setParallelRasterization(bool enabled, int threadCount = 0);
+bool isParallelRasterization();
+void flushTriangleBins();
+void compositeTransparency(FrameBuffer &frameBuffer);
+void shadeGBuffer(FrameBuffer &frameBuffer, const std::vector<LightSourcePtr> &lights,
+					const glm::mat4 &viewingMatrix);
+
 void drawAxisOnWindow(FrameBuffer &frameBuffer);
 void drawWirePolygon(FrameBuffer &frameBuffer, const std::vector<glm::vec3> &pts, const color &rgb);
 void drawLine(FrameBuffer &frameBuffer, int x1, int y1, int x2, int y2, const color &C);
@@ -15,15 +32,21 @@ void drawLine(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
 void drawManyLines(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
 					const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &vertices,
 					const glm::mat4 &viewingMatrix);
+void drawManyLines(FrameBuffer &frameBuffer, const RenderState &state,
+					const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &vertices);
 void drawWireFrameTriangle(FrameBuffer &frameBuffer, const glm::vec3 &eyePos, const std::vector<LightSourcePtr> &lights, const VertexData &v0, const VertexData &v1, const VertexData &v2,
 							const glm::mat4 &viewingMatrix);
-void drawFilledTriangle(FrameBuffer &frameBuffer, const glm::vec3 &eyePos, std::vector<LightSourcePtr> &lights, const VertexData &v0, const VertexData &v1, const VertexData &v2,
+void drawFilledTriangle(FrameBuffer &frameBuffer, const glm::vec3 &eyePos, const std::vector<LightSourcePtr> &lights, const VertexData &v0, const VertexData &v1, const VertexData &v2,
 						const glm::mat4 &viewingMatrix);
+void drawFilledTriangle(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights,
+						const VertexData &v0, const VertexData &v1, const VertexData &v2);
 void drawManyWireFrameTriangles(FrameBuffer &frameBuffer, const glm::vec3 &eyePos, 
 								const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &vertices,
 								const glm::mat4 &viewingMatrix);
 void drawManyFilledTriangles(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
 							const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &vertices,
 								const glm::mat4 &viewingMatrix);
+void drawManyFilledTriangles(FrameBuffer &frameBuffer, const RenderState &state,
+							const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &vertices);
 void drawArc(FrameBuffer &fb, const glm::vec2 &center, float R,
 	float startRads, float lengthInRads, const color &rgb);
@@ -51,7 +51,8 @@ void RayTracer::raytraceScene(FrameBuffer &frameBuffer, int depth,
 
 /**
  * @fn	color RayTracer::traceIndividualRay(const Ray &ray, const IScene &theScene, int recursionLevel) const
- * @brief	Trace an individual ray.
+ * @brief	Trace an individual ray. Shadows come from shadow rays, or from the
+ * 			light's shadow map if it has one in shadowMaps.
  * @param	ray			  	The ray.
  * @param	theScene	  	The scene.
  * @param	recursionLevel	The recursion level.
@@ -65,34 +66,41 @@ color RayTracer::traceIndividualRay(const Ray &ray, const IScene &theScene, int
 	glm::vec3 offsetpoint = IShape::movePointOffSurface(theHit.interceptPoint, theHit.surfaceNormal);
 
 	if (theHit.t < FLT_MAX) {
+		const Material &material = MaterialTable::get(theHit.materialID);
 
 		for (int i = 0; i < theScene.lights.size(); i++) {//theScene.lights.size()
-			Ray shadowR(offsetpoint, glm::normalize(theScene.lights[i]->lightPosition - offsetpoint));
-			HitRecord shadow = VisibleIShape::findIntersection(shadowR, theScene.visibleObjects);
-			bool inShadow = false;
+			const ShadowMap *shadowMap = ShadowMap::find(shadowMaps, theScene.lights[i]);
+			float visibility = 1.0f;
 			Frame f(ray.origin, theScene.camera->cameraFrame.u, theScene.camera->cameraFrame.v, 
 				theScene.camera->cameraFrame.w);
 
-			if (shadow.t < FLT_MAX && shadow.material.alpha == 1.0f) {
-				inShadow = true;
+			if (shadowMap != nullptr) {
+				visibility = shadowMap->visibility(theHit.interceptPoint, theHit.surfaceNormal);
+			}
+			else {
+				Ray shadowR(offsetpoint, glm::normalize(theScene.lights[i]->lightPosition - offsetpoint));
+				HitRecord shadow = VisibleIShape::findIntersection(shadowR, theScene.visibleObjects);
+				if (shadow.t < FLT_MAX && MaterialTable::get(shadow.materialID).alpha == 1.0f) {
+					visibility = 0.0f;
+				}
 			}
 
 			if (theHit.texture != nullptr) {  // if object has a texture, use it
 				float u = glm::clamp(theHit.u, 0.0f, 1.0f);
 				float v = glm::clamp(theHit.v, 0.0f, 1.0f);
-				result += theHit.texture->getPixel(u, v) * theScene.lights[i]->illuminate(theHit.interceptPoint, 
-					theHit.surfaceNormal, theHit.material, f, inShadow);
+				result += theHit.texture->getPixel(u, v) * illuminateWithVisibility(*theScene.lights[i], 
+					theHit.interceptPoint, theHit.surfaceNormal, material, f, visibility);
 			}
 			else {
 
-				if (theHit.material.alpha < 1.0f) {
-					result += theHit.material.alpha * theScene.lights[i]->illuminate(theHit.interceptPoint, 
-						theHit.surfaceNormal, theHit.material, f, inShadow) + (1 - theHit.material.alpha) * 
+				if (material.alpha < 1.0f) {
+					result += material.alpha * illuminateWithVisibility(*theScene.lights[i], theHit.interceptPoint, 
+						theHit.surfaceNormal, material, f, visibility) + (1 - material.alpha) * 
 						traceIndividualRay(Ray(theHit.interceptPoint, ray.direction), theScene, recursionLevel);
 				}
 				else {
-					result += theScene.lights[i]->illuminate(theHit.interceptPoint, theHit.surfaceNormal, 
-						theHit.material, f, inShadow);
+					result += illuminateWithVisibility(*theScene.lights[i], theHit.interceptPoint, 
+						theHit.surfaceNormal, material, f, visibility);
 				}
 				
 			}
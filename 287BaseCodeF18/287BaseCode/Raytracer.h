@@ -4,6 +4,7 @@
 #include "FrameBuffer.h"
 #include "Camera.h"
 #include "IScene.h"
+#include "ShadowMap.h"
 
 /**
  * @struct	RayTracer
@@ -12,6 +13,7 @@
 
 struct RayTracer {
 	color defaultColor;
+	std::vector<const ShadowMap *> shadowMaps;	//!< Lights with a shadow map use it instead of shadow rays. For fast previews. Unlike shadow rays, a map is fully blocked by transparent (alpha < 1) objects drawn into it, so leave those out of its casters.
 	RayTracer(const color &defaultColor);
 	void raytraceScene(FrameBuffer &frameBuffer, int depth,
 						const IScene &theScene) const;
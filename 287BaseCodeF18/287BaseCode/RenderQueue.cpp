@@ -0,0 +1,187 @@
+#include <algorithm>
+#include "RenderQueue.h"
+#include "VertexOps.h"
+
+/**
+ * @fn	void RenderQueue::submit(const IndexedMesh &mesh, const std::vector<LightSourcePtr> &lights, const glm::mat4 &TM)
+ * @brief	Queues an indexed mesh.
+ * @param	mesh  	The mesh.
+ * @param	lights	The lights.
+ * @param	TM	  	The modeling transformation.
+ */
+
+void RenderQueue::submit(const IndexedMesh &mesh, const std::vector<LightSourcePtr> &lights, const glm::mat4 &TM) {
+	DrawCommand draw(VertexOps::currentState(TM));
+	draw.mesh = &mesh;
+	draw.lights = &lights;
+	draw.bounds = mesh.bounds;
+	enqueue(draw);
+}
+
+/**
+ * @fn	void RenderQueue::submit(const StaticMesh &mesh, const std::vector<LightSourcePtr> &lights)
+ * @brief	Queues a static mesh, drawn from its cached world space vertices.
+ * @param	mesh  	The mesh.
+ * @param	lights	The lights.
+ */
+
+void RenderQueue::submit(const StaticMesh &mesh, const std::vector<LightSourcePtr> &lights) {
+	DrawCommand draw(VertexOps::currentState(glm::mat4(1.0f)));
+	draw.mesh = &mesh.worldMesh();
+	draw.worldSpace = true;
+	draw.lights = &lights;
+	draw.bounds = draw.mesh->bounds;
+	enqueue(draw);
+}
+
+/**
+ * @fn	void RenderQueue::submit(const std::vector<VertexData> &triangles, const std::vector<LightSourcePtr> &lights, const glm::mat4 &TM)
+ * @brief	Queues a list of triangles.
+ * @param	triangles	The vertices, where each successive triplet is a triangle.
+ * @param	lights   	The lights.
+ * @param	TM		 	The modeling transformation.
+ */
+
+void RenderQueue::submit(const std::vector<VertexData> &triangles, const std::vector<LightSourcePtr> &lights,
+							const glm::mat4 &TM) {
+	DrawCommand draw(VertexOps::currentState(TM));
+	draw.triangles = &triangles;
+	draw.lights = &lights;
+	draw.bounds = ObjectBounds(triangles);
+	enqueue(draw);
+}
+
+/**
+ * @fn	void RenderQueue::enqueue(DrawCommand &draw)
+ * @brief	Culls a draw against the view volume, then finds its depth and state
+ * 			group and adds it to the queue.
+ * @param [in,out]	draw	The draw.
+ */
+
+void RenderQueue::enqueue(DrawCommand &draw) {
+	if (VertexOps::isOutsideViewVolume(draw.state, draw.bounds)) {
+		return;
+	}
+	const glm::vec4 center = draw.state.modelMatrix * glm::vec4(draw.bounds.center, 1.0f);
+	draw.depth = -(draw.state.viewingMatrix * center).z;
+
+	draw.stateGroup = (int)stateLeaders.size();
+	for (int i = 0; i < (int)stateLeaders.size(); i++) {
+		if (sameState(draws[stateLeaders[i]], draw)) {
+			draw.stateGroup = i;
+			break;
+		}
+	}
+	if (draw.stateGroup == (int)stateLeaders.size()) {
+		stateLeaders.push_back((int)draws.size());
+	}
+	draws.push_back(draw);
+}
+
+/**
+ * @fn	bool RenderQueue::sameState(const DrawCommand &a, const DrawCommand &b)
+ * @brief	Tests if two draws can share a batch: everything past the vertex
+ * 			stage must match. The modeling transformation may differ, since
+ * 			it is applied per draw as the batch is built.
+ * @param	a	The first draw.
+ * @param	b	The second draw.
+ * @return	True iff the draws can be batched together.
+ */
+
+bool RenderQueue::sameState(const DrawCommand &a, const DrawCommand &b) {
+	const RenderState &s = a.state, &t = b.state;
+	return *a.lights == *b.lights &&
+			s.viewingMatrix == t.viewingMatrix && s.projectionMatrix == t.projectionMatrix &&
+			s.viewport.lx == t.viewport.lx && s.viewport.rx == t.viewport.rx &&
+			s.viewport.ly == t.viewport.ly && s.viewport.ry == t.viewport.ry &&
+			s.performDepthTest == t.performDepthTest && s.readonlyDepthBuffer == t.readonlyDepthBuffer &&
+			s.readonlyColorBuffer == t.readonlyColorBuffer && s.earlyDepthTest == t.earlyDepthTest &&
+			s.performBlending == t.performBlending && s.transparency == t.transparency &&
+			s.perVertexLighting == t.perVertexLighting &&
+			s.fogParams.type == t.fogParams.type && s.fogParams.start == t.fogParams.start &&
+			s.fogParams.end == t.fogParams.end && s.fogParams.density == t.fogParams.density &&
+			s.fogParams.color == t.fogParams.color;
+}
+
+/**
+ * @fn	int RenderQueue::flush(FrameBuffer &frameBuffer)
+ * @brief	Draws and empties the queue. Opaque draws are sorted by state group
+ * 			and then front to back; blended draws follow. Those gathered for
+ * 			order-independent transparency are only grouped by state; the rest
+ * 			come last, strictly back to front, so only neighbours sharing a state
+ * 			are batched.
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @return	The number of batches drawn.
+ */
+
+int RenderQueue::flush(FrameBuffer &frameBuffer) {
+	order.resize(draws.size());
+	for (int i = 0; i < (int)draws.size(); i++) {
+		order[i] = i;
+	}
+	auto firstBlended = std::stable_partition(order.begin(), order.end(),
+												[this](int i) { return !draws[i].state.performBlending; });
+	std::sort(order.begin(), firstBlended, [this](int i, int j) {
+		const DrawCommand &a = draws[i], &b = draws[j];
+		return a.stateGroup != b.stateGroup ? a.stateGroup < b.stateGroup : a.depth < b.depth;
+	});
+	std::stable_sort(firstBlended, order.end(), [this, &frameBuffer](int i, int j) {
+		const DrawCommand &a = draws[i], &b = draws[j];
+		const bool aUnordered = FragmentOps::isOrderIndependent(frameBuffer, a.state);
+		const bool bUnordered = FragmentOps::isOrderIndependent(frameBuffer, b.state);
+		if (aUnordered != bUnordered) {
+			return aUnordered;
+		}
+		return aUnordered ? a.stateGroup < b.stateGroup : a.depth > b.depth;
+	});
+
+	int batches = 0;
+	for (int start = 0; start < (int)order.size(); ) {
+		int end = start + 1;
+		while (end < (int)order.size() && draws[order[end]].stateGroup == draws[order[start]].stateGroup) {
+			end++;
+		}
+		drawBatch(frameBuffer, &order[start], end - start);
+		batches++;
+		start = end;
+	}
+	clear();
+	return batches;
+}
+
+/**
+ * @fn	void RenderQueue::drawBatch(FrameBuffer &frameBuffer, const int order[], int count)
+ * @brief	Runs draws sharing a state through the vertex stage, each with its
+ * 			own modeling transformation, and rasterizes the triangles together.
+ * 			Draws hidden behind earlier batches are skipped.
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	order	   	Indices of the draws.
+ * @param 		  	count	   	The number of draws.
+ */
+
+void RenderQueue::drawBatch(FrameBuffer &frameBuffer, const int order[], int count) {
+	VertexOps::arena.windowCoords.clear();
+	for (int i = 0; i < count; i++) {
+		const DrawCommand &draw = draws[order[i]];
+		if (VertexOps::isOccluded(frameBuffer, draw.state, draw.bounds)) {
+			continue;
+		}
+		if (draw.mesh != nullptr) {
+			VertexOps::appendIndexedTriangles(draw.state, *draw.lights, *draw.mesh, draw.worldSpace);
+		} else {
+			VertexOps::appendTriangleVertices(draw.state, *draw.lights, *draw.triangles);
+		}
+	}
+	const DrawCommand &first = draws[order[0]];
+	drawManyFilledTriangles(frameBuffer, first.state, *first.lights, VertexOps::arena.windowCoords);
+}
+
+/**
+ * @fn	void RenderQueue::clear()
+ * @brief	Empties the queue without drawing.
+ */
+
+void RenderQueue::clear() {
+	draws.clear();
+	stateLeaders.clear();
+}
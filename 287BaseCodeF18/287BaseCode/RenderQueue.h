@@ -0,0 +1,57 @@
+#pragma once
+#include <vector>
+#include "IndexedMesh.h"
+#include "StaticMesh.h"
+#include "FrameBuffer.h"
+#include "Light.h"
+#include "RenderState.h"
+
+/**
+ * @struct	DrawCommand
+ * @brief	One object waiting in a RenderQueue. Exactly one of mesh and
+ * 			triangles is set. The queue keeps pointers, so the geometry and
+ * 			lights must outlive the flush.
+ */
+
+struct DrawCommand {
+	const IndexedMesh *mesh;					//!< The mesh, or nullptr.
+	bool worldSpace;							//!< True ==> mesh is a StaticMesh's world space mesh.
+	const std::vector<VertexData> *triangles;	//!< The triangle list, or nullptr.
+	const std::vector<LightSourcePtr> *lights;	//!< The lights.
+	ObjectBounds bounds;						//!< The object's bounds, in object coordinates.
+	RenderState state;							//!< Settings captured when the draw was submitted.
+	float depth;								//!< Eye distance to the bounds' center, along the view direction.
+	int stateGroup;								//!< Draws with equal groups can share a batch.
+	DrawCommand(const RenderState &state) : mesh(nullptr), worldSpace(false), triangles(nullptr), lights(nullptr),
+											state(state), depth(0.0f), stateGroup(0) {}
+};
+
+/**
+ * @class	RenderQueue
+ * @brief	Defers draws so they can be sorted and batched. submit() captures
+ * 			the current VertexOps and FragmentOps settings, like VertexOps::render,
+ * 			and culls objects outside the view volume. flush() draws opaque
+ * 			objects grouped by state and front to back within a state, for early
+ * 			depth rejection, and then blended objects: back to front, unless
+ * 			they use order-independent transparency. Each run of draws sharing
+ * 			a state goes through the vertex stage into one batch of triangles,
+ * 			which is rasterized with a single call.
+ */
+
+class RenderQueue {
+	public:
+		void submit(const IndexedMesh &mesh, const std::vector<LightSourcePtr> &lights, const glm::mat4 &TM);
+		void submit(const StaticMesh &mesh, const std::vector<LightSourcePtr> &lights);
+		void submit(const std::vector<VertexData> &triangles, const std::vector<LightSourcePtr> &lights,
+					const glm::mat4 &TM);
+		int flush(FrameBuffer &frameBuffer);
+		int size() const { return (int)draws.size(); }
+		void clear();
+	protected:
+		static bool sameState(const DrawCommand &a, const DrawCommand &b);
+		void enqueue(DrawCommand &draw);
+		void drawBatch(FrameBuffer &frameBuffer, const int order[], int count);
+		std::vector<DrawCommand> draws;			//!< The draws, in submission order.
+		std::vector<int> stateLeaders;			//!< Per state group, the index of its first draw.
+		std::vector<int> order;					//!< Draw order, rebuilt by each flush.
+};
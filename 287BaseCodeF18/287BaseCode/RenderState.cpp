@@ -0,0 +1,40 @@
+#include "RenderState.h"
+#include "VertexOps.h"
+
+/**
+ * @fn	RenderState::RenderState(const glm::mat4 &modelMatrix, const glm::mat4 &viewingMatrix, const glm::mat4 &projectionMatrix, const BoundingBoxi &viewport)
+ * @brief	Captures the state for one draw. The matrices are taken from the
+ * 			arguments; the flags and fog settings are copied from the current
+ * 			VertexOps and FragmentOps settings, and may be changed before the
+ * 			state is handed to the pipeline.
+ * @param	modelMatrix			The modeling transformation.
+ * @param	viewingMatrix   	The viewing transformation.
+ * @param	projectionMatrix	The projection transformation.
+ * @param	viewport			The window area drawn into.
+ */
+
+RenderState::RenderState(const glm::mat4 &modelMatrix, const glm::mat4 &viewingMatrix,
+							const glm::mat4 &projectionMatrix, const BoundingBoxi &viewport)
+	: modelMatrix(modelMatrix), viewingMatrix(viewingMatrix), projectionMatrix(projectionMatrix),
+	viewport(viewport) {
+	viewportMatrix = T((float)viewport.lx, (float)viewport.ly, 0.0f) *
+					S((float)viewport.width() / VertexOps::ndc.width(),
+						(float)viewport.height() / VertexOps::ndc.height(), 1.0f) *
+					T(-VertexOps::ndc.lx, -VertexOps::ndc.ly, 0.0f);
+	viewProjectionMatrix = projectionMatrix * viewingMatrix;
+	modelViewProjectionMatrix = viewProjectionMatrix * modelMatrix;
+	normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelMatrix)));
+	inverseViewingMatrix = glm::inverse(viewingMatrix);
+	eyePosition = inverseViewingMatrix[3].xyz;
+	eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
+
+	renderBackFaces = VertexOps::renderBackFaces;
+	perVertexLighting = VertexOps::perVertexLighting;
+	performDepthTest = FragmentOps::performDepthTest;
+	readonlyDepthBuffer = FragmentOps::readonlyDepthBuffer;
+	readonlyColorBuffer = FragmentOps::readonlyColorBuffer;
+	earlyDepthTest = FragmentOps::earlyDepthTest;
+	performBlending = FragmentOps::performBlending;
+	transparency = FragmentOps::transparency;
+	fogParams = FragmentOps::fogParams;
+}
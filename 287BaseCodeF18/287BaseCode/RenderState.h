@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Defs.h"
+#include "ColorAndMaterials.h"
+
+/**
+ * @enum	fogType
+ * @brief	Represents the different types of fog processing.
+ */
+
+enum fogType { NO_FOG, LINEAR_FOG, EXPONENTIAL_FOG, EXPONENTIAL_2_FOG };
+
+/**
+ * @enum	transparencyType
+ * @brief	How blended fragments are combined. SORTED_TRANSPARENCY blends each
+ * 			fragment into the color buffer as it arrives, so it is only right if
+ * 			the geometry is drawn back to front. The others gather fragments in
+ * 			the framebuffer's transparency buffers, in any order, to be
+ * 			composited afterward: weighted blended is approximate but constant
+ * 			cost, the k-buffer is exact up to K_BUFFER_LAYERS layers per pixel.
+ * 			Weighted blended fragments keep no depth, so they are only hidden by
+ * 			opaque geometry drawn before them; draw everything opaque first.
+ */
+
+enum transparencyType { SORTED_TRANSPARENCY, WEIGHTED_BLENDED_TRANSPARENCY, K_BUFFER_TRANSPARENCY };
+
+/**
+ * @struct	FogParams
+ * @brief	A fog parameters.
+ */
+
+struct FogParams {
+	float start, end, density;
+	fogType type;
+	color color;
+	float fogFactor(const glm::vec3 &fragPos, const glm::vec3 &eyePos) const;
+};
+
+/**
+ * @struct	RenderState
+ * @brief	Everything one draw needs from the pipeline's settings, captured when
+ * 			the draw is submitted. The combined matrices, their inverses and the
+ * 			eye's frame are computed once here instead of per vertex or fragment.
+ * 			The pipeline only ever sees a RenderState by const reference, so
+ * 			draws can be in flight while the VertexOps and FragmentOps settings
+ * 			change for the next one.
+ */
+
+struct RenderState {
+	glm::mat4 modelMatrix;				//!< Object to world.
+	glm::mat4 viewingMatrix;			//!< World to eye.
+	glm::mat4 projectionMatrix;			//!< Eye to clip.
+	glm::mat4 viewportMatrix;			//!< NDC to window.
+	glm::mat4 viewProjectionMatrix;		//!< World to clip.
+	glm::mat4 modelViewProjectionMatrix;	//!< Object to clip.
+	glm::mat3 normalMatrix;				//!< Object to world, for normals. The inverse transpose of the model matrix.
+	glm::mat4 inverseViewingMatrix;		//!< Eye to world.
+	glm::vec3 eyePosition;				//!< The eye's position in world coordinates.
+	Frame eyeFrame;						//!< The eye's frame.
+	BoundingBoxi viewport;				//!< The window area drawn into.
+	bool renderBackFaces;				//!< Snapshot of VertexOps::renderBackFaces.
+	bool perVertexLighting;				//!< Snapshot of VertexOps::perVertexLighting.
+	bool performDepthTest;				//!< Snapshot of FragmentOps::performDepthTest.
+	bool readonlyDepthBuffer;			//!< Snapshot of FragmentOps::readonlyDepthBuffer.
+	bool readonlyColorBuffer;			//!< Snapshot of FragmentOps::readonlyColorBuffer.
+	bool earlyDepthTest;				//!< Snapshot of FragmentOps::earlyDepthTest.
+	bool performBlending;				//!< Snapshot of FragmentOps::performBlending.
+	transparencyType transparency;		//!< Snapshot of FragmentOps::transparency.
+	FogParams fogParams;				//!< Snapshot of FragmentOps::fogParams.
+	RenderState(const glm::mat4 &modelMatrix, const glm::mat4 &viewingMatrix,
+				const glm::mat4 &projectionMatrix, const BoundingBoxi &viewport);
+};
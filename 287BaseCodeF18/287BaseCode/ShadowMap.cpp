@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <cmath>
+#include "ShadowMap.h"
+#include "VertexOps.h"
+
+int ShadowMap::pcfRadius = 1;
+float ShadowMap::normalOffset = 1.5f;
+float ShadowMap::depthBias = 1.0f;
+
+/**
+ * @fn	ShadowMap::ShadowMap(const PositionalLight &light, int resolution, float nearPlane, float farPlane)
+ * @brief	Constructs a shadow map for a light. Nothing is in shadow until the
+ * 			map is rendered.
+ * @param	light	  	The light.
+ * @param	resolution	Width and height, in texels, of each face.
+ * @param	nearPlane 	Casters closer than this to the light are ignored.
+ * @param	farPlane  	Casters and points farther than this from the light are ignored.
+ */
+
+ShadowMap::ShadowMap(const PositionalLight &light, int resolution, float nearPlane, float farPlane)
+	: light(&light), resolution(resolution), nearPlane(nearPlane), farPlane(farPlane),
+	tanHalfFov(1.0f), target(resolution, resolution) {
+	setUpFaces();
+}
+
+/**
+ * @fn	void ShadowMap::setUpFaces()
+ * @brief	Points the faces and sets their projection, from the light's current
+ * 			position, direction and cone. Each face's field of view is widened so
+ * 			the PCF block around any point it is used for stays on the face.
+ */
+
+void ShadowMap::setUpFaces() {
+	const glm::vec3 CUBE_AXES[CUBE_FACES] = { X_AXIS, -X_AXIS, Y_AXIS, -Y_AXIS, Z_AXIS, -Z_AXIS };
+	const float margin = std::max(1.0f - 2.0f * (pcfRadius + 1) / (resolution - 1), 0.5f);
+	const SpotLight *spot = dynamic_cast<const SpotLight *>(light);
+	if (spot != nullptr && spot->fov <= MAX_SPOT_MAP_FOV) {
+		faces.resize(1);
+		faces[0].forward = glm::normalize(spot->spotDirection);
+		tanHalfFov = std::tan(spot->fov / 2.0f) / margin;
+	} else {
+		faces.resize(CUBE_FACES);
+		for (int i = 0; i < CUBE_FACES; i++) {
+			faces[i].forward = CUBE_AXES[i];
+		}
+		tanHalfFov = 1.0f / margin;
+	}
+	const glm::mat4 projection = glm::perspective(2.0f * std::atan(tanHalfFov), 1.0f, nearPlane, farPlane);
+	for (ShadowMapFace &face : faces) {
+		const glm::vec3 up = std::abs(face.forward.y) > 0.99f ? Z_AXIS : Y_AXIS;
+		face.viewingMatrix = glm::lookAt(light->lightPosition, light->lightPosition + face.forward, up);
+		face.projectionMatrix = projection;
+	}
+}
+
+/**
+ * @fn	void ShadowMap::render(const std::function<void(FrameBuffer &)> &drawCasters)
+ * @brief	Renders the map from the light's current position. For each face, the
+ * 			pipeline is set to look out from the light, with color writes and
+ * 			blending off, and drawCasters is called to draw whatever should cast
+ * 			shadows into the framebuffer it is given. Back faces are drawn, so
+ * 			open surfaces cast shadows from both sides. The pipeline's settings
+ * 			are restored afterward.
+ * @param	drawCasters	Draws the shadow casters, with VertexOps, into its argument.
+ */
+
+void ShadowMap::render(const std::function<void(FrameBuffer &)> &drawCasters) {
+	setUpFaces();
+	const glm::mat4 modeling = VertexOps::modelingTransformation;
+	const glm::mat4 viewing = VertexOps::viewingTransformation;
+	const glm::mat4 projection = VertexOps::projectionTransformation;
+	const BoundingBoxi viewport = VertexOps::viewport;
+	const bool backFaces = VertexOps::renderBackFaces;
+	const bool vertexLighting = VertexOps::perVertexLighting;
+	const bool depthTest = FragmentOps::performDepthTest;
+	const bool readonlyDepth = FragmentOps::readonlyDepthBuffer;
+	const bool readonlyColor = FragmentOps::readonlyColorBuffer;
+	const bool blending = FragmentOps::performBlending;
+
+	VertexOps::renderBackFaces = true;
+	VertexOps::perVertexLighting = false;
+	FragmentOps::performDepthTest = true;
+	FragmentOps::readonlyDepthBuffer = false;
+	FragmentOps::readonlyColorBuffer = true;
+	FragmentOps::performBlending = false;
+	VertexOps::setViewport(0, resolution - 1, 0, resolution - 1);
+
+	// Window depths are NDC z, -1 at the near plane and 1 at the far one
+	const float depthScale = 2.0f * nearPlane * farPlane;
+	const float depthSum = farPlane + nearPlane, depthRange = farPlane - nearPlane;
+	for (ShadowMapFace &face : faces) {
+		VertexOps::viewingTransformation = face.viewingMatrix;
+		VertexOps::projectionTransformation = face.projectionMatrix;
+		face.lightMatrix = VertexOps::viewportTransformation * face.projectionMatrix * face.viewingMatrix;
+		target.clearColorAndDepthBuffers();
+		drawCasters(target);
+		flushTriangleBins();
+		face.depths.resize(resolution * resolution);
+		for (int y = 0; y < resolution; y++) {
+			for (int x = 0; x < resolution; x++) {
+				face.depths[y * resolution + x] = depthScale / (depthSum - target.getDepth(x, y) * depthRange);
+			}
+		}
+	}
+
+	VertexOps::modelingTransformation = modeling;
+	VertexOps::viewingTransformation = viewing;
+	VertexOps::projectionTransformation = projection;
+	VertexOps::setViewport(viewport);
+	VertexOps::renderBackFaces = backFaces;
+	VertexOps::perVertexLighting = vertexLighting;
+	FragmentOps::performDepthTest = depthTest;
+	FragmentOps::readonlyDepthBuffer = readonlyDepth;
+	FragmentOps::readonlyColorBuffer = readonlyColor;
+	FragmentOps::performBlending = blending;
+}
+
+/**
+ * @fn	int ShadowMap::faceOf(const glm::vec3 &toPoint) const
+ * @brief	Finds the face a direction from the light falls on: the cube face of
+ * 			its major axis, or the only face.
+ * @param	toPoint	The direction, from the light.
+ * @return	The face's index.
+ */
+
+int ShadowMap::faceOf(const glm::vec3 &toPoint) const {
+	if (!isCubeMap()) {
+		return 0;
+	}
+	const glm::vec3 a = glm::abs(toPoint);
+	if (a.x >= a.y && a.x >= a.z) {
+		return toPoint.x > 0.0f ? 0 : 1;
+	} else if (a.y >= a.z) {
+		return toPoint.y > 0.0f ? 2 : 3;
+	}
+	return toPoint.z > 0.0f ? 4 : 5;
+}
+
+/**
+ * @fn	float ShadowMap::visibility(const glm::vec3 &position, const glm::vec3 &normal) const
+ * @brief	Determines how much of the light reaches a surface point. The point is
+ * 			moved normalOffset texels along its normal, toward the light, and
+ * 			compared with the block of texels around where it lands. Safe to call
+ * 			from several threads at once.
+ * @param	position	The surface point, in world coordinates.
+ * @param	normal  	The surface normal, in world coordinates.
+ * @return	The fraction of the texels the point is in front of: 0 ==> in shadow,
+ * 			1 ==> lit. Points the map does not reach are lit.
+ */
+
+float ShadowMap::visibility(const glm::vec3 &position, const glm::vec3 &normal) const {
+	const glm::vec3 toPoint = position - light->lightPosition;
+	const float depth = glm::dot(toPoint, faces[faceOf(toPoint)].forward);
+	if (faces[0].depths.empty() || depth <= nearPlane || depth >= farPlane) {
+		return 1.0f;
+	}
+	const float texel = 2.0f * depth * tanHalfFov / (resolution - 1);
+	const glm::vec3 n = glm::dot(normal, toPoint) > 0.0f ? -normal : normal;
+	const glm::vec3 offset = toPoint + glm::normalize(n) * (normalOffset * texel);
+	const ShadowMapFace &face = faces[faceOf(offset)];
+	const float offsetDepth = glm::dot(offset, face.forward);
+	if (offsetDepth <= nearPlane) {
+		return 1.0f;
+	}
+	const glm::vec4 window = face.lightMatrix * glm::vec4(light->lightPosition + offset, 1.0f);
+	const int centerX = (int)std::lround(window.x / window.w);
+	const int centerY = (int)std::lround(window.y / window.w);
+	const float nearest = offsetDepth - depthBias * texel;
+	int lit = 0;
+	for (int y = centerY - pcfRadius; y <= centerY + pcfRadius; y++) {
+		const float *row = &face.depths[glm::clamp(y, 0, resolution - 1) * resolution];
+		for (int x = centerX - pcfRadius; x <= centerX + pcfRadius; x++) {
+			lit += row[glm::clamp(x, 0, resolution - 1)] >= nearest ? 1 : 0;
+		}
+	}
+	const int side = 2 * pcfRadius + 1;
+	return (float)lit / (side * side);
+}
+
+/**
+ * @fn	const ShadowMap *ShadowMap::find(const std::vector<const ShadowMap *> &shadowMaps, const LightSource *light)
+ * @brief	Looks up a light's shadow map.
+ * @param	shadowMaps	The shadow maps.
+ * @param	light	  	The light.
+ * @return	The light's shadow map, or nullptr if it has none.
+ */
+
+const ShadowMap *ShadowMap::find(const std::vector<const ShadowMap *> &shadowMaps, const LightSource *light) {
+	for (const ShadowMap *shadowMap : shadowMaps) {
+		if (shadowMap->light == light) {
+			return shadowMap;
+		}
+	}
+	return nullptr;
+}
+
+/**
+ * @fn	color illuminateWithVisibility(const LightSource &light, const glm::vec3 &position, const glm::vec3 &normal, const Material &material, const Frame &eyeFrame, float visibility)
+ * @brief	Computes the color a light produces at a point only partly reached by
+ * 			it, mixing the lit and shadowed colors. Same as illuminate when the
+ * 			visibility is 0 or 1.
+ * @param	light	  	The light.
+ * @param	position  	The surface point, in world coordinates.
+ * @param	normal	  	The surface normal, in world coordinates.
+ * @param	material  	The surface material.
+ * @param	eyeFrame  	The eye's frame.
+ * @param	visibility	How much of the light reaches the point, 0 to 1.
+ * @return	The color produced at the point.
+ */
+
+color illuminateWithVisibility(const LightSource &light, const glm::vec3 &position,
+								const glm::vec3 &normal, const Material &material,
+								const Frame &eyeFrame, float visibility) {
+	if (visibility >= 1.0f) {
+		return light.illuminate(position, normal, material, eyeFrame, false);
+	}
+	const color shadowed = light.illuminate(position, normal, material, eyeFrame, true);
+	if (visibility <= 0.0f) {
+		return shadowed;
+	}
+	return visibility * light.illuminate(position, normal, material, eyeFrame, false) + (1.0f - visibility) * shadowed;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <functional>
+#include <vector>
+#include "FrameBuffer.h"
+#include "Light.h"
+
+const int CUBE_FACES = 6;					//!< Faces of the cube map around a positional light.
+const float MAX_SPOT_MAP_FOV = 2 * M_PI_3;	//!< Widest spot light drawn into a single face. Wider ones get a cube map.
+
+/**
+ * @struct	ShadowMapFace
+ * @brief	One depth image of a shadow map, rendered from the light's position
+ * 			through a square perspective projection. Depths are distances along
+ * 			the face's forward direction, row-major, one per texel.
+ */
+
+struct ShadowMapFace {
+	glm::mat4 viewingMatrix;		//!< World to the light's eye coordinates.
+	glm::mat4 projectionMatrix;		//!< Light's eye to clip.
+	glm::mat4 lightMatrix;			//!< World to the face's window coordinates.
+	glm::vec3 forward;				//!< The direction the face looks, in world coordinates.
+	std::vector<float> depths;		//!< Distance to the nearest caster at each texel.
+};
+
+/**
+ * @class	ShadowMap
+ * @brief	Depth of the scene as seen from a light, for shadow queries without
+ * 			tracing rays. A positional light gets a cube map of six faces; a spot
+ * 			light no wider than MAX_SPOT_MAP_FOV gets one face covering its cone.
+ * 			The faces are drawn by the regular pipeline, depth only, so anything
+ * 			VertexOps can render casts shadows. Queries compare against a block of
+ * 			texels (percentage closer filtering), so shadow edges are soft, and the
+ * 			point is pushed off the surface by a few texels first, to keep lit
+ * 			surfaces from shadowing themselves. The light must outlive the map.
+ */
+
+class ShadowMap {
+public:
+	static int pcfRadius;			//!< Queries compare (2*pcfRadius+1)^2 texels. 0 ==> one, with hard edges.
+	static float normalOffset;		//!< Texels a queried point is moved along its normal.
+	static float depthBias;			//!< Texels a queried point may be behind a caster and still be lit.
+
+	ShadowMap(const PositionalLight &light, int resolution = 512, float nearPlane = 0.05f, float farPlane = 100.0f);
+	const PositionalLight &getLight() const { return *light; }
+	int getResolution() const { return resolution; }
+	bool isCubeMap() const { return faces.size() == CUBE_FACES; }
+	void render(const std::function<void(FrameBuffer &)> &drawCasters);
+	float visibility(const glm::vec3 &position, const glm::vec3 &normal) const;
+	static const ShadowMap *find(const std::vector<const ShadowMap *> &shadowMaps, const LightSource *light);
+protected:
+	void setUpFaces();
+	int faceOf(const glm::vec3 &toPoint) const;
+	const PositionalLight *light;			//!< The light the map is rendered from.
+	int resolution;							//!< Width and height, in texels, of each face.
+	float nearPlane, farPlane;				//!< Depth range of the faces, in world units.
+	float tanHalfFov;						//!< Tangent of half of each face's field of view.
+	std::vector<ShadowMapFace> faces;		//!< One face, or CUBE_FACES in the order +x, -x, +y, -y, +z, -z.
+	FrameBuffer target;						//!< The faces are drawn here, one at a time.
+};
+
+color illuminateWithVisibility(const LightSource &light, const glm::vec3 &position,
+								const glm::vec3 &normal, const Material &material,
+								const Frame &eyeFrame, float visibility);
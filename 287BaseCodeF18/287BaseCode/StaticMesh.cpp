@@ -0,0 +1,45 @@
+#include "StaticMesh.h"
+
+/**
+ * @fn	StaticMesh::StaticMesh(const IndexedMesh &mesh, const glm::mat4 &modelMatrix)
+ * @brief	Builds a static mesh and its world space vertices.
+ * @param	mesh	   	The mesh, in object coordinates.
+ * @param	modelMatrix	Object to world.
+ */
+
+StaticMesh::StaticMesh(const IndexedMesh &mesh, const glm::mat4 &modelMatrix)
+	: source(mesh), world(mesh), modelMatrix(modelMatrix) {
+	update();
+}
+
+/**
+ * @fn	void StaticMesh::setModelMatrix(const glm::mat4 &M)
+ * @brief	Moves the mesh. The world space vertices are only rebuilt if the
+ * 			matrix actually changed.
+ * @param	M	Object to world.
+ */
+
+void StaticMesh::setModelMatrix(const glm::mat4 &M) {
+	if (M != modelMatrix) {
+		modelMatrix = M;
+		update();
+	}
+}
+
+/**
+ * @fn	void StaticMesh::update()
+ * @brief	Takes the vertices and bounds into world coordinates.
+ */
+
+void StaticMesh::update() {
+	const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelMatrix)));
+	for (size_t i = 0; i < source.vertices.size(); i++) {
+		const VertexData &v = source.vertices[i];
+		VertexData &w = world.vertices[i];
+		w.position = modelMatrix * v.position;
+		w.worldPosition = w.position.xyz;
+		w.normal = glm::normalize(normalMatrix * v.normal);
+	}
+	world.bounds = ObjectBounds(world.vertices);
+	world.streams = VertexStreams(world.vertices);
+}
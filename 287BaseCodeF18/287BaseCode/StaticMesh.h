@@ -0,0 +1,24 @@
+#pragma once
+#include "IndexedMesh.h"
+
+/**
+ * @class	StaticMesh
+ * @brief	An indexed mesh whose world space vertices are cached across frames.
+ * 			Positions, world positions and normals are taken through the modeling
+ * 			transformation once, and again only when it changes, so drawing the
+ * 			mesh costs the view-projection transform, clipping and rasterization.
+ * 			e.g., StaticMesh plane(IndexedMesh(EShape::createECheckerBoard(...)));
+ */
+
+class StaticMesh {
+	public:
+		explicit StaticMesh(const IndexedMesh &mesh, const glm::mat4 &modelMatrix = glm::mat4(1.0f));
+		void setModelMatrix(const glm::mat4 &M);
+		const glm::mat4 &getModelMatrix() const { return modelMatrix; }
+		const IndexedMesh &worldMesh() const { return world; }
+	protected:
+		void update();
+		IndexedMesh source;			//!< The mesh, in object coordinates.
+		IndexedMesh world;			//!< The mesh, in world coordinates.
+		glm::mat4 modelMatrix;		//!< Object to world.
+};
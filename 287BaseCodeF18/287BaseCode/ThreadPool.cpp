@@ -0,0 +1,96 @@
+#include <algorithm>
+#include "ThreadPool.h"
+
+/**
+ * @fn	ThreadPool::ThreadPool(int threadCount)
+ * @brief	Constructs a thread pool.
+ * @param	threadCount	Total number of threads, including the caller of parallelFor.
+ * 						0 ==> one per hardware thread.
+ */
+
+ThreadPool::ThreadPool(int threadCount)
+	: task(nullptr), taskCount(0), nextTask(0), busyWorkers(0), generation(0), stopping(false) {
+	if (threadCount <= 0) {
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	for (int i = 1; i < threadCount; i++) {
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+/**
+ * @fn	ThreadPool::~ThreadPool()
+ * @brief	Stops and joins the worker threads.
+ */
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workReady.notify_all();
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+}
+
+/**
+ * @fn	void ThreadPool::parallelFor(int taskCount, const std::function<void(int)> &task)
+ * @brief	Runs task(0) ... task(taskCount-1) on the pool's threads. Tasks are
+ * 			claimed in increasing order, but may finish in any order.
+ * @param	taskCount	Number of tasks.
+ * @param	task	 	The task to run.
+ */
+
+void ThreadPool::parallelFor(int taskCount, const std::function<void(int)> &task) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->task = &task;
+		this->taskCount = taskCount;
+		nextTask = 0;
+		busyWorkers = (int)workers.size();
+		generation++;
+	}
+	workReady.notify_all();
+	runTasks();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	workDone.wait(lock, [this] { return busyWorkers == 0; });
+	this->task = nullptr;
+}
+
+/**
+ * @fn	void ThreadPool::runTasks()
+ * @brief	Claims and runs tasks until there are none left.
+ */
+
+void ThreadPool::runTasks() {
+	for (int i = nextTask++; i < taskCount; i = nextTask++) {
+		(*task)(i);
+	}
+}
+
+/**
+ * @fn	void ThreadPool::workerLoop()
+ * @brief	Body of each worker thread: waits for work, helps with it, and reports back.
+ */
+
+void ThreadPool::workerLoop() {
+	unsigned long long lastGeneration = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			workReady.wait(lock, [&] { return stopping || generation != lastGeneration; });
+			if (stopping) {
+				return;
+			}
+			lastGeneration = generation;
+		}
+		runTasks();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busyWorkers--;
+		}
+		workDone.notify_one();
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @class	ThreadPool
+ * @brief	A fixed set of worker threads that run numbered tasks in parallel.
+ * 			The calling thread works on the tasks too, and parallelFor returns
+ * 			only once every task has finished.
+ */
+
+class ThreadPool {
+public:
+	ThreadPool(int threadCount = 0);
+	~ThreadPool();
+	int getThreadCount() const { return (int)workers.size() + 1; }
+	void parallelFor(int taskCount, const std::function<void(int)> &task);
+protected:
+	void workerLoop();
+	void runTasks();
+	std::vector<std::thread> workers;		//!< Worker threads, not counting the caller
+	std::mutex mutex;						//!< Guards everything below except nextTask
+	std::condition_variable workReady;		//!< Signaled when a new parallelFor starts
+	std::condition_variable workDone;		//!< Signaled when a worker finishes its share
+	const std::function<void(int)> *task;	//!< The task being run
+	int taskCount;							//!< Number of tasks in this parallelFor
+	std::atomic<int> nextTask;				//!< Next task to be claimed
+	int busyWorkers;						//!< Workers still working on this parallelFor
+	unsigned long long generation;			//!< Counts parallelFor calls, so workers notice new work
+	bool stopping;							//!< True ==> workers should exit
+};
@@ -6,7 +6,7 @@
 #include "Defs.h"
 #include "ColorAndMaterials.h"
 
-extern bool DEBUG_PIXEL;
+extern thread_local bool DEBUG_PIXEL;
 extern int xDebug, yDebug;
 void mouseUtility(int, int, int, int);
 
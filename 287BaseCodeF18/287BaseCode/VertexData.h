@@ -1,6 +1,6 @@
 #pragma once
 #include "Defs.h"
-#include "ColorAndMaterials.h"
+#include "MaterialTable.h"
 
 /**
  * @struct	VertexData
@@ -11,11 +11,15 @@ struct VertexData {
 	glm::vec4 position;		//!< Processed coordinate.
 	glm::vec3 normal;		//!< transformed normal vector.
 	glm::vec3 worldPosition;//!< Saved world position, for lighting calculations.
-	Material material;		//!< This vertex's material.
+	MaterialIndex materialID;	//!< This vertex's material, in the MaterialTable.
+	color litColor;			//!< Color lit at this vertex, when lighting is per vertex.
 
 	VertexData(const glm::vec4 &pos = ORIGIN3DHOMO,
 				const glm::vec3 &norm = glm::vec3(0.0, 0.0, 1.0),
-				const Material &mat = bronze,
+				MaterialIndex matID = DEFAULT_MATERIAL,
+				const glm::vec3 &worldPos = ORIGIN3D);
+	VertexData(const glm::vec4 &pos, const glm::vec3 &norm,
+				const Material &mat,
 				const glm::vec3 &worldPos = ORIGIN3D);
 	VertexData(float w1, const VertexData &vd1,
 				float w2, const VertexData &vd2);
@@ -6,239 +6,450 @@ glm::mat4 VertexOps::viewingTransformation;
 glm::mat4 VertexOps::projectionTransformation;
 glm::mat4 VertexOps::viewportTransformation;
 bool VertexOps::renderBackFaces = true;
+bool VertexOps::perVertexLighting = false;
 
 const BoundingBox3D VertexOps::ndc(-1, 1, -1, 1, -1, 1);	//l,r,b,t,n,f
 BoundingBoxi VertexOps::viewport(0, WINDOW_WIDTH - 1, 0, WINDOW_HEIGHT - 1);
-
-// Planes describing the normalized device coordinates view volume - 2x2x2 cube
-std::vector<IPlane> VertexOps::ndcPlanes{ IPlane(glm::vec3(0, 1, 0), glm::vec3(0, -1, 0)),
-											IPlane(glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0)),
-											IPlane(glm::vec3(0, 0, 1), glm::vec3(0, 0, -1)),
-											IPlane(glm::vec3(-1, 0, 0), glm::vec3(1, 0, 0)),
-											IPlane(glm::vec3(0, -1, 0), glm::vec3(0, 1, 0)),
-											IPlane(glm::vec3(0, 0, -1), glm::vec3(0, 0, 1)) };
+thread_local VertexArena VertexOps::arena;
+
+// Clip space planes, as coefficients (a,b,c,d) of a*x + b*y + c*z + d*w >= 0.
+// The first six bound the view volume; the last four bound the guard band.
+static const glm::vec4 CLIP_PLANES[] = { glm::vec4(1, 0, 0, 1), glm::vec4(-1, 0, 0, 1),
+										glm::vec4(0, 1, 0, 1), glm::vec4(0, -1, 0, 1),
+										glm::vec4(0, 0, 1, 1), glm::vec4(0, 0, -1, 1),
+										glm::vec4(1, 0, 0, GUARD_BAND), glm::vec4(-1, 0, 0, GUARD_BAND),
+										glm::vec4(0, 1, 0, GUARD_BAND), glm::vec4(0, -1, 0, GUARD_BAND) };
+const int CLIP_PLANE_COUNT = 10;
+const int OUTSIDE_VIEW_VOLUME = 0x3F;		//!< Outcode bits of the view volume's planes.
+const int OUTSIDE_NEAR_FAR = 0x30;			//!< Outcode bits of the near and far planes.
+const int OUTSIDE_GUARD_BAND = 0x3C0;		//!< Outcode bits of the guard band's planes.
 
 /**
- * @fn	std::vector<VertexData> triangulate(const std::vector<VertexData> &poly)
- * @brief	Triangulates the given polygon
- * @param	poly	The polygon to be decomposed into individual triangles.
- * @return	A vector of triangles, which comprise the original polygon.
+ * @fn	static inline float clipDistance(const glm::vec4 &plane, const glm::vec4 &P)
+ * @brief	Signed distance, up to scale, of a clip space point from a clip plane.
+ * @param	plane	The plane's coefficients.
+ * @param	P	 	The point.
+ * @return	Non-negative iff the point is inside the plane.
  */
 
-std::vector<VertexData> triangulate(const std::vector<VertexData> &poly) {
-	std::vector<VertexData> triangles;
+static inline float clipDistance(const glm::vec4 &plane, const glm::vec4 &P) {
+	return plane.x * P.x + plane.y * P.y + plane.z * P.z + plane.w * P.w;
+}
 
-	for (unsigned int i = 1; i < poly.size() - 1; i++) {
-		triangles.push_back(poly[0]);
-		triangles.push_back(poly[i]);
-		triangles.push_back(poly[i + 1]);
-	}
+/**
+ * @fn	int VertexOps::outcode(const glm::vec4 &P)
+ * @brief	Computes a clip space point's outcode: bit i is set iff the point is
+ * 			outside CLIP_PLANES[i].
+ * @param	P	The point.
+ * @return	The outcode.
+ */
 
-	return triangles;
+int VertexOps::outcode(const glm::vec4 &P) {
+	int code = 0;
+	for (int i = 0; i < CLIP_PLANE_COUNT; i++) {
+		if (clipDistance(CLIP_PLANES[i], P) < 0.0f) {
+			code |= 1 << i;
+		}
+	}
+	return code;
 }
 
 /**
- * @fn	std::vector<VertexData> VertexOps::clipAgainstPlane(std::vector<VertexData> &verts, const IPlane &plane)
- * @brief	Clips a polygon against a single plane
- * @param [in,out]	verts	The array of vertices.
- * @param 		  	plane	The plane that will do the clipping.
- * @return	The polygon that exludes the portions outside the given plane.
+ * @fn	VertexData VertexOps::transformVertex(const RenderState &state, const VertexData &v)
+ * @brief	Takes a vertex from object to clip coordinates in one step, with the
+ * 			precombined modeling-viewing-projection matrix. The world position
+ * 			and normal are kept for per pixel lighting.
+ * @param	state	The state of the draw.
+ * @param	v	 	The vertex, in object coordinates.
+ * @return	The vertex, in clip coordinates.
  */
 
-std::vector<VertexData> VertexOps::clipAgainstPlane(std::vector<VertexData> &verts, const IPlane &plane) {
-	std::vector<VertexData> output;
+VertexData VertexOps::transformVertex(const RenderState &state, const VertexData &v) {
+	glm::vec4 worldPos = state.modelMatrix * v.position;
+	VertexData vt(state.modelViewProjectionMatrix * v.position, state.normalMatrix * v.normal,
+					v.materialID, worldPos.xyz);
+	return vt;
+}
 
-	if (verts.size() > 2) {
-		verts.push_back(verts[0]);
+/**
+ * @fn	int VertexOps::clipAgainstPlane(const VertexData verts[], int count, VertexData output[], const glm::vec4 &plane)
+ * @brief	Clips a polygon against a single plane, in homogeneous clip space
+ * @param 		  	verts 	The polygon's vertices.
+ * @param 		  	count 	The number of vertices.
+ * @param [in,out]	output	Receives the clipped polygon. Room for MAX_CLIP_VERTS.
+ * @param 		  	plane 	The plane that will do the clipping.
+ * @return	The number of vertices in the polygon that exludes the portions outside the given plane.
+ */
 
-		for (unsigned int i = 1; i < verts.size(); i++) {
-			bool v0In = plane.insidePlane(verts[i - 1].position.xyz);
-			bool v1In = plane.insidePlane(verts[i].position.xyz);
+int VertexOps::clipAgainstPlane(const VertexData verts[], int count, VertexData output[], const glm::vec4 &plane) {
+	int outCount = 0;
+
+	if (count > 2) {
+		float d0 = clipDistance(plane, verts[0].position);
+		for (int i = 1; i <= count && outCount + 2 <= MAX_CLIP_VERTS; i++) {
+			const VertexData &v0 = verts[i - 1];
+			const VertexData &v1 = verts[i % count];
+			const float d1 = clipDistance(plane, v1.position);
+			const bool v0In = d0 >= 0.0f;
+			const bool v1In = d1 >= 0.0f;
 
 			if (v0In && v1In) {
-				output.push_back(verts[i]);
+				output[outCount++] = v1;
 			} else if (v0In || v1In) {
-				float t;
-				plane.findIntersection(verts[i - 1].position.xyz, verts[i].position.xyz, t);
-				VertexData I(1.0f - t, verts[i - 1], t, verts[i]);
-				output.push_back(I);
+				const float t = d0 / (d0 - d1);
+				output[outCount++] = VertexData(1.0f - t, v0, t, v1);
 				if (!v0In && v1In) {
-					output.push_back(verts[i]);
+					output[outCount++] = v1;
 				}
 			}
+			d0 = d1;
 		}
 	}
-	return output;
+	return outCount;
 }
 
 /**
- * @fn	std::vector<VertexData> VertexOps::clipPolygon(const std::vector<VertexData> &clipCoords)
- * @brief	Clip polygon against the normalized view volumn - 2x2x2 cube.
- * @param	clipCoords	The array of triangles.
- * @return	The array of triangles, after performing clipping.
+ * @fn	int VertexOps::clipPolygon(VertexData *&polygon, VertexData *&scratch, int count, int planes)
+ * @brief	Clips a polygon against some of the clip planes, in homogeneous clip
+ * 			space. The two buffers are swapped as the polygon moves between them.
+ * @param [in,out]	polygon	The polygon; on return, the clipped polygon.
+ * @param [in,out]	scratch	A second buffer, of MAX_CLIP_VERTS vertices.
+ * @param 		  	count  	The number of vertices.
+ * @param 		  	planes 	Outcode bits of the planes to clip against.
+ * @return	The number of vertices in the clipped polygon. 0 if it was clipped away.
  */
 
-std::vector<VertexData> VertexOps::clipPolygon(const std::vector<VertexData> &clipCoords) {
-	std::vector<VertexData> ndcCoords;
-
-	if (clipCoords.size() > 2) {
-		for (unsigned int i = 0; i < clipCoords.size() - 2; i += 3) {
-			std::vector<VertexData> polygon;
-			polygon.push_back(clipCoords[i]);
-			polygon.push_back(clipCoords[i + 1]);
-			polygon.push_back(clipCoords[i + 2]);
-
-			for (IPlane plane : ndcPlanes) {
-				polygon = clipAgainstPlane(polygon, plane);
-			}
-			if (polygon.size() > 3) {
-				polygon = triangulate(polygon);
-			}
-			for (VertexData v : polygon) {
-				ndcCoords.push_back(v);
+int VertexOps::clipPolygon(VertexData *&polygon, VertexData *&scratch, int count, int planes) {
+	for (int i = 0; i < CLIP_PLANE_COUNT; i++) {
+		if (planes & (1 << i)) {
+			count = clipAgainstPlane(polygon, count, scratch, CLIP_PLANES[i]);
+			std::swap(polygon, scratch);
+			if (count < 3) {
+				return 0;
 			}
 		}
 	}
-	return ndcCoords;
+	return count;
 }
 
 /**
- * @fn	std::vector<VertexData> VertexOps::clipLineSegments(const std::vector<VertexData> &clipCoords)
- * @brief	Clip line segments against normalized view volume.
- * @param	clipCoords	The vector of line segments that are to be clipped.
- * @return	A std::vector&lt;VertexData&gt;
+ * @fn	bool VertexOps::clipLineSegment(VertexData &v0, VertexData &v1, int planes)
+ * @brief	Clips a line segment against some of the clip planes, in place, in
+ * 			homogeneous clip space.
+ * @param [in,out]	v0	  	The first endpoint.
+ * @param [in,out]	v1	  	The second endpoint.
+ * @param 		  	planes	Outcode bits of the planes to clip against.
+ * @return	False iff the segment is entirely clipped away.
  */
 
-std::vector<VertexData> VertexOps::clipLineSegments(const std::vector<VertexData> &clipCoords) {
-	std::vector<VertexData> ndcCoords;
-
-	if (clipCoords.size() > 1) {
-		for (unsigned int i = 0; i < clipCoords.size() - 1; i += 2) {
-			VertexData v0 = clipCoords[i];
-			VertexData v1 = clipCoords[i + 1];
-
-			bool outsideViewVolume = false;
-
-			for (const IPlane plane : ndcPlanes) {
-				bool v0In = ndcPlanes[i].insidePlane(v0.position.xyz);
-				bool v1In = ndcPlanes[i].insidePlane(v1.position.xyz);
-
-				if (!v0In && !v1In) { // Line segment is entirely clipped
-					outsideViewVolume = true;
-					break; 
-				} else if (v0In && !v1In) {
-					float t;
-					ndcPlanes[i].findIntersection(v0.position.xyz, v1.position.xyz, t);
-					v1 = VertexData(1.0f-t, v0, t, v1);
-				} else if (!v0In && v1In) {
-					float t;
-					ndcPlanes[i].findIntersection(v0.position.xyz, v1.position.xyz, t);
-					v0 = VertexData(1.0f-t, v0, t, v1);
-				} else {  // both inside
-				}
-			}
-			if (!outsideViewVolume) {
-				ndcCoords.push_back(v0);
-				ndcCoords.push_back(v1);
+bool VertexOps::clipLineSegment(VertexData &v0, VertexData &v1, int planes) {
+	for (int i = 0; i < CLIP_PLANE_COUNT; i++) {
+		if (planes & (1 << i)) {
+			const float d0 = clipDistance(CLIP_PLANES[i], v0.position);
+			const float d1 = clipDistance(CLIP_PLANES[i], v1.position);
+			if (d0 < 0.0f && d1 < 0.0f) {		// Line segment is entirely clipped
+				return false;
+			} else if (d0 >= 0.0f && d1 < 0.0f) {
+				const float t = d0 / (d0 - d1);
+				v1 = VertexData(1.0f - t, v0, t, v1);
+			} else if (d0 < 0.0f && d1 >= 0.0f) {
+				const float t = d0 / (d0 - d1);
+				v0 = VertexData(1.0f - t, v0, t, v1);
 			}
 		}
 	}
-	return ndcCoords;
+	return true;
 }
 
- /**
- * @fn	std::vector<VertexData> VertexOps::removeBackwardFacingTriangles(const std::vector<VertexData> &triangleVerts)
- * @brief	Removes the backward facing triangles
- * @param	triangleVerts	The vector of triangle vertices.
- * @return	Vector of triangle vertices, without those facing backward.
+/**
+ * @fn	void VertexOps::emitWindowVertex(const RenderState &state, const VertexData &ndcVertex)
+ * @brief	Maps a vertex onto the window and appends it to the arena's output.
+ * @param	state		The state of the draw.
+ * @param	ndcVertex	The vertex, in normalized device coordinates.
  */
 
-std::vector<VertexData> VertexOps::removeBackwardFacingTriangles(const std::vector<VertexData> &triangleVerts) {
-	std::vector<VertexData> fowardFacingTriangles;
-	const glm::vec3 viewDirection(0.0f, 0.0f, -1.0f);
+void VertexOps::emitWindowVertex(const RenderState &state, const VertexData &ndcVertex) {
+	arena.windowCoords.push_back(ndcVertex);
+	VertexData &vd = arena.windowCoords.back();
+	vd.position = state.viewportMatrix * ndcVertex.position;
+	vd.normal = glm::normalize(vd.normal);		// Clipping interpolates normals
+}
 
-	for (int i = 0; i < (int)triangleVerts.size() - 2; i += 3) {
-		glm::vec3 n = normalFrom3Points(triangleVerts[i].position.xyz, triangleVerts[i + 1].position.xyz, triangleVerts[i + 2].position.xyz);
+/**
+ * @fn	void VertexOps::applyLighting(const RenderState &state, const std::vector<LightSourcePtr> &lights, VertexData verts[], int count)
+ * @brief	Lights vertices, leaving the color in each one's litColor. Used when
+ * 			lighting is per vertex, so the rasterizer only interpolates colors.
+ * @param 		  	state	The state of the draw.
+ * @param 		  	lights	The vector of lights in the scene.
+ * @param [in,out]	verts 	The vertices, with world positions and normals.
+ * @param 		  	count 	The number of vertices.
+ */
 
-		if (glm::dot(viewDirection, n) <= 0.0) {
-			fowardFacingTriangles.push_back(triangleVerts[i]);
-			fowardFacingTriangles.push_back(triangleVerts[i + 1]);
-			fowardFacingTriangles.push_back(triangleVerts[i + 2]);
+void VertexOps::applyLighting(const RenderState &state, const std::vector<LightSourcePtr> &lights,
+								VertexData verts[], int count) {
+	const Frame &eyeFrame = state.eyeFrame;
+	for (int i = 0; i < count; i++) {
+		VertexData &vert = verts[i];
+		const Material &material = MaterialTable::get(vert.materialID);
+		const glm::vec3 normal = glm::normalize(vert.normal);
+		color totalLight = black;
+		for (unsigned int j = 0; j < lights.size(); j++) {
+			const ShadowMap *shadowMap = ShadowMap::find(FragmentOps::shadowMaps, lights[j]);
+			const float visibility = shadowMap != nullptr ? shadowMap->visibility(vert.worldPosition, normal) : 1.0f;
+			totalLight += illuminateWithVisibility(*lights[j], vert.worldPosition, normal, material, eyeFrame, visibility);
 		}
+		vert.litColor = totalLight;
+	}
+}
+
+/**
+ * @fn	RenderState VertexOps::currentState(const glm::mat4 &modelMatrix)
+ * @brief	Captures the current pipeline settings as the state of one draw.
+ * @param	modelMatrix	The modeling transformation of the draw.
+ * @return	The state.
+ */
+
+RenderState VertexOps::currentState(const glm::mat4 &modelMatrix) {
+	return RenderState(modelMatrix, viewingTransformation, projectionTransformation, viewport);
+}
+
+/**
+ * @fn	void VertexOps::assembleTriangle(const RenderState &state, const VertexData &v0, const VertexData &v1, const VertexData &v2, int code0, int code1, int code2)
+ * @brief	Clips, back-face culls and maps one clip space triangle onto the window,
+ * 			appending what is left to the arena's output. Triangles entirely
+ * 			outside one view volume plane are rejected from their outcodes. Only
+ * 			triangles crossing the near or far plane or the guard band are
+ * 			clipped; the rest are drawn whole and the rasterizer scissors them.
+ * @param	state	The state of the draw.
+ * @param	v0   	The first vertex.
+ * @param	v1   	The second vertex.
+ * @param	v2   	The third vertex.
+ * @param	code0	The first vertex's outcode.
+ * @param	code1	The second vertex's outcode.
+ * @param	code2	The third vertex's outcode.
+ */
+
+void VertexOps::assembleTriangle(const RenderState &state, const VertexData &v0,
+									const VertexData &v1, const VertexData &v2,
+									int code0, int code1, int code2) {
+	if (code0 & code1 & code2 & OUTSIDE_VIEW_VOLUME) {
+		return;
+	}
+
+	VertexData *polygon = arena.polygon[0];
+	VertexData *scratch = arena.polygon[1];
+	polygon[0] = v0;
+	polygon[1] = v1;
+	polygon[2] = v2;
+	int count = 3;
+	const int planes = (code0 | code1 | code2) & (OUTSIDE_NEAR_FAR | OUTSIDE_GUARD_BAND);
+	if (planes != 0) {
+		count = clipPolygon(polygon, scratch, count, planes);
+	}
+
+	float area = 0.0f;
+	for (int i = 0; i < count; i++) {		// Perspective division
+		polygon[i].position /= polygon[i].position.w;
+	}
+	for (int i = 0; i < count; i++) {
+		const glm::vec4 &a = polygon[i].position, &b = polygon[(i + 1) % count].position;
+		area += a.x * b.y - b.x * a.y;
+	}
+	if (!state.renderBackFaces && !(area > 0.0f)) {	// backface culling?
+		return;
+	}
+
+	for (int j = 1; j < count - 1; j++) {	// Triangulate as a fan
+		emitWindowVertex(state, polygon[0]);
+		emitWindowVertex(state, polygon[j]);
+		emitWindowVertex(state, polygon[j + 1]);
 	}
-	return fowardFacingTriangles;
 }
 
 /**
- * @fn	std::vector<VertexData> VertexOps::transformVerticesToWorldCoordinates(const glm::mat4 &modelMatrix, const std::vector<VertexData> &vertices)
- * @brief	Apply modeling transformation to vector of vertices.
- * @param	modelMatrix	Modeling matrix.
- * @param	vertices   	The vector of vertices.
- * @return	The transformed vertices.
+ * @fn	void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &objectCoords)
+ * @brief	Transforms the triangle vertices through pipeline: object -> clip -> ndc -> window,
+ * 			in a single pass. Each triangle is transformed, clipped in clip space
+ * 			and culled in the arena's polygon buffers, and its window coordinates
+ * 			are appended to the arena's output.
+ * @param [in,out]	frameBuffer 	Buffer for frame data.
+ * @param 		  	state			The state of the draw.
+ * @param 		  	lights			The lights.
+ * @param 		  	objectCoords	The object coordinates.
  */
 
-std::vector<VertexData> VertexOps::transformVerticesToWorldCoordinates(const glm::mat4 &modelMatrix, const std::vector<VertexData> &vertices) {
-	// Create 3 x 3 matrix for transforming normal vectors to world coordinates
-	glm::mat3 TM3x3(modelMatrix);
-	glm::mat3 modelingTransfomationForNormals = glm::transpose(glm::inverse(TM3x3));
-
-	std::vector<VertexData> transformedVertices;
-	for (unsigned int i=0; i<vertices.size(); i++) {
-		const VertexData &v = vertices[i];
-		glm::vec3 n = modelingTransfomationForNormals * v.normal;
-		glm::vec4 worldPos = modelMatrix * v.position;
-		VertexData vt(worldPos, n, v.material, worldPos.xyz);
-		transformedVertices.push_back(vt);
+void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer, const RenderState &state,
+										const std::vector<LightSourcePtr> &lights,
+										const std::vector<VertexData> &objectCoords) {
+	arena.windowCoords.clear();
+	appendTriangleVertices(state, lights, objectCoords);
+	drawManyFilledTriangles(frameBuffer, state, lights, arena.windowCoords);
+}
+
+/**
+ * @fn	void VertexOps::appendTriangleVertices(const RenderState &state, const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &objectCoords)
+ * @brief	Runs triangles through the vertex stage, appending their window
+ * 			coordinates to the arena's output without drawing them.
+ * @param	state			The state of the draw.
+ * @param	lights			The lights, used when lighting is per vertex.
+ * @param	objectCoords	The object coordinates.
+ */
+
+void VertexOps::appendTriangleVertices(const RenderState &state, const std::vector<LightSourcePtr> &lights,
+										const std::vector<VertexData> &objectCoords) {
+	VertexData triangle[3];
+	int codes[3];
+	for (int i = 0; i < (int)objectCoords.size() - 2; i += 3) {
+		for (int j = 0; j < 3; j++) {
+			triangle[j] = transformVertex(state, objectCoords[i + j]);
+			codes[j] = outcode(triangle[j].position);
+		}
+		if (state.perVertexLighting) {
+			applyLighting(state, lights, triangle, 3);
+		}
+		assembleTriangle(state, triangle[0], triangle[1], triangle[2], codes[0], codes[1], codes[2]);
 	}
-	return transformedVertices;
 }
 
 /**
- * @fn	void VertexOps::applyLighting(const std::vector<LightSourcePtr> &lights, std::vector<VertexData> &worldCoords)
- * @brief	Applies the lighting to all the vertices. Modifies the VertexData's material field.
- * @param 		  	lights	   	The vector of lights in the scene.
- * @param [in,out]	worldCoords	The vector of world coordinates.
+ * @fn	void VertexOps::processIndexedTriangles(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, const IndexedMesh &mesh, bool worldSpace)
+ * @brief	Transforms an indexed mesh through the pipeline. Each distinct vertex is
+ * 			transformed once, into the arena's post-transform cache along with its
+ * 			outcode, and the triangles are assembled from the cache in index order.
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	state	   	The state of the draw.
+ * @param 		  	lights	   	The lights.
+ * @param 		  	mesh	   	The mesh, in object coordinates.
+ * @param 		  	worldSpace 	True ==> the mesh is already in world coordinates.
+ */
+
+void VertexOps::processIndexedTriangles(FrameBuffer &frameBuffer, const RenderState &state,
+										const std::vector<LightSourcePtr> &lights,
+										const IndexedMesh &mesh, bool worldSpace) {
+	arena.windowCoords.clear();
+	appendIndexedTriangles(state, lights, mesh, worldSpace);
+	drawManyFilledTriangles(frameBuffer, state, lights, arena.windowCoords);
+}
+
+/**
+ * @fn	void VertexOps::appendIndexedTriangles(const RenderState &state, const std::vector<LightSourcePtr> &lights, const IndexedMesh &mesh, bool worldSpace)
+ * @brief	Runs an indexed mesh through the vertex stage, appending its window
+ * 			coordinates to the arena's output without drawing them. The mesh's
+ * 			position and normal streams are copied into the arena and transformed
+ * 			there a whole stream at a time. A mesh already in world coordinates
+ * 			only needs the view-projection transform. When lighting is per vertex,
+ * 			each distinct vertex is lit once, however many triangles share it.
+ * @param	state	  	The state of the draw.
+ * @param	lights	  	The lights, used when lighting is per vertex.
+ * @param	mesh 	  	The mesh.
+ * @param	worldSpace	True ==> the mesh is already in world coordinates.
  */
 
-void VertexOps::applyLighting(const std::vector<LightSourcePtr> &lights, std::vector<VertexData> &worldCoords) {
-	Frame eyeFrame = Frame::createOrthoNormalBasis(VertexOps::viewingTransformation);
-	for (unsigned int i = 0; i < worldCoords.size(); i++) {
-		VertexData &vert = worldCoords[i];
-		float alpha = worldCoords[i].material.alpha;
-		color totalLight = black;
+void VertexOps::appendIndexedTriangles(const RenderState &state, const std::vector<LightSourcePtr> &lights,
+										const IndexedMesh &mesh, bool worldSpace) {
+	const int N = mesh.streams.size();
+	VertexStreams &clip = arena.clipStreams;
+	VertexStreams &world = arena.worldStreams;
+	clip = mesh.streams;
+	clip.transformPositions(worldSpace ? state.viewProjectionMatrix : state.modelViewProjectionMatrix);
+	if (!worldSpace) {
+		world = mesh.streams;
+		world.transformPositions(state.modelMatrix);
+		world.transformNormals(state.normalMatrix);
+	}
 
-		for (unsigned int j = 0; j < lights.size(); j++) {
-			totalLight += lights[j]->illuminate(vert.worldPosition, vert.normal, vert.material,
-												eyeFrame, false);
+	arena.meshCoords.resize(N);
+	arena.meshOutcodes.resize(N);
+	for (int i = 0; i < N; i++) {
+		VertexData &vd = arena.meshCoords[i];
+		vd = mesh.vertices[i];
+		vd.position = glm::vec4(clip.x[i], clip.y[i], clip.z[i], clip.w[i]);
+		if (!worldSpace) {
+			vd.normal = glm::vec3(world.nx[i], world.ny[i], world.nz[i]);
+			vd.worldPosition = glm::vec3(world.x[i], world.y[i], world.z[i]);
 		}
-		worldCoords[i].material.ambient = totalLight;
+		arena.meshOutcodes[i] = outcode(vd.position);
+	}
+	if (state.perVertexLighting) {
+		applyLighting(state, lights, arena.meshCoords.data(), N);
 	}
+	assembleIndexedTriangles(state, mesh.indices.data(), mesh.triangleCount());
 }
 
 /**
- * @fn	std::vector<VertexData> VertexOps::transformVertices(const glm::mat4 &TM, const std::vector<VertexData> & vertices)
- * @brief	Applies a transformation matrix to a vector of vertices. Does not change the worldPosition; copies it over.
- * @param	TM			The transformation matrix.
- * @param	vertices   	The vertices.
- * @return	The transformed vector of vertices.
+ * @fn	void VertexOps::appendCompactTriangles(const RenderState &state, const std::vector<LightSourcePtr> &lights, const CompactMesh &mesh)
+ * @brief	Runs a compact mesh through the vertex stage, appending its window
+ * 			coordinates to the arena's output without drawing them. Positions
+ * 			and decoded normals are transformed as streams, like an IndexedMesh's,
+ * 			and material indices are copied as they are.
+ * @param	state	The state of the draw.
+ * @param	lights	The lights, used when lighting is per vertex.
+ * @param	mesh 	The mesh, in object coordinates.
  */
 
-std::vector<VertexData> VertexOps::transformVertices(const glm::mat4 &TM, const std::vector<VertexData> & vertices) {
-	std::vector<VertexData> transformedVertices;
+void VertexOps::appendCompactTriangles(const RenderState &state, const std::vector<LightSourcePtr> &lights,
+										const CompactMesh &mesh) {
+	const int N = mesh.size();
+	VertexStreams &clip = arena.clipStreams;
+	VertexStreams &world = arena.worldStreams;
+	clip.x = mesh.x;
+	clip.y = mesh.y;
+	clip.z = mesh.z;
+	clip.w.assign(N, 1.0f);
+	world.x = mesh.x;
+	world.y = mesh.y;
+	world.z = mesh.z;
+	world.w.assign(N, 1.0f);
+	world.nx.resize(N);
+	world.ny.resize(N);
+	world.nz.resize(N);
+	for (int i = 0; i < N; i++) {
+		const glm::vec3 n = decodeOctahedral(mesh.normals[i]);
+		world.nx[i] = n.x;
+		world.ny[i] = n.y;
+		world.nz[i] = n.z;
+	}
+	clip.transformPositions(state.modelViewProjectionMatrix);
+	world.transformPositions(state.modelMatrix);
+	world.transformNormals(state.normalMatrix);
+
+	arena.meshCoords.resize(N);
+	arena.meshOutcodes.resize(N);
+	for (int i = 0; i < N; i++) {
+		VertexData &vd = arena.meshCoords[i];
+		vd.position = glm::vec4(clip.x[i], clip.y[i], clip.z[i], clip.w[i]);
+		vd.normal = glm::vec3(world.nx[i], world.ny[i], world.nz[i]);
+		vd.worldPosition = glm::vec3(world.x[i], world.y[i], world.z[i]);
+		vd.materialID = mesh.materials[i];
+		arena.meshOutcodes[i] = outcode(vd.position);
+	}
+	if (state.perVertexLighting) {
+		applyLighting(state, lights, arena.meshCoords.data(), N);
+	}
+	assembleIndexedTriangles(state, mesh.indices.data(), mesh.triangleCount());
+}
 
-	for (VertexData v : vertices) {
-		VertexData vt(TM * v.position, v.normal, v.material);
-		// Save the world position separately for use in per pixel lighting calculations
-		vt.worldPosition = v.worldPosition;
+/**
+ * @fn	void VertexOps::assembleIndexedTriangles(const RenderState &state, const uint32_t *indices, int triangleCount)
+ * @brief	Assembles triangles from the arena's post-transform cache, in index order.
+ * @param	state		 	The state of the draw.
+ * @param	indices		 	Index triplets into the cache, one per triangle.
+ * @param	triangleCount	The number of triangles.
+ */
 
-		transformedVertices.push_back(vt);
+void VertexOps::assembleIndexedTriangles(const RenderState &state, const uint32_t *indices, int triangleCount) {
+	const std::vector<VertexData> &cache = arena.meshCoords;
+	const std::vector<int> &codes = arena.meshOutcodes;
+	for (int t = 0; t < triangleCount; t++, indices += 3) {
+		const uint32_t i0 = indices[0], i1 = indices[1], i2 = indices[2];
+		assembleTriangle(state, cache[i0], cache[i1], cache[i2], codes[i0], codes[i1], codes[i2]);
 	}
-	return transformedVertices;
 }
 
 /**
  * @fn	void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer, const glm::vec3 &eyePos, const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &objectCoords)
- * @brief	Transforms the triangle vertices through pipeline: object -> world -> eye -> clip/ndc -> window.
+ * @brief	Transforms the triangle vertices through pipeline, with the current
+ * 			modeling transformation and settings.
  * @param [in,out]	frameBuffer 	Buffer for frame data.
  * @param 		  	eyePos			The eye position.
  * @param 		  	lights			The lights.
@@ -248,35 +459,7 @@ std::vector<VertexData> VertexOps::transformVertices(const glm::mat4 &TM, const
 void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
 										const std::vector<LightSourcePtr> &lights,
 										const std::vector<VertexData> &objectCoords) {
-	std::vector<VertexData> worldCoords = transformVerticesToWorldCoordinates(modelingTransformation, objectCoords);
-	std::vector<VertexData> eyeCoords = transformVertices(viewingTransformation, worldCoords);
-	glm::mat4 VM = VertexOps::viewingTransformation;
-	std::vector<VertexData> projCoords = transformVertices(projectionTransformation, eyeCoords);
-	std::vector<VertexData> clipCoords;
-	for (VertexData v : projCoords) {		// Perspective division
-		if (v.position.w >= 0)
-			v.position /= v.position.w;
-		else {
-			v.position.x /= -v.position.w;
-			v.position.y /= -v.position.w;
-			v.position.z = -std::abs(v.position.z);
-			v.position.w = 1.0f;
-		}
-		clipCoords.push_back(v);
-	}
-
-	if (!renderBackFaces)	// backface culling?
-		clipCoords = removeBackwardFacingTriangles(clipCoords);	
-
-	std::vector<VertexData> ndcCoords = clipPolygon(clipCoords);
-	std::vector<VertexData> windowCoords = transformVertices(viewportTransformation, ndcCoords);
-
-	for (VertexData &vd : windowCoords) {
-		vd.position.x = glm::clamp(vd.position.x, (float)viewport.lx, (float)viewport.rx);
-		vd.position.y = glm::clamp(vd.position.y, (float)viewport.ly, (float)viewport.ry);
-	}
-
-	drawManyFilledTriangles(frameBuffer, eyePos, lights, windowCoords, viewingTransformation);
+	processTriangleVertices(frameBuffer, currentState(modelingTransformation), lights, objectCoords);
 }
 
 /**
@@ -292,14 +475,50 @@ void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer,
 										const std::vector<LightSourcePtr> &lights,
 										const glm::mat4 &TM,
 										const std::vector<VertexData> &objectCoords) {
-	glm::vec3 eyePos = glm::inverse(VertexOps::viewingTransformation)[3].xyz;
 	VertexOps::modelingTransformation = TM;
-	processTriangleVertices(frameBuffer, eyePos, lights, objectCoords);
+	processTriangleVertices(frameBuffer, currentState(TM), lights, objectCoords);
+}
+
+/**
+ * @fn	void VertexOps::processLineSegments(FrameBuffer &frameBuffer, const RenderState &state, const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &objectCoords)
+ * @brief	Process the line segments through the pipeline, in a single pass. Lines
+ * 			are clipped to the view volume in clip space.
+ * @param [in,out]	frameBuffer 	Frame buffer
+ * @param 		  	state			The state of the draw.
+ * @param 		  	lights			The lights in the scene.
+ * @param 		  	objectCoords	The vector of object coordinates.
+ */
+
+void VertexOps::processLineSegments(FrameBuffer &frameBuffer, const RenderState &state,
+									const std::vector<LightSourcePtr> &lights,
+									const std::vector<VertexData> &objectCoords) {
+	arena.windowCoords.clear();
+
+	for (int i = 0; i < (int)objectCoords.size() - 1; i += 2) {
+		VertexData *segment = arena.polygon[0];
+		segment[0] = transformVertex(state, objectCoords[i]);
+		segment[1] = transformVertex(state, objectCoords[i + 1]);
+		if (state.perVertexLighting) {
+			applyLighting(state, lights, segment, 2);
+		}
+		const int code0 = outcode(segment[0].position);
+		const int code1 = outcode(segment[1].position);
+		if ((code0 & code1 & OUTSIDE_VIEW_VOLUME) ||
+			!clipLineSegment(segment[0], segment[1], (code0 | code1) & OUTSIDE_VIEW_VOLUME)) {
+			continue;
+		}
+		for (int j = 0; j < 2; j++) {		// Perspective division
+			segment[j].position /= segment[j].position.w;
+			emitWindowVertex(state, segment[j]);
+		}
+	}
+	drawManyLines(frameBuffer, state, lights, arena.windowCoords);
 }
 
 /**
  * @fn	void VertexOps::processLineSegments(FrameBuffer &frameBuffer, const glm::vec3 &eyePos, const std::vector<LightSourcePtr> &lights, const std::vector<VertexData> &objectCoords)
- * @brief	Process the line segments through the pipeline.
+ * @brief	Process the line segments through the pipeline, with the current
+ * 			modeling transformation and settings.
  * @param [in,out]	frameBuffer 	Frame buffer
  * @param 		  	eyePos			Eye position.
  * @param 		  	lights			The lights in the scene.
@@ -309,41 +528,197 @@ void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer,
 void VertexOps::processLineSegments(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
 									const std::vector<LightSourcePtr> &lights,
 									const std::vector<VertexData> &objectCoords) {
-	std::vector<VertexData> worldCoords = transformVerticesToWorldCoordinates(modelingTransformation, objectCoords);
-
-	std::vector<VertexData> eyeCoords = transformVertices(viewingTransformation, worldCoords);
-	std::vector<VertexData> projCoords = transformVertices(projectionTransformation, eyeCoords);
-	std::vector<VertexData> clipCoords;
-
-	for (VertexData v : projCoords) {	// Perspective division
-		if (v.position.w >= 0)
-			v.position /= v.position.w;
-		else {
-			v.position /= -v.position.w;
-			v.position.z = -std::abs(v.position.z);
-		}
-		clipCoords.push_back(v);
-	}
-	std::vector<VertexData> ndcCoords = clipLineSegments(clipCoords);
-	std::vector<VertexData> windowCoords = transformVertices(viewportTransformation, ndcCoords);
-	drawManyLines(frameBuffer, eyePos, lights, windowCoords, viewingTransformation);
+	processLineSegments(frameBuffer, currentState(modelingTransformation), lights, objectCoords);
 }
 
 /**
- * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const std::vector<VertexData> verts, const std::vector<LightSourcePtr> &lights, const glm::mat4 &TM)
- * @brief	Renders this object
+ * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const std::vector<VertexData> &verts, const std::vector<LightSourcePtr> &lights, const glm::mat4 &TM)
+ * @brief	Renders this object. Objects outside the view volume, or hidden
+ * 			behind what has been drawn, are skipped before any vertex is
+ * 			transformed. A list of triangles has its bounds found in one pass
+ * 			per draw; an IndexedMesh has them cached.
  * @param [in,out]	frameBuffer	Buffer for frame data.
  * @param 		  	verts	   	The vertices.
  * @param 		  	lights	   	The lights.
  * @param 		  	TM		   	The time.
  */
 
-void VertexOps::render(FrameBuffer &frameBuffer, const std::vector<VertexData> verts,
+void VertexOps::render(FrameBuffer &frameBuffer, const std::vector<VertexData> &verts,
 							const std::vector<LightSourcePtr> &lights,
 							const glm::mat4 &TM) {
-	glm::vec3 eyePos = glm::inverse(VertexOps::viewingTransformation)[3].xyz;
 	VertexOps::modelingTransformation = TM;
-	VertexOps::processTriangleVertices(frameBuffer, eyePos, lights, verts);
+	const RenderState state = currentState(TM);
+	const ObjectBounds bounds(verts);
+	if (isOutsideViewVolume(state, bounds) || isOccluded(frameBuffer, state, bounds)) {
+		return;
+	}
+	VertexOps::processTriangleVertices(frameBuffer, state, lights, verts);
+}
+
+/**
+ * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const IndexedMesh &mesh, const std::vector<LightSourcePtr> &lights, const glm::mat4 &TM)
+ * @brief	Renders an indexed mesh
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	mesh	   	The mesh.
+ * @param 		  	lights	   	The lights.
+ * @param 		  	TM		   	The modeling transformation.
+ */
+
+void VertexOps::render(FrameBuffer &frameBuffer, const IndexedMesh &mesh,
+						const std::vector<LightSourcePtr> &lights,
+						const glm::mat4 &TM) {
+	VertexOps::modelingTransformation = TM;
+	const RenderState state = currentState(TM);
+	if (isOutsideViewVolume(state, mesh.bounds) || isOccluded(frameBuffer, state, mesh.bounds)) {
+		return;
+	}
+	processIndexedTriangles(frameBuffer, state, lights, mesh);
+}
+
+/**
+ * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const CompactMesh &mesh, const std::vector<LightSourcePtr> &lights, const glm::mat4 &TM)
+ * @brief	Renders a compact mesh
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	mesh	   	The mesh.
+ * @param 		  	lights	   	The lights.
+ * @param 		  	TM		   	The modeling transformation.
+ */
+
+void VertexOps::render(FrameBuffer &frameBuffer, const CompactMesh &mesh,
+						const std::vector<LightSourcePtr> &lights,
+						const glm::mat4 &TM) {
+	VertexOps::modelingTransformation = TM;
+	const RenderState state = currentState(TM);
+	if (isOutsideViewVolume(state, mesh.bounds) || isOccluded(frameBuffer, state, mesh.bounds)) {
+		return;
+	}
+	arena.windowCoords.clear();
+	appendCompactTriangles(state, lights, mesh);
+	drawManyFilledTriangles(frameBuffer, state, lights, arena.windowCoords);
+}
+
+/**
+ * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const StaticMesh &mesh, const std::vector<LightSourcePtr> &lights)
+ * @brief	Renders a static mesh from its cached world space vertices.
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	mesh	   	The mesh.
+ * @param 		  	lights	   	The lights.
+ */
+
+void VertexOps::render(FrameBuffer &frameBuffer, const StaticMesh &mesh,
+						const std::vector<LightSourcePtr> &lights) {
+	VertexOps::modelingTransformation = glm::mat4(1.0f);
+	const RenderState state = currentState(glm::mat4(1.0f));
+	const IndexedMesh &world = mesh.worldMesh();
+	if (isOutsideViewVolume(state, world.bounds) || isOccluded(frameBuffer, state, world.bounds)) {
+		return;
+	}
+	processIndexedTriangles(frameBuffer, state, lights, world, true);
+}
+
+/**
+ * @fn	bool VertexOps::isOccluded(const FrameBuffer &frameBuffer, const std::vector<VertexData> &objectCoords, const glm::mat4 &modelMatrix)
+ * @brief	Occlusion query. Projects the object's bounding box onto the window and
+ * 			tests it against the framebuffer's hierarchical Z. Conservative: an
+ * 			object reaching behind the eye is never reported as occluded.
+ * @param	frameBuffer 	The framebuffer.
+ * @param	objectCoords	The object's triangles, in object coordinates.
+ * @param	modelMatrix 	The modeling transformation.
+ * @return	True iff no part of the object can pass the depth test.
+ */
+
+bool VertexOps::isOccluded(const FrameBuffer &frameBuffer, const std::vector<VertexData> &objectCoords,
+							const glm::mat4 &modelMatrix) {
+	return isOccluded(frameBuffer, currentState(modelMatrix), objectCoords);
+}
+
+/**
+ * @fn	bool VertexOps::isOccluded(const FrameBuffer &frameBuffer, const RenderState &state, const std::vector<VertexData> &objectCoords)
+ * @brief	Occlusion query against the framebuffer's hierarchical Z, for a draw's state.
+ * @param	frameBuffer 	The framebuffer.
+ * @param	state			The state of the draw.
+ * @param	objectCoords	The object's triangles, in object coordinates.
+ * @return	True iff no part of the object can pass the depth test.
+ */
+
+bool VertexOps::isOccluded(const FrameBuffer &frameBuffer, const RenderState &state,
+							const std::vector<VertexData> &objectCoords) {
+	return isOccluded(frameBuffer, state, ObjectBounds(objectCoords));
+}
+
+/**
+ * @fn	bool VertexOps::isOccluded(const FrameBuffer &frameBuffer, const RenderState &state, const ObjectBounds &bounds)
+ * @brief	Occlusion query against the framebuffer's hierarchical Z, for an
+ * 			object whose bounds are known.
+ * @param	frameBuffer	The framebuffer.
+ * @param	state	   	The state of the draw.
+ * @param	bounds	   	The object's bounds, in object coordinates.
+ * @return	True iff no part of the object can pass the depth test.
+ */
+
+bool VertexOps::isOccluded(const FrameBuffer &frameBuffer, const RenderState &state,
+							const ObjectBounds &bounds) {
+	if (!state.performDepthTest || bounds.isEmpty()) {
+		return false;
+	}
+
+	const glm::vec3 &lo = bounds.lo;
+	const glm::vec3 &hi = bounds.hi;
+	const glm::mat4 &PVM = state.modelViewProjectionMatrix;
+	float xMin = FLT_MAX, xMax = -FLT_MAX, yMin = FLT_MAX, yMax = -FLT_MAX, zMin = FLT_MAX;
+	for (int i = 0; i < 8; i++) {
+		glm::vec4 corner((i & 1) ? hi.x : lo.x, (i & 2) ? hi.y : lo.y, (i & 4) ? hi.z : lo.z, 1.0f);
+		glm::vec4 clip = PVM * corner;
+		if (clip.w <= 0.0f) {
+			return false;
+		}
+		glm::vec4 window = state.viewportMatrix * (clip / clip.w);
+		xMin = std::min(xMin, window.x);
+		xMax = std::max(xMax, window.x);
+		yMin = std::min(yMin, window.y);
+		yMax = std::max(yMax, window.y);
+		zMin = std::min(zMin, window.z);
+	}
+	return frameBuffer.isRegionOccluded((int)std::floor(xMin), (int)std::ceil(xMax),
+										(int)std::floor(yMin), (int)std::ceil(yMax), zMin);
+}
+
+/**
+ * @fn	bool VertexOps::isOutsideViewVolume(const RenderState &state, const ObjectBounds &bounds)
+ * @brief	Frustum culling of a whole object. The view volume's clip planes are
+ * 			taken back into object coordinates through the modeling-viewing-
+ * 			projection matrix, and the object's sphere, then its box, is tested
+ * 			against each. Conservative: near misses at the frustum's corners are
+ * 			not culled.
+ * @param	state 	The state of the draw.
+ * @param	bounds	The object's bounds, in object coordinates.
+ * @return	True iff the object is entirely outside one of the view volume's planes.
+ */
+
+bool VertexOps::isOutsideViewVolume(const RenderState &state, const ObjectBounds &bounds) {
+	if (bounds.isEmpty()) {
+		return true;
+	}
+	const glm::mat4 &PVM = state.modelViewProjectionMatrix;
+	for (int i = 0; i < CLIP_PLANE_COUNT; i++) {
+		if (!(OUTSIDE_VIEW_VOLUME & (1 << i))) {
+			continue;
+		}
+		// dot(plane, PVM * P) == dot(plane', P), where plane'[c] == dot(plane, PVM[c])
+		const glm::vec4 plane(clipDistance(CLIP_PLANES[i], PVM[0]), clipDistance(CLIP_PLANES[i], PVM[1]),
+								clipDistance(CLIP_PLANES[i], PVM[2]), clipDistance(CLIP_PLANES[i], PVM[3]));
+		const glm::vec3 N(plane.x, plane.y, plane.z);
+		if (glm::dot(N, bounds.center) + plane.w < -bounds.radius * glm::length(N)) {
+			return true;
+		}
+		const glm::vec3 mostInside(N.x >= 0.0f ? bounds.hi.x : bounds.lo.x,
+								N.y >= 0.0f ? bounds.hi.y : bounds.lo.y,
+								N.z >= 0.0f ? bounds.hi.z : bounds.lo.z);
+		if (glm::dot(N, mostInside) + plane.w < 0.0f) {
+			return true;
+		}
+	}
+	return false;
 }
 
 /**
@@ -4,17 +4,43 @@
 #include "FrameBuffer.h"
 #include "Light.h"
 #include "VertexData.h"
+#include "IndexedMesh.h"
+#include "StaticMesh.h"
+#include "CompactMesh.h"
 #include "IScene.h"
 #include "Rasterization.h"
 
+const int MAX_CLIP_VERTS = 16;		//!< Most vertices a clipped polygon may have. A triangle clipped by 6 planes has at most 9.
+const float GUARD_BAND = 8.0f;		//!< Half-size of the guard band, in NDC units. Triangles within it are not clipped in x or y.
+
+/**
+ * @struct	VertexArena
+ * @brief	Scratch storage the vertex stage reuses from draw to draw. Once the
+ * 			output buffer has grown to fit the largest draw, processing vertices
+ * 			does no heap allocation. Each thread has its own, so draws issued
+ * 			from different threads never share scratch space.
+ */
+
+struct VertexArena {
+	std::vector<VertexData> windowCoords;		//!< Output of the vertex stage, in window coordinates.
+	std::vector<VertexData> meshCoords;			//!< Post-transform cache: each vertex of an indexed mesh, in clip coordinates.
+	std::vector<int> meshOutcodes;				//!< Outcode of each vertex in meshCoords.
+	VertexStreams clipStreams;					//!< An indexed mesh's positions, transformed in place to clip coordinates.
+	VertexStreams worldStreams;					//!< An indexed mesh's positions and normals, transformed in place to world coordinates.
+	VertexData polygon[2][MAX_CLIP_VERTS];		//!< Ping-pong buffers for clipping one polygon.
+};
+
 /**
  * @class	VertexOps
  * @brief	Class to encapsulate the methods related to vertex processing.
  */
 
 class VertexOps {
+	friend class RenderQueue;
+	friend class ShadowMap;
 public:
 	static bool renderBackFaces;				//!< Typically false for closed body objects (e.g., sphere).
+	static bool perVertexLighting;				//!< True ==> lit once per vertex and colors interpolated (Gouraud). Typically false.
 	static glm::mat4 modelingTransformation;	//!< Used to orient/scale/position objects. Changed often.
 	static glm::mat4 viewingTransformation;		//!< Orient/position camera.
 	static glm::mat4 projectionTransformation;	//!< Define projection. Typically set just once.
@@ -22,8 +48,10 @@ public:
 
 	static const BoundingBox3D ndc;				//!< normalized device coordinate; the limits
 
-	static std::vector<IPlane> ndcPlanes;		//!< the 6 planes of the 2x2x2 cube.
-
+	static RenderState currentState(const glm::mat4 &modelMatrix);
+	static void processTriangleVertices(FrameBuffer &frameBuffer, const RenderState &state,
+										const std::vector<LightSourcePtr> &lights,
+										const std::vector<VertexData> &objectCoords);
 	static void processTriangleVertices(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
 										const std::vector<LightSourcePtr> &lights,
 										const std::vector<VertexData> &objectCoords);
@@ -31,22 +59,55 @@ public:
 										const std::vector<LightSourcePtr> &lights,
 										const glm::mat4 &TM,
 										const std::vector<VertexData> &objectCoords);
+	static void processIndexedTriangles(FrameBuffer &frameBuffer, const RenderState &state,
+										const std::vector<LightSourcePtr> &lights,
+										const IndexedMesh &mesh, bool worldSpace = false);
+	static void processLineSegments(FrameBuffer &frameBuffer, const RenderState &state,
+									const std::vector<LightSourcePtr> &lights,
+									const std::vector<VertexData> &objectCoords);
 	static void processLineSegments(FrameBuffer &frameBuffer, const glm::vec3 &eyePos,
 									const std::vector<LightSourcePtr> &lights,
 									const std::vector<VertexData> &objectCoords);
-	static void VertexOps::render(FrameBuffer &frameBuffer, const std::vector<VertexData> verts,
+	static void VertexOps::render(FrameBuffer &frameBuffer, const std::vector<VertexData> &verts,
 								const std::vector<LightSourcePtr> &lights,
 								const glm::mat4 &TM);
+	static void render(FrameBuffer &frameBuffer, const IndexedMesh &mesh,
+						const std::vector<LightSourcePtr> &lights,
+						const glm::mat4 &TM);
+	static void render(FrameBuffer &frameBuffer, const CompactMesh &mesh,
+						const std::vector<LightSourcePtr> &lights,
+						const glm::mat4 &TM);
+	static void render(FrameBuffer &frameBuffer, const StaticMesh &mesh,
+						const std::vector<LightSourcePtr> &lights);
+	static bool isOccluded(const FrameBuffer &frameBuffer, const std::vector<VertexData> &objectCoords,
+							const glm::mat4 &modelMatrix);
+	static bool isOccluded(const FrameBuffer &frameBuffer, const RenderState &state,
+							const std::vector<VertexData> &objectCoords);
+	static bool isOccluded(const FrameBuffer &frameBuffer, const RenderState &state,
+							const ObjectBounds &bounds);
+	static bool isOutsideViewVolume(const RenderState &state, const ObjectBounds &bounds);
 	static void setViewport(int left, int right, int bottom, int top);
 	static void setViewport(const BoundingBoxi &vp);
 protected:
 	static BoundingBoxi viewport;			//!< the currently active viewport
 	static void setViewportTransformation();
-	static std::vector<VertexData> clipAgainstPlane(std::vector<VertexData> &verts, const IPlane &plane);
-	static std::vector<VertexData> clipPolygon(const std::vector<VertexData> &clipCoords);
-	static std::vector<VertexData> clipLineSegments(const std::vector<VertexData> &clipCoords);
-	static std::vector<VertexData> removeBackwardFacingTriangles(const std::vector<VertexData> &triangleVerts);
-	static std::vector<VertexData> transformVerticesToWorldCoordinates(const glm::mat4 &modelMatrix, const std::vector<VertexData> &vertices);
-	static void applyLighting(const std::vector<LightSourcePtr> &lights, std::vector<VertexData> &worldCoords);
-	static std::vector<VertexData> transformVertices(const glm::mat4 &TM, const std::vector<VertexData> &vertices);
+	static thread_local VertexArena arena;	//!< Scratch storage of the vertex stage, one per thread
+	static int outcode(const glm::vec4 &P);
+	static VertexData transformVertex(const RenderState &state, const VertexData &v);
+	static void assembleTriangle(const RenderState &state, const VertexData &v0,
+									const VertexData &v1, const VertexData &v2,
+									int code0, int code1, int code2);
+	static int clipAgainstPlane(const VertexData verts[], int count, VertexData output[], const glm::vec4 &plane);
+	static int clipPolygon(VertexData *&polygon, VertexData *&scratch, int count, int planes);
+	static bool clipLineSegment(VertexData &v0, VertexData &v1, int planes);
+	static void emitWindowVertex(const RenderState &state, const VertexData &ndcVertex);
+	static void appendTriangleVertices(const RenderState &state, const std::vector<LightSourcePtr> &lights,
+										const std::vector<VertexData> &objectCoords);
+	static void appendIndexedTriangles(const RenderState &state, const std::vector<LightSourcePtr> &lights,
+										const IndexedMesh &mesh, bool worldSpace = false);
+	static void appendCompactTriangles(const RenderState &state, const std::vector<LightSourcePtr> &lights,
+										const CompactMesh &mesh);
+	static void assembleIndexedTriangles(const RenderState &state, const uint32_t *indices, int triangleCount);
+	static void applyLighting(const RenderState &state, const std::vector<LightSourcePtr> &lights,
+								VertexData verts[], int count);
 };
@@ -0,0 +1,178 @@
+#include "VertexStreams.h"
+#include "Rasterization.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define HAS_X86_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define HAS_X86_SIMD 0
+#endif
+
+static const bool useAVX2 = cpuSupportsAVX2();
+
+/**
+ * @fn	VertexStreams::VertexStreams(const std::vector<VertexData> &verts)
+ * @brief	Splits vertices into position and normal streams.
+ * @param	verts	The vertices.
+ */
+
+VertexStreams::VertexStreams(const std::vector<VertexData> &verts) {
+	const size_t N = verts.size();
+	x.resize(N); y.resize(N); z.resize(N); w.resize(N);
+	nx.resize(N); ny.resize(N); nz.resize(N);
+	for (size_t i = 0; i < N; i++) {
+		const VertexData &v = verts[i];
+		x[i] = v.position.x; y[i] = v.position.y; z[i] = v.position.z; w[i] = v.position.w;
+		nx[i] = v.normal.x; ny[i] = v.normal.y; nz[i] = v.normal.z;
+	}
+}
+
+/**
+ * @fn	static void transformPositionsScalar(const glm::mat4 &M, float *x, float *y, float *z, float *w, int begin, int end)
+ * @brief	Scalar position kernel, for processors without AVX2 and for the
+ * 			vertices left over after the last full vector.
+ * @param 		  	M	 	The matrix.
+ * @param [in,out]	x	 	The x stream.
+ * @param [in,out]	y	 	The y stream.
+ * @param [in,out]	z	 	The z stream.
+ * @param [in,out]	w	 	The w stream.
+ * @param 		  	begin	First vertex to transform.
+ * @param 		  	end  	One past the last vertex to transform.
+ */
+
+static void transformPositionsScalar(const glm::mat4 &M, float *x, float *y, float *z, float *w, int begin, int end) {
+	for (int i = begin; i < end; i++) {
+		const glm::vec4 P = M * glm::vec4(x[i], y[i], z[i], w[i]);
+		x[i] = P.x; y[i] = P.y; z[i] = P.z; w[i] = P.w;
+	}
+}
+
+/**
+ * @fn	static void transformNormalsScalar(const glm::mat3 &N, float *x, float *y, float *z, int begin, int end)
+ * @brief	Scalar normal kernel.
+ * @param 		  	N	 	The matrix.
+ * @param [in,out]	x	 	The x stream.
+ * @param [in,out]	y	 	The y stream.
+ * @param [in,out]	z	 	The z stream.
+ * @param 		  	begin	First normal to transform.
+ * @param 		  	end  	One past the last normal to transform.
+ */
+
+static void transformNormalsScalar(const glm::mat3 &N, float *x, float *y, float *z, int begin, int end) {
+	for (int i = begin; i < end; i++) {
+		const glm::vec3 n = N * glm::vec3(x[i], y[i], z[i]);
+		x[i] = n.x; y[i] = n.y; z[i] = n.z;
+	}
+}
+
+#if HAS_X86_SIMD
+
+/**
+ * @fn	static int transformPositionsAVX2(const glm::mat4 &M, float *x, float *y, float *z, float *w, int count)
+ * @brief	AVX2 position kernel. Each iteration loads 8 vertices from each stream
+ * 			and computes M[0]*x + M[1]*y + M[2]*z + M[3]*w one row at a time, in
+ * 			the same order as glm, so the results match the scalar kernel.
+ * @param 		  	M	 	The matrix.
+ * @param [in,out]	x	 	The x stream.
+ * @param [in,out]	y	 	The y stream.
+ * @param [in,out]	z	 	The z stream.
+ * @param [in,out]	w	 	The w stream.
+ * @param 		  	count	The number of vertices.
+ * @return	The number of vertices transformed, a multiple of 8.
+ */
+
+TARGET_AVX2 static int transformPositionsAVX2(const glm::mat4 &M, float *x, float *y, float *z, float *w, int count) {
+	__m256 m[4][4];
+	for (int c = 0; c < 4; c++) {
+		for (int r = 0; r < 4; r++) {
+			m[c][r] = _mm256_set1_ps(M[c][r]);
+		}
+	}
+	float *streams[4] = { x, y, z, w };
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m256 in[4] = { _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i),
+								_mm256_loadu_ps(z + i), _mm256_loadu_ps(w + i) };
+		for (int r = 0; r < 4; r++) {
+			__m256 out = _mm256_mul_ps(m[0][r], in[0]);
+			out = _mm256_add_ps(out, _mm256_mul_ps(m[1][r], in[1]));
+			out = _mm256_add_ps(out, _mm256_mul_ps(m[2][r], in[2]));
+			out = _mm256_add_ps(out, _mm256_mul_ps(m[3][r], in[3]));
+			_mm256_storeu_ps(streams[r] + i, out);
+		}
+	}
+	return i;
+}
+
+/**
+ * @fn	static int transformNormalsAVX2(const glm::mat3 &N, float *x, float *y, float *z, int count)
+ * @brief	AVX2 normal kernel, 8 normals per iteration.
+ * @param 		  	N	 	The matrix.
+ * @param [in,out]	x	 	The x stream.
+ * @param [in,out]	y	 	The y stream.
+ * @param [in,out]	z	 	The z stream.
+ * @param 		  	count	The number of normals.
+ * @return	The number of normals transformed, a multiple of 8.
+ */
+
+TARGET_AVX2 static int transformNormalsAVX2(const glm::mat3 &N, float *x, float *y, float *z, int count) {
+	__m256 m[3][3];
+	for (int c = 0; c < 3; c++) {
+		for (int r = 0; r < 3; r++) {
+			m[c][r] = _mm256_set1_ps(N[c][r]);
+		}
+	}
+	float *streams[3] = { x, y, z };
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m256 in[3] = { _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), _mm256_loadu_ps(z + i) };
+		for (int r = 0; r < 3; r++) {
+			__m256 out = _mm256_mul_ps(m[0][r], in[0]);
+			out = _mm256_add_ps(out, _mm256_mul_ps(m[1][r], in[1]));
+			out = _mm256_add_ps(out, _mm256_mul_ps(m[2][r], in[2]));
+			_mm256_storeu_ps(streams[r] + i, out);
+		}
+	}
+	return i;
+}
+
+#endif
+
+/**
+ * @fn	void VertexStreams::transformPositions(const glm::mat4 &M)
+ * @brief	Multiplies every position by a matrix, in place.
+ * @param	M	The matrix.
+ */
+
+void VertexStreams::transformPositions(const glm::mat4 &M) {
+	int done = 0;
+#if HAS_X86_SIMD
+	if (useAVX2) {
+		done = transformPositionsAVX2(M, x.data(), y.data(), z.data(), w.data(), size());
+	}
+#endif
+	transformPositionsScalar(M, x.data(), y.data(), z.data(), w.data(), done, size());
+}
+
+/**
+ * @fn	void VertexStreams::transformNormals(const glm::mat3 &N)
+ * @brief	Multiplies every normal by a matrix, in place. For a modeling
+ * 			transformation M, N is the inverse transpose of M's upper 3x3, as in
+ * 			RenderState::normalMatrix. The normals are not renormalized.
+ * @param	N	The normal matrix.
+ */
+
+void VertexStreams::transformNormals(const glm::mat3 &N) {
+	int done = 0;
+#if HAS_X86_SIMD
+	if (useAVX2) {
+		done = transformNormalsAVX2(N, nx.data(), ny.data(), nz.data(), size());
+	}
+#endif
+	transformNormalsScalar(N, nx.data(), ny.data(), nz.data(), done, size());
+}
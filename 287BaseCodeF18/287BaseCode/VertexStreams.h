@@ -0,0 +1,22 @@
+#pragma once
+#include <vector>
+#include "VertexData.h"
+
+/**
+ * @struct	VertexStreams
+ * @brief	Vertex positions and normals as a structure of arrays, so whole
+ * 			streams can be transformed with one matrix, 8 vertices per AVX2
+ * 			instruction. The transforms work in place; copy a mesh's streams
+ * 			into scratch streams first to keep the originals.
+ */
+
+struct VertexStreams {
+	std::vector<float> x, y, z, w;		//!< Positions.
+	std::vector<float> nx, ny, nz;		//!< Normals.
+
+	VertexStreams() {}
+	explicit VertexStreams(const std::vector<VertexData> &verts);
+	int size() const { return (int)x.size(); }
+	void transformPositions(const glm::mat4 &M);
+	void transformNormals(const glm::mat3 &N);
+};
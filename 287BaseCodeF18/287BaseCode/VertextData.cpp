@@ -2,10 +2,26 @@
 #include "Utilities.h"
 
 /**
- * @fn	VertexData::VertexData(const glm::vec4 &pos, const glm::vec3 &norm, const Material &mat, const glm::vec3 &worldPos) : position(pos), normal(glm::normalize(norm)), material(mat), worldPosition(worldPos)
+ * @fn	VertexData::VertexData(const glm::vec4 &pos, const glm::vec3 &norm, MaterialIndex matID, const glm::vec3 &worldPos) : position(pos), normal(glm::normalize(norm)), worldPosition(worldPos), materialID(matID)
  * @brief	Constructor
  * @param	pos			Current coordinate.
  * @param	norm		Normal vector
+ * @param	matID		Index of the material in the MaterialTable.
+ * @param	worldPos	World position.
+ */
+
+VertexData::VertexData(const glm::vec4 &pos,
+				const glm::vec3 &norm,
+				MaterialIndex matID,
+				const glm::vec3 &worldPos) :
+	position(pos), normal(glm::normalize(norm)), worldPosition(worldPos), materialID(matID), litColor(black) {
+}
+
+/**
+ * @fn	VertexData::VertexData(const glm::vec4 &pos, const glm::vec3 &norm, const Material &mat, const glm::vec3 &worldPos)
+ * @brief	Constructor. The material is added to the MaterialTable.
+ * @param	pos			Current coordinate.
+ * @param	norm		Normal vector
  * @param	mat			Material
  * @param	worldPos	World position.
  */
@@ -14,12 +30,14 @@ VertexData::VertexData(const glm::vec4 &pos,
 				const glm::vec3 &norm,
 				const Material &mat,
 				const glm::vec3 &worldPos) :
-	position(pos), normal(glm::normalize(norm)), material(mat), worldPosition(worldPos) {
+	position(pos), normal(glm::normalize(norm)), worldPosition(worldPos), materialID(MaterialTable::add(mat)),
+	litColor(black) {
 }
 
 /**
  * @fn	VertexData::VertexData(float w1, const VertexData &vd1, float w2, const VertexData &vd2)
  * @brief	Constructs object using weighted average of two VertexData objects.
+ * 			Materials aren't blended; the more heavily weighted one is kept.
  * @param	w1 	Weight #1.
  * @param	vd1	VertexData #1.
  * @param	w2 	Weight #2.
@@ -30,8 +48,9 @@ VertexData::VertexData(float w1, const VertexData &vd1,
 					float w2, const VertexData &vd2)
 					: position(weightedAverage(w1, vd1.position, w2, vd2.position)),
 						normal(weightedAverage(w1, vd1.normal, w2, vd2.normal)),
-						material(weightedAverage(w1, vd1.material, w2, vd2.material)),
-						worldPosition(weightedAverage(w1, vd1.worldPosition, w2, vd2.worldPosition)) {
+						worldPosition(weightedAverage(w1, vd1.worldPosition, w2, vd2.worldPosition)),
+						materialID(w1 >= w2 ? vd1.materialID : vd2.materialID),
+						litColor(weightedAverage(w1, vd1.litColor, w2, vd2.litColor)) {
 }
 
 /**
@@ -149,7 +168,8 @@ void VertexData::addConvexPolyVertsAndComputeNormals(std::vector<VertexData> &ve
  */
 
 VertexData operator * (float w, const VertexData &data) {
-	VertexData result(w*data.position, w*data.normal, w*data.material, w*data.worldPosition);
+	VertexData result(w*data.position, w*data.normal, data.materialID, w*data.worldPosition);
+	result.litColor = w*data.litColor;
 	return result;
 }
 
@@ -157,13 +177,13 @@ VertexData operator * (float w, const VertexData &data) {
  * @fn	VertexData VertexData::operator+ (const VertexData &other) const
  * @brief	Addition operator for VertexData objects
  * @param	other	The 2nd VertexData object.
- * @return	The raw summation of the two VertexData objects
+ * @return	The raw summation of the two VertexData objects, with this one's material.
  */
 
 VertexData VertexData::operator + (const VertexData &other) const {
 	VertexData result(*this);
-	result.material += other.material;
 	result.normal += other.normal;
+	result.litColor += other.litColor;
 	result.position += other.position;
 	result.worldPosition += other.worldPosition;
 	return result;